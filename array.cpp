@@ -17,6 +17,8 @@ array::array(size_t size) throw()
     : _size(size)
     , _flags(0)
     , _nativeCode(nullptr)
+    , _entryCount(0)
+    , _backEdgeCount(0)
 { }
 
 array::~array() throw()
@@ -51,6 +53,23 @@ array * array::clone(memoryManager & mm)
     return res;
 }
 
+array * array::moveToOwnPages(memoryManager & mm)
+{
+    array * res = createInt(mm, _size, false, true);
+
+    memcpy(res->platters(), platters(), _size * sizeof(platter));
+
+    res->_flags = _flags | flag::ownPages;
+    res->_nativeCode = _nativeCode;
+    res->_entryCount = _entryCount;
+    res->_backEdgeCount = _backEdgeCount;
+
+    _nativeCode = nullptr;
+    destroy(mm);
+
+    return res;
+}
+
 size_t array::size() const
 {
     return _size;
@@ -69,6 +88,37 @@ void array::dirty(bool v)
         _flags &= ~flag::dirty;
 }
 
+bool array::shared() const
+{
+    return (_flags & flag::shared) != 0;
+}
+
+void array::shared(bool v)
+{
+    if (v)
+        _flags |= flag::shared;
+    else
+        _flags &= ~flag::shared;
+}
+
+bool array::ownPages() const
+{
+    return (_flags & flag::ownPages) != 0;
+}
+
+bool array::writeProtected() const
+{
+    return (_flags & flag::writeProtected) != 0;
+}
+
+void array::writeProtected(bool v)
+{
+    if (v)
+        _flags |= flag::writeProtected;
+    else
+        _flags &= ~flag::writeProtected;
+}
+
 const platter * array::platters() const
 {
     return reinterpret_cast<const platter *>
@@ -111,10 +161,12 @@ nativeCode * array::nativeCode()
     return _nativeCode;
 }
 
-array * array::createInt(memoryManager & mm, size_t size, bool zero)
+array * array::createInt(memoryManager & mm, size_t size, bool zero,
+                         bool ownPages)
 {
     size_t totalSize = _plattersOffset + size * sizeof(platter);
-    void * p = mm.alloc(totalSize, zero);
+    void * p = ownPages ? mm.allocPageAligned(totalSize, _plattersOffset, zero)
+                        : mm.alloc(totalSize, zero);
 
     /*
      * See nativeCode::craete(...) implementation for an exmplanation why 
@@ -48,6 +48,12 @@ public:
      */
     array * clone(memoryManager & mm);
 
+    /*
+     * Moves the platters, the native code block and the flags into a new 
+     * array that has ownPages() set.  This array is destroyed.
+     */
+    array * moveToOwnPages(memoryManager & mm);
+
     size_t size() const;
 
     /*
@@ -57,6 +63,27 @@ public:
     bool dirty() const;
     void dirty(bool v);
 
+    /*
+     * This array is array 0 and at the same time the array it was loaded 
+     * from.  It should be copied before either one is amended, see 
+     * context::unshare().
+     */
+    bool shared() const;
+    void shared(bool v);
+
+    /*
+     * Platters start at a memory page boundary and no other allocation 
+     * shares their pages, so they can be write protected.
+     */
+    bool ownPages() const;
+
+    /*
+     * Platters are write protected, see context::writeProtection(...).  
+     * Only the flag is changed here.
+     */
+    bool writeProtected() const;
+    void writeProtected(bool v);
+
     const platter * platters() const;
     platter * platters();
 
@@ -77,7 +104,8 @@ private:
      * This create(...) is used by both public create(...) and clone(...).  
      * Clone can do with uninitialized memory thus saving on zeroing.
      */
-    static array * createInt(memoryManager & mm, size_t size, bool zero);
+    static array * createInt(memoryManager & mm, size_t size, bool zero,
+                             bool ownPages = false);
 
     /*
      * context::generateNativeCode(...) fills in _jumpTable and _nativeCode 
@@ -85,6 +113,15 @@ private:
      */
     friend class context;
 
+    /* codeCache restores _nativeCode of arrays it loads. */
+    friend class codeCache;
+
+    /* programCache moves _nativeCode between arrays with the same content. */
+    friend class programCache;
+
+    /* Translated code reads and modifies platters inline. */
+    friend struct translatedProgram;
+
     /* Number of platters in this array. */
     size_t _size;
 
@@ -93,7 +130,16 @@ private:
         enum value
         {
             /* dirty() value */
-            dirty = 0x1
+            dirty = 0x1,
+
+            /* shared() value */
+            shared = 0x2,
+
+            /* ownPages() value */
+            ownPages = 0x4,
+
+            /* writeProtected() value */
+            writeProtected = 0x8
         };
 
     private:
@@ -109,6 +155,16 @@ private:
      */
     class nativeCode * _nativeCode;
 
+    /*
+     * Number of times this array was loaded as array 0 and number of 
+     * backward jumps executed in it as array 0.  Used by the 
+     * context::compilation::tiered mode to decide when the array is worth 
+     * compiling.  Counters follow _nativeCode when it is moved between 
+     * arrays.
+     */
+    size_t _entryCount;
+    size_t _backEdgeCount;
+
     /* Actual array of platters comes after the header. */
 };
 
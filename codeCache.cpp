@@ -0,0 +1,236 @@
+#include "codeCache.h"
+
+#include "memoryManager.h"
+#include "array.h"
+#include "nativeCode.h"
+#include "jumpTable.h"
+#include "platter.h"
+#include "utils.h"
+
+#include <cstring>
+#include <vector>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+
+namespace {
+
+    /* Cache file format version is the last two characters. */
+    const char magic[8] = { 'u', 'm', 'c', 'o', 'd', 'e', '0', '1' };
+
+    /* commonStubs value for stubs that are not set. */
+    const unsigned long long noOffset = ~0ull;
+
+    /*
+     * Cache files start with this header.  It is followed by the platters, 
+     * header::codeSize bytes of code and size / 4 + 1 jump table entries, 
+     * each one an unsigned long long offset from the beginning of the code. 
+     * Everything is in the host byte order.
+     */
+    struct header
+    {
+        char magic[8];
+        unsigned long long build;
+        unsigned long long scrollHash;
+        unsigned long long scrollSize;
+        unsigned long long codeSize;
+
+        /* Offsets of jumpTable::commonStub slots 1 to count. */
+        unsigned long long commonStubs[jumpTable::commonStub::count];
+    };
+
+    /*
+     * Native code embeds offsets of the context and array fields and the 
+     * protocol between the code and context::run(), so it may only be reused 
+     * by the same um binary.  The binary is identified by a hash of its own 
+     * file.  Returns zero if there is no way to tell which binary is running.
+     */
+    unsigned long long buildHash()
+    {
+#if defined(__x86_64__) && defined(__linux__)
+        fs::ifstream binary("/proc/self/exe", ios::in | ios::binary);
+        if (!binary.is_open())
+            return 0;
+
+        vector<char> content((istreambuf_iterator<char>(binary)),
+                             istreambuf_iterator<char>());
+        if (content.empty())
+            return 0;
+
+        return contentHash(&content[0], content.size()) | 1;
+#else
+        return 0;
+#endif
+    }
+
+}
+
+codeCache::codeCache(const fs::path & directory)
+    : _directory(directory)
+    , _build(buildHash())
+{
+    fs::create_directories(_directory);
+}
+
+::array * codeCache::load(memoryManager & mm,
+                        const char * scroll, size_t size) const
+{
+    if (!_build || size % 4 != 0)
+        return nullptr;
+
+    unsigned long long scrollHash = contentHash(scroll, size);
+    fs::path file = fileFor(scrollHash);
+
+    boost::system::error_code ec;
+    uintmax_t fileSize = fs::file_size(file, ec);
+    if (ec)
+        return nullptr;
+
+    fs::ifstream in(file, ios::in | ios::binary);
+    if (!in.is_open())
+        return nullptr;
+
+    header h;
+    in.read(reinterpret_cast<char *>(&h), sizeof(h));
+    if (!in
+        || memcmp(h.magic, magic, sizeof(magic)) != 0
+        || h.build != _build
+        || h.scrollHash != scrollHash
+        || h.scrollSize != size)
+        return nullptr;
+
+    size_t platters = size / 4;
+    uintmax_t fixedSize = sizeof(h) + size
+        + (platters + 1) * sizeof(unsigned long long);
+    if (fileSize < fixedSize || h.codeSize != fileSize - fixedSize)
+        return nullptr;
+
+    vector<unsigned long long> offsets(platters + 1);
+    ::array * res = ::array::createInt(mm, platters, false);
+    nativeCode * code =
+        nativeCode::create(mm, static_cast<size_t>(h.codeSize), platters + 1);
+
+    in.read(reinterpret_cast<char *>(res->platters()), size);
+    in.read(code->begin(), code->size());
+    in.read(reinterpret_cast<char *>(&offsets[0]),
+            offsets.size() * sizeof(offsets[0]));
+
+    bool valid = !!in;
+    for (size_t i = 0; valid && i < offsets.size(); ++i)
+        valid = offsets[i] < h.codeSize;
+    for (size_t s = 0; valid && s < jumpTable::commonStub::count; ++s)
+        valid = h.commonStubs[s] < h.codeSize
+                || h.commonStubs[s] == noOffset;
+
+    if (!valid)
+    {
+        code->destroy(mm);
+        res->destroy(mm);
+        return nullptr;
+    }
+
+    jumpTable & jt = *code->jumpTable();
+    for (size_t i = 0; i < offsets.size(); ++i)
+        jt.begin()[i] = code->begin() + offsets[i];
+
+    for (size_t s = 0; s < jumpTable::commonStub::count; ++s)
+    {
+        jt.commonStubAddress(
+            static_cast<jumpTable::commonStub::value>(s + 1),
+            h.commonStubs[s] == noOffset ? nullptr
+                                         : code->begin() + h.commonStubs[s]);
+    }
+
+    res->_nativeCode = code;
+
+    return res;
+}
+
+void codeCache::store(const char * scroll, size_t size, const ::array & a) const
+{
+    const nativeCode * code = a.nativeCode();
+    if (!_build || !code || a.dirty() || size != a.size() * 4)
+        return;
+
+    const char * begin = code->begin();
+    const jumpTable & jt = *code->jumpTable();
+
+    header h;
+    memcpy(h.magic, magic, sizeof(magic));
+    h.build = _build;
+    h.scrollHash = contentHash(scroll, size);
+    h.scrollSize = size;
+    h.codeSize = code->size();
+
+    /*
+     * Only eagerly compiled code that was not executed yet is stored, so 
+     * every address is expected to be inside the block.  Stubs that are not 
+     * used by this compilation mode are not initialized.
+     */
+    for (size_t s = 0; s < jumpTable::commonStub::count; ++s)
+    {
+        const char * stub = static_cast<const char *>(jt.commonStubAddress(
+            static_cast<jumpTable::commonStub::value>(s + 1)));
+
+        h.commonStubs[s] = stub >= begin && stub < begin + code->size()
+                           ? stub - begin : noOffset;
+    }
+
+    vector<unsigned long long> offsets(a.size() + 1);
+    for (size_t i = 0; i < offsets.size(); ++i)
+    {
+        const char * address = static_cast<const char *>(jt.address(i));
+        if (address < begin || address >= begin + code->size())
+            return;
+
+        offsets[i] = address - begin;
+    }
+
+    fs::path file = fileFor(h.scrollHash);
+    /*
+     * Another um could be reading or writing the same file, so it is replaced 
+     * only once it is complete.
+     */
+    boost::system::error_code ec;
+    fs::path temp = file;
+    temp += fs::unique_path(".%%%%-%%%%-%%%%", ec);
+    if (ec)
+        return;
+
+    {
+        fs::ofstream out(temp, ios::out | ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char *>(a.platters()), size);
+        out.write(begin, code->size());
+        out.write(reinterpret_cast<const char *>(&offsets[0]),
+                  offsets.size() * sizeof(offsets[0]));
+        out.close();
+
+        if (!out)
+        {
+            fs::remove(temp, ec);
+            return;
+        }
+    }
+
+    fs::rename(temp, file, ec);
+    if (ec)
+        fs::remove(temp, ec);
+}
+
+fs::path codeCache::fileFor(unsigned long long scrollHash) const
+{
+    static const char digits[] = "0123456789abcdef";
+
+    char name[16 + sizeof(".code")];
+    for (size_t i = 0; i < 16; ++i)
+        name[i] = digits[(scrollHash >> (60 - i * 4)) & 0xF];
+    memcpy(name + 16, ".code", sizeof(".code"));
+
+    return _directory / name;
+}
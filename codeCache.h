@@ -0,0 +1,62 @@
+#ifndef __CODE_CACHE__H
+#define __CODE_CACHE__H
+
+#include <boost/utility.hpp>
+#include <boost/filesystem/path.hpp>
+
+class memoryManager;
+class array;
+
+/*
+ * Keeps native code generated for "program" scrolls in a directory, so that 
+ * the next run of the same scroll does not need to decode or compile it.
+ *
+ * A cache file is named after a hash of the scroll content.  It holds the 
+ * platters of array 0, native code generated for them by 
+ * context::compilation::eager and the jump table with addresses stored as 
+ * offsets from the beginning of the code.  Files written by a different 
+ * build of the um, for a different scroll or damaged in any way are ignored 
+ * and replaced by the next store(...).
+ *
+ * Only x86-64 native code is position independent, so on other platforms 
+ * nothing is ever loaded or stored.
+ */
+class codeCache: boost::noncopyable
+{
+public:
+    /*
+     * Creates `directory' if it does not exist.
+     *
+     * Throws boost::filesystem::filesystem_error if `directory' could not be 
+     * created.
+     */
+    explicit codeCache(const boost::filesystem::path & directory);
+
+    /*
+     * Returns array 0 for the `size' bytes long `scroll' with native code 
+     * already generated, or nullptr if there is no usable cache file for it.
+     */
+    array * load(memoryManager & mm, const char * scroll, size_t size) const;
+
+    /*
+     * Writes native code of `a' into a cache file for `scroll'.  `a' should be 
+     * decoded from `scroll' and compiled by context::compilation::eager, 
+     * but not executed yet.  Errors are ignored, as the cache is just an 
+     * optimization.
+     */
+    void store(const char * scroll, size_t size, const array & a) const;
+
+private:
+    boost::filesystem::path fileFor(unsigned long long scrollHash) const;
+
+private:
+    boost::filesystem::path _directory;
+
+    /*
+     * Identifies the um binary that generates the code.  Zero if code can not 
+     * be cached.
+     */
+    unsigned long long _build;
+};
+
+#endif /* __CODE_CACHE__H */
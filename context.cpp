@@ -1,13 +1,19 @@
 #include "context.h"
 
 #include "jumpTable.h"
+#include "memoryManager.h"
 #include "nativeCode.h"
+#include "decodedPlatters.h"
+#include "nativeCodeProtocol.h"
+#include "utils.h"
 
 #include <algorithm>
 #include <type_traits>
 #include <istream>
 #include <ostream>
+#include <sstream>
 #include <stdexcept>
+#include <cstring>
 
 #include <boost/assert.hpp>
 
@@ -15,107 +21,156 @@
 using namespace std;
 
 
+/*
+ * === context ===
+ */
+
 namespace
 {
+    /* Size of the output buffer native code writes characters into. */
+    const size_t outputBufferSize = 64 * 1024;
 
-    /*
-     * When native code returns it is expected to put one of these values into 
-     * eax to indicate the reason of the return.
-     */
-    namespace nativeCodeReturnValue
-    {
-        enum value
-        {
-            /*
-             * ebx: error code
-             *   0 - normal termination
-             *   1 - invalid operator
-             *   2 - execution beyond array size
-             *
-             * ecx: additional value only valid for the following ebx values
-             *   1 - ecx is a value of the plater that was not decoded
-             */
-            halt            = 1,
-
-            /*
-             * ebx: size of the new array
-             */
-            allocation      = 2,
-
-            /*
-             * ebx: an index of an array to abandon
-             */
-            abandonment     = 3,
+    /* Size of the input buffer native code reads characters from. */
+    const size_t inputBufferSize = 64 * 1024;
 
-            /*
-             * ebx: value to output (should be [0, 255])
-             */
-            output          = 4,
+    /* Default context::flushInterval(...) value. */
+    const unsigned int defaultFlushInterval = 100;
 
-            /*
-             * Upon return into the native code:
-             *      eax should contain a character code that was read [0, 255] 
-             *          or ~0 for EOF
-             */
-            input           = 5,
+    /* Default context::programCacheBudget(...) value. */
+    const size_t defaultProgramCacheBudget = 64 * 1024 * 1024;
 
-            /*
-             * ebx: an index of an array to be copied into array 0
-             * ecx: an index to set the execution finger to
-             */
-            loadProgram     = 6,
+    /*
+     * In the context::compilation::tiered mode array 0 is compiled once it 
+     * was loaded this many times, or once this many backward jumps were 
+     * executed in it.  Interpreting a platter is several times slower than 
+     * running its native code, but compiling a platter takes about as long 
+     * as interpreting it a few dozen times.
+     */
+    const size_t tieredEntryThreshold = 8;
+    const size_t tieredBackEdgeThreshold = 1024;
 
-            /*
-             * This code is returned when execution hits a "recompile stub".  
-             * Array 0 native code should be regenerated and execution should be 
-             * restarted from the same platter.
-             *
-             * Recompile stubs are inserted by array amendment operations that 
-             * amend array 0 itself.  This way we are trying to avoid extra 
-             * recompilations if array 0 is modified in more than one spot 
-             * before the modified code is actually executed.
-             *
-             * Execution finger position is calculated by doing a search in the 
-             * jumpTable for the nativeCode before recompilation.  It is not 
-             * very efficient but reduces stub size.  As stub may replace any 
-             * other operator its size is effectively the minimum size for 
-             * native code blocks generated for other operators.  As 
-             * recompilation of a generated native code should not happen often 
-             * this seems like a reasonable optimization.
-             */
-            recompile       = 7,
-        };
-    };
+    /*
+     * In the context::compilation::traced mode a trace is recorded from a 
+     * platter after this many jumps to it.
+     */
+    const unsigned int traceThreshold = 1024;
 
-    namespace haltReturnCodes
-    {
-        enum value
-        {
-            normalTermination   = 0,
-            invalidOperator     = 1,
-            outOfBoundExecution = 2,
-        };
-    };
+    /* Longer traces are not recorded. */
+    const size_t maxTraceLength = 512;
 }
 
-
-/*
- * === context ===
- */
-
-context::context(memoryManager & mm, istream & is, ostream & os, ::array * zeroArray)
+context::context(memoryManager & mm, istream & is, ostream & os, ::array * zeroArray,
+                 compilation::value compilationMode)
     : _mm(mm)
     , _is(is)
     , _os(os)
-    , _array0Source(0)
-    , _minEmptyArrayIndex(1)
+    , _compilation(compilationMode)
+    , _writeProtection(false)
+    , _boundsChecks(false)
+    , _slotsBase(nullptr)
+    , _programCache(mm, defaultProgramCacheBudget)
+    , _traceTableOffset(0)
 {
     if (!zeroArray)
         throw invalid_argument("zeroArray should not be a null pointer");
 
     _arrays.push_back(zeroArray);
+
+    _freeIndices.resize(_arrays.size());
+
+    _nativeState.freeLists = mm.freeLists();
+    _nativeState.freeIndices = &_freeIndices[0];
+    _nativeState.freeIndexCount = 0;
+    _nativeState.arrayCount = _arrays.size();
+    _nativeState.array0Source = 0;
+    _nativeState.traceCounters = nullptr;
+
+    _outputBuffer.resize(outputBufferSize);
+    _nativeState.outputNext = &_outputBuffer[0];
+    _nativeState.outputEnd = &_outputBuffer[0] + _outputBuffer.size();
+
+    _inputBuffer.resize(inputBufferSize);
+    _nativeState.inputNext = &_inputBuffer[0];
+    _nativeState.inputEnd = &_inputBuffer[0];
+
+    flushInterval(defaultFlushInterval);
+    _lastFlush = boost::posix_time::microsec_clock::universal_time();
+}
+
+context::~context()
+{
+    while (!_protectedArrays.empty())
+        unprotect(*_protectedArrays.back());
+}
+
+void context::flushInterval(unsigned int milliseconds)
+{
+    _flushInterval = boost::posix_time::milliseconds(milliseconds);
+}
+
+void context::programCacheBudget(size_t bytes)
+{
+    _programCache.budget(bytes);
+}
+
+void context::writeProtection(bool enable)
+{
+#if defined(__x86_64__)
+    _writeProtection = enable;
+#else
+    (void) enable;
+#endif
+}
+
+void context::boundsChecks(bool enable)
+{
+    _boundsChecks = enable;
+}
+
+void context::compile()
+{
+    generateNativeCode(*_arrays[0]);
+}
+
+void context::run(translatedCode translated)
+    throw(exceptions::invalidArrayIndex, 
+          exceptions::invalidOperatorFormat)
+{
+    /* Buffered output is written out however run() exits. */
+    struct outputFlusher
+    {
+        context & ctx;
+
+        ~outputFlusher()
+        {
+            ctx.flushOutput();
+        }
+    } flusher = { *this };
+
+    size_t fingerPosition = 0;
+
+    if (translated && !translated(*this, fingerPosition))
+        return;
+
+    switch (_compilation)
+    {
+        case compilation::interpreted:
+            interpret(fingerPosition);
+            break;
+
+        case compilation::tiered:
+            /* Execution moves between the tiers until the machine halts. */
+            while (nativeTier() ? runNative(fingerPosition)
+                                : interpret(fingerPosition))
+                ;
+            break;
+
+        default:
+            runNative(fingerPosition);
+    }
 }
 
+#ifdef _MSC_VER
 #pragma warning( push )
 /*
  * C4731: frame pointer register 'ebp' modified by inline assembly code
@@ -126,19 +181,39 @@ context::context(memoryManager & mm, istream & is, ostream & os, ::array * zeroA
  * With vc10 this warning seems to work only at a function level.
  */
 #pragma warning( disable: 4731 )
+#endif
 
-void context::run() throw(exceptions::invalidArrayIndex, 
-                          exceptions::invalidOperatorFormat)
+bool context::runNative(size_t & fingerPosition)
 {
+    if (!_arrays[0]->nativeCode())
+        generateNativeCode(*_arrays[0]);
+
+    protectArray0();
     ::array * array0 = _arrays[0];
-    generateNativeCode(*array0);
+
+    /* Faults are only expected while native code runs. */
+    struct faultsHandling
+    {
+        context & ctx;
+
+        ~faultsHandling()
+        {
+            ctx.handleFaults(false);
+        }
+    } faults = { *this };
+
+    handleFaults(true);
+
+    if (_compilation == compilation::traced)
+        resetTraceCounters();
 
     size_t eaxValue = 0;
     void * registers = &_registers[0];
 
     void * arrays = &_arrays[0];
     class jumpTable * jumpTable = array0->jumpTable();
-    void * resumeAt = array0->nativeCode()->begin();
+    void * resumeAt = array0->size() ? nativeEntry(*array0, fingerPosition)
+                                     : array0->nativeCode()->begin();
 
     size_t newFingerPosition;
     size_t returnCode; /* eax */
@@ -148,6 +223,12 @@ void context::run() throw(exceptions::invalidArrayIndex,
         size_t value1; /* ebx */
         size_t value2; /* ecx */
 
+#if defined(_M_IX86)
+        /*
+         * Native code returns with "pop edx; call edx", so the address to 
+         * resume at is on the stack.  Unlike the x86-64 enterNativeCode the 
+         * call is not matched by a ret.
+         */
         __asm
         {
             pushad
@@ -172,32 +253,33 @@ void context::run() throw(exceptions::invalidArrayIndex,
 
             popad
         }
+#elif defined(__x86_64__)
+        nativeCodeFrame frame;
+
+        frame.eaxValue  = eaxValue;
+        frame.resumeAt  = resumeAt;
+        frame.registers = registers;
+        frame.arrays    = arrays;
+        frame.jumpTable = jumpTable;
+
+        enterNativeCode(&frame);
+
+        returnCode = frame.returnCode;
+        value1     = frame.value1;
+        value2     = frame.value2;
+        resumeAt   = frame.resumeAt;
+#else
+# error "Native code generation is only implemented for x86 and x86-64."
+#endif
 
         switch (returnCode)
         {
             case nativeCodeReturnValue::halt:
-                switch (value1)
-                {
-                    case haltReturnCodes::normalTermination:
-                        break;
-
-                    case haltReturnCodes::invalidOperator:
-                        _os << endl
-                            << "Invalid operator: "
-                                "0x" << hex << uppercase << value2 << endl;
-                        break;
-
-                    case haltReturnCodes::outOfBoundExecution:
-                        _os << endl
-                            << "Execution beyound array length" << endl;
-                        break;
-
-                    default:
-                        _os << endl
-                            << "Unexpected halt code: "
-                                "0x" << hex << uppercase << value1 << endl;
-                }
-                return;
+                if (value1 == haltReturnCodes::divisionByZero)
+                    value2 = fingerPositionFor(resumeAt);
+
+                halt(value1, value2);
+                return false;
 
             case nativeCodeReturnValue::allocation:
                 eaxValue = allocation(value1);
@@ -209,10 +291,18 @@ void context::run() throw(exceptions::invalidArrayIndex,
                 arrays = &_arrays[0];
                 break;
 
+            case nativeCodeReturnValue::unshare:
+                unshare();
+                break;
+
             case nativeCodeReturnValue::output:
                 output(static_cast<unsigned char>(value1));
                 break;
 
+            case nativeCodeReturnValue::outputString:
+                output(reinterpret_cast<const char *>(value1), value2);
+                break;
+
             case nativeCodeReturnValue::input:
                 eaxValue = input();
                 break;
@@ -222,632 +312,1298 @@ void context::run() throw(exceptions::invalidArrayIndex,
 
                 loadProgram(value1);
 
-                array0 = _arrays[0];
-
-                if (newFingerPosition >= array0->size())
+                if (newFingerPosition >= _arrays[0]->size())
                     throw exceptions::invalidArrayIndex
                         (L"loadProgram index out of range", newFingerPosition);
 
+                if (_compilation == compilation::tiered && !nativeTier())
+                {
+                    fingerPosition = newFingerPosition;
+                    return true;
+                }
+
+                /* nativeTier() may have just compiled the new array 0. */
+                protectArray0();
+                array0 = _arrays[0];
+
+                if (_compilation == compilation::traced)
+                    resetTraceCounters();
+
                 jumpTable = array0->jumpTable();
-                resumeAt = jumpTable->address(newFingerPosition);
+                resumeAt = nativeEntry(*array0, newFingerPosition);
                 break;
 
             case nativeCodeReturnValue::recompile:
                 newFingerPosition = fingerPositionFor(resumeAt);
 
-                generateNativeCode(*array0);
+                recompilePlatter(*array0, newFingerPosition);
 
                 jumpTable = array0->jumpTable();
-                resumeAt = jumpTable->address(newFingerPosition);
+                resumeAt = nativeEntry(*array0, newFingerPosition);
+                break;
+
+            case nativeCodeReturnValue::compile:
+                BOOST_ASSERT(value1 < array0->size());
+
+                resumeAt = nativeEntry(*array0, value1);
+                break;
+
+            case nativeCodeReturnValue::trace:
+                BOOST_ASSERT(value1 < array0->size());
+
+                newFingerPosition = traceFrom(*array0, value1);
+                resumeAt = nativeEntry(*array0, newFingerPosition);
                 break;
 
+            case nativeCodeReturnValue::invalidIndex:
+                checkIndex(value2, value1, fingerPositionFor(resumeAt));
+
+                /* Native code only returns if the check failed. */
+                BOOST_ASSERT(false);
+                return false;
+
             default:
+                flushOutput();
+
                 _os << endl
                     << "Unexpected native code return: "
                                 "0x" << hex << uppercase << returnCode << endl;
-                return;
+                return false;
         }
+
+        /* After output(...), so that a new line is written when it is due. */
+        flushOutputIfDue();
     }
 }
+#ifdef _MSC_VER
 #pragma warning( pop )
+#endif
 
-size_t context::fingerPositionFor(void * returnAddress)
+void context::halt(size_t haltCode, size_t value)
 {
-    ::array & array0 = *_arrays[0];
+    flushOutput();
 
-    BOOST_ASSERT(array0.size() > 0);
+    switch (haltCode)
+    {
+        case haltReturnCodes::normalTermination:
+            break;
 
-    void ** begin = array0.jumpTable()->begin();
-    void ** end   = begin + array0.size() - 1;
+        case haltReturnCodes::invalidOperator:
+            _os << endl
+                << "Invalid operator: "
+                    "0x" << hex << uppercase << value << endl;
+            break;
 
-    void ** platter = lower_bound(begin, end, returnAddress);
+        case haltReturnCodes::outOfBoundExecution:
+            _os << endl
+                << "Execution beyound array length" << endl;
+            break;
 
-    /*
-     * As return address should never be the very first byte of an array native 
-     * code we should never get begin as a result.
-     */
-    BOOST_ASSERT(platter > begin);
+        case haltReturnCodes::divisionByZero:
+            _os << endl
+                << "Division by zero at platter " << value << endl
+                << "Registers:";
+            for (size_t i = 0; i < _registers.size(); ++i)
+                _os << " 0x" << hex << uppercase
+                    << static_cast<unsigned int>(_registers[i]) << dec;
+            _os << endl
+                << "Array 0: " << _arrays[0]->size() << " platters, hash 0x"
+                << hex << uppercase << contentHash(_arrays[0]->platters(),
+                                                   _arrays[0]->size()
+                                                   * sizeof(platter))
+                << dec << endl;
+            break;
 
-    return platter - begin - 1;
+        default:
+            _os << endl
+                << "Unexpected halt code: "
+                    "0x" << hex << uppercase << haltCode << endl;
+    }
 }
 
-/*
- * --- Code generation helper macros ---
- *
- * Used by codeFor and codeForOOBStub.
- *
- * Expect to, curr and size to be in scope.
- */
-
-/*
- * STR is expected to be a litteral string constant and thus include a trailing 
- * zero bytes that is not copied in the output.
- */
-#define EMIT_BYTES(STR)                         \
-    if (to)                                     \
-    {                                           \
-        memcpy(curr, STR, sizeof(STR) - 1);     \
-        curr += sizeof(STR) - 1;                \
-    }                                           \
-    size += sizeof(STR) - 1;                    \
-    /* */
-
-#define EMIT_REGISTER_AS_BYTE_DISP(REG)                         \
-    if (to)                                                     \
-    {                                                           \
-        *curr = static_cast<char>(REG * sizeof(unsigned int));  \
-        ++curr;                                                 \
-    }                                                           \
-    ++size;                                                     \
-    /* */
-
-#define EMIT_BYTE(VALUE)                                        \
-    if (to)                                                     \
-    {                                                           \
-        *reinterpret_cast<unsigned char *>(curr) = VALUE;       \
-        ++curr;                                                 \
-    }                                                           \
-    ++size;                                                     \
-    /* */
-
-#define EMIT_WORD(VALUE)                                        \
-    if (to)                                                     \
-    {                                                           \
-        *reinterpret_cast<unsigned int *>(curr) = VALUE;        \
-        curr += sizeof(unsigned int);                           \
-    }                                                           \
-    size += sizeof(unsigned int);                               \
-    /* */
-
-size_t context::codeFor(const platter & p, char * to)
+bool context::nativeTier()
 {
-    /*
-     * Native code assumes:
-     *
-     * ESI - pointer to the registers array [8 32-bit values]
-     * EDI - pointer to the collection of array pointers
-     * EBP - jump table first entry address
-     */
+    ::array & array0 = *_arrays[0];
 
-    unsigned int A, B, C, value;
+    if (array0._nativeCode)
+        return true;
 
-    size_t size = 0;
-    char * curr = to;
+    if (array0._entryCount < tieredEntryThreshold
+        && array0._backEdgeCount < tieredBackEdgeThreshold)
+        return false;
 
-    size_t jmpSource = 0;
+    generateNativeCode(array0);
+    return true;
+}
 
-    /*
-     * Any instruction should be compiled into at least this many bytes so that 
-     * it can always be overwritten by a recompile stub in case the code in the 
-     * array 0 will decide to modify itself.
-     */
-    const size_t recompileStubSize = 7;
+void * context::platterAddress(::array & a, size_t i)
+{
+    if (_compilation == compilation::strided)
+        return a.nativeCode()->begin() + i * codeStride;
 
-    platter::operator_::value op;
-    try
-    {
-        op = p.decode(A, B, C, value);
-    }
-    catch (const exceptions::invalidOperatorFormat & /* ex */)
+    return a.jumpTable()->address(i);
+}
+
+void * context::nativeEntry(::array & a, size_t i)
+{
+    if (_compilation == compilation::lazy)
     {
-        static_assert(nativeCodeReturnValue::halt == 1,
-                      "halt value is encoded below.  If it changes "
-                      "the value below should be updated.");
-        static_assert(haltReturnCodes::invalidOperator == 1,
-                      "invalidOperator value is encoded below.  If it changes "
-                      "the value below should be update.");
+        class jumpTable * jumpTable = a.jumpTable();
 
-        /* eax: nativeCodeReturnValue::halt */
-        EMIT_BYTES("\x31\xC0"               /* xor eax, eax             */
-                   "\xB0\x01"               /* mov al, imm8             */
-                                   /* imm8: nativeCodeReturnValue::halt */
-        /* ecx: 1 - invalid operator */
-                   "\x31\xDB"               /* xor ebx, ebx             */
-                   "\xB3\x01"               /* mov bl, imm8             */
-                              /* imm8: haltReturnCodes::invalidOperator */
-        /* edx: Invalid platter value */
-                   "\xB9");                 /* mov ecx, imm32           */
-        EMIT_WORD(p);
-        /* return */
-        EMIT_BYTES("\x5A"                   /* pop edx                  */
-                   "\xFF\xD2");             /* call edx                 */
+        if (jumpTable->address(i)
+            == jumpTable->commonStubAddress(jumpTable::commonStub::compile))
+            compileBlock(a, i);
+    }
 
-        BOOST_ASSERT(size >= recompileStubSize);
+    return platterAddress(a, i);
+}
 
-        return size;
-    }
+size_t context::fingerPositionFor(void * returnAddress)
+{
+    ::array & array0 = *_arrays[0];
 
-    switch (op)
-    {
-        case platter::operator_::conditionalMove:
-            /* ecx: C */
-            EMIT_BYTES("\x8B\x4E");         /* mov ecx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+    BOOST_ASSERT(array0.size() > 0);
 
-            /* if (C != 0) { */
-            EMIT_BYTES("\xE3\x06");         /* jcxz rel8 (6)            */
-            jmpSource = size;
+    /*
+     * Recompiled platters may be anywhere, as they do not keep the order of 
+     * the rest of the code.
+     */
+    size_t recompiled;
+    if (array0.nativeCode()->outOfLinePlatter(returnAddress, recompiled))
+        return recompiled;
 
-            /*     eax: B */
-            EMIT_BYTES("\x8B\x46");         /* mov eax, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
-            /*     A = B */
-            EMIT_BYTES("\x89\x46");         /* mov [esi + disp8], eax   */
-            EMIT_REGISTER_AS_BYTE_DISP(A);  /*     [esi + A]            */
-            /* } */
-            BOOST_ASSERT(jmpSource + 6 == size);
+    if (_compilation == compilation::strided)
+    {
+        char * slots = array0.nativeCode()->begin();
+        char * slotsEnd = slots + array0.size() * codeStride;
 
-            BOOST_ASSERT(size >= recompileStubSize);
+        BOOST_ASSERT(returnAddress > slots);
 
-            break;
-            
-        case platter::operator_::arrayIndex:
-            /* ebx: B */
-            EMIT_BYTES("\x8B\x5E");         /* mov ebx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
-            /* eax: array[B] */
-            EMIT_BYTES("\x8B\x04\x9F");     /* mov eax, [edi + ebx * 4] */
-            /* ecx: C */
-            EMIT_BYTES("\x8B\x4E");         /* mov ecx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
-            /* eax: array[B]->platters()[C] */
-            EMIT_BYTES("\x8B\x44\x88");    
-                          /* mov eax, [eax + ecx * 4 + disp8]           */
-                          /*          [eax + ecx * 4 + <first platter>] */
-            EMIT_BYTE(::array::_plattersOffset);     /* <first platter> */
-            BOOST_ASSERT(::array::_plattersOffset < 256);
-
-            /* A = array[B]->platters()[C] */
-            EMIT_BYTES("\x89\x46");         /* mov [esi + disp8], eax   */
-            EMIT_REGISTER_AS_BYTE_DISP(A);  /*     [esi + A]            */
-
-            BOOST_ASSERT(size >= recompileStubSize);
+        if (returnAddress <= slotsEnd)
+            return (static_cast<char *>(returnAddress) - slots - 1)
+                   / codeStride;
 
-            break;
+        /*
+         * Code that does not fit into its slot is put after the slots, and 
+         * the slot starts with a branch to it, see codeForBranch(...).  The 
+         * return address belongs to the platter with the closest out of line 
+         * code before it.
+         */
+        size_t platter = 0;
+        const char * closest = nullptr;
 
-        case platter::operator_::arrayAmendment:
-            /* ecx: A */
-            EMIT_BYTES("\x8B\x4E");         /* mov ecx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(A);  /*          [esi + A]       */
-            /* ebx: B */
-            EMIT_BYTES("\x8B\x5E");         /* mov ebx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
-            /* edx: C */
-            EMIT_BYTES("\x8B\x56");         /* mov edx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
-
-            /* eax: array[A] */
-            EMIT_BYTES("\x8B\x04\x8F");     /* mov eax, [edi + ecx * 4] */
-
-            /* array[A]->_flags |= dirty */
-            EMIT_BYTES("\x83\x88");         /* or [eax + disp32], imm8  */
-            EMIT_WORD(static_cast<unsigned int>(offsetof(::array, _flags)));
-                                            /*    [eax + array::_flags] */
-            EMIT_BYTE(static_cast<unsigned char>(::array::flag::dirty));
-                                            /* imm8: array::flag::dirty */
-
-            /* array[A]->platters()[B] = C */
-            EMIT_BYTES("\x89\x54\x98");    
-                               /* mov [eax + ebx * 4 + disp8], edx      */
-                               /*     [eax + ebx * 4 + <first platter>] */
-            EMIT_BYTE(::array::_plattersOffset);     /* <first platter> */
-            BOOST_ASSERT(::array::_plattersOffset < 256);
-
-            /* if (A == 0) { */
-            EMIT_BYTES("\x83\xF9\x00");     /* cmp ecx, imm8 (0)        */
-            EMIT_BYTES("\x75\x13");         /* jnz rel8: 19             */
-            jmpSource = size;
-
-            /*     eax: jumpTable[B] */
-            EMIT_BYTES("\x8B\x44\x9D\x00"); 
-                                 /* mov eax, [ebp + ebx * 4 + disp8(0)] */
+        for (size_t i = 0; i < array0.size(); ++i)
+        {
+            const char * slot = slots + i * codeStride;
+            if (static_cast<unsigned char>(slot[0]) != 0xE9)
+                continue;
+
+            int rel;
+            memcpy(&rel, slot + 1, sizeof(rel));
+
+            const char * target = slot + 5 + rel;
+            if (target >= slotsEnd && target < returnAddress
+                && (!closest || target > closest))
+            {
+                closest = target;
+                platter = i;
+            }
+        }
 
-            /*
-             *     *eax = asm {
-             *                  xor eax, eax
-             *                  mov al, imm8
-             *                   ... nativeCodeReturnValue::recompile
-             *                  pop edx
-             *                  call edx
-             *            }
-             */
+        BOOST_ASSERT(closest);
 
-            static_assert(nativeCodeReturnValue::recompile == 7,
-                          "recompile is encoded in the code below.  If it "
-                          "value changes code below should be updated.");
-            /*
-             * 31 C0             xor eax, eax
-             * B0 07             mov al, imm8 - B0+ al(0)
-             *                            nativeCodeReturnValue::recompile
-             * 5A                pop edx
-             * FF D2             (near abs) call edx
-             */
+        return platter;
+    }
 
-            EMIT_BYTES("\xC7\x00\x31\xC0\xB0\x00"
-                                       /* mov [eax], imm32 (0x31C0B000) */
+    void ** begin = array0.jumpTable()->begin();
+    void ** end   = begin + array0.size() - 1;
 
-                       "\xC7\x40\x03\x07\x5A\xFF\xD2"
-                            /* mov [eax + disp8(3)], imm32 (0x075AFFD2) */
+    if (_compilation == compilation::lazy)
+    {
+        /*
+         * Lazily compiled blocks are not ordered, but the return address is 
+         * still closer to the code of the platter that set it than to the 
+         * code of any other platter that starts before it.
+         */
+        void ** platter = nullptr;
+        for (void ** i = begin; i <= end; ++i)
+            if (*i < returnAddress && (!platter || *i > *platter))
+                platter = i;
+
+        BOOST_ASSERT(platter);
+
+        return platter - begin;
+    }
 
-            /*     jmp rel8 (0) */
-                       "\xEB\x00");
+    /* end is the last platter entry, not the one after it. */
+    void ** platter = lower_bound(begin, end + 1, returnAddress);
 
-            /* } */
-            BOOST_ASSERT(jmpSource + 19 == size);
+    /*
+     * As return address should never be the very first byte of an array native 
+     * code we should never get begin as a result.
+     */
+    BOOST_ASSERT(platter > begin);
 
-            BOOST_ASSERT(size >= recompileStubSize);
+    return platter - begin - 1;
+}
 
-            break;
+void context::generateNativeCode(::array & a, size_t entry)
+{
+    if (a._nativeCode)
+    {
+        a._nativeCode->destroy(_mm);
+        a._nativeCode = nullptr;
+    }
 
-        case platter::operator_::addition:
-            /* eax: B */
-            EMIT_BYTES("\x8B\x46");         /* mov eax, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
-            /* eax: B + C */
-            EMIT_BYTES("\x03\x46");         /* add eax, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
-            /* A = B + C */
-            EMIT_BYTES("\x89\x46");         /* mov [esi + disp8], eax   */
-            EMIT_REGISTER_AS_BYTE_DISP(A);  /*     [esi + A]            */
-
-            BOOST_ASSERT(size >= recompileStubSize);
+    a.dirty(false);
 
-            break;
+    if (_compilation == compilation::strided)
+    {
+        generateStridedNativeCode(a);
+        return;
+    }
 
-        case platter::operator_::multiplication:
-            /* eax: B */
-            EMIT_BYTES("\x8B\x46");         /* mov eax, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
-            /* eax: B * C */
-            EMIT_BYTES("\xF7\x66");       /* mul edx:eax, [esi + disp8] */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*            [esi + C]     */
-            /* A = B * C */
-            EMIT_BYTES("\x89\x46");         /* mov [esi + disp8], eax   */
-            EMIT_REGISTER_AS_BYTE_DISP(A);  /*     [esi + A]            */
-
-            BOOST_ASSERT(size >= recompileStubSize);
+    if (_compilation == compilation::lazy)
+    {
+        /*
+         * Out of bound stub is still at the very beginning, so that an empty 
+         * array starts execution there.
+         */
+        size_t nativeCodeSize = codeForOOBStub(nullptr)
+                                + codeForCommonStubs(nullptr, nullptr);
 
-            break;
+        a._nativeCode = nativeCode::create(_mm, nativeCodeSize, a.size() + 1);
 
-        case platter::operator_::division:
-            /* eax: B */
-            EMIT_BYTES("\x8B\x46");         /* mov eax, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
-            /* edx: 0 */
-            EMIT_BYTES("\x31\xD2");         /* xor edx, edx             */
-            /* eax: B / C */
-            EMIT_BYTES("\xF7\x76");       /* div edx:eax, [esi + disp8] */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*            [esi + C]     */
-            /* A = B / C */
-            EMIT_BYTES("\x89\x46");         /* mov [esi + disp8], eax   */
-            EMIT_REGISTER_AS_BYTE_DISP(A);  /*     [esi + A]            */
-
-            BOOST_ASSERT(size >= recompileStubSize);
+        class jumpTable * jumpTable = a._nativeCode->jumpTable();
 
-            break;
+        char * nativeCode = a._nativeCode->begin();
+        jumpTable->begin()[a.size()] = nativeCode;
+        nativeCode += codeForOOBStub(nativeCode);
+        nativeCode += codeForCommonStubs(nativeCode, jumpTable);
 
-        case platter::operator_::notAnd:
-            /* eax: B */
-            EMIT_BYTES("\x8B\x46");         /* mov eax, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
-            /* eax: B & C */
-            EMIT_BYTES("\x23\x46");         /* and eax, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
-            /* eax: ~(B & C) */
-            EMIT_BYTES("\xF7\xD0");         /* not eax                  */
-            /* A = ~(B & C) */
-            EMIT_BYTES("\x89\x46");         /* mov [esi + disp8], eax   */
-            EMIT_REGISTER_AS_BYTE_DISP(A);  /*     [esi + A]            */
-
-            BOOST_ASSERT(size >= recompileStubSize);
+        fill(jumpTable->begin(), jumpTable->begin() + a.size(),
+             jumpTable->commonStubAddress(jumpTable::commonStub::compile));
 
-            break;
+        return;
+    }
 
-        case platter::operator_::halt:
+    /* Trace table follows the jump table. */
+    size_t slotCount = a.size() + 1;
+    _traceTableOffset = slotCount * sizeof(void *);
+    if (_compilation == compilation::traced)
+        slotCount *= 2;
 
-            static_assert(nativeCodeReturnValue::halt == 1,
-                          "halt value is encoded below.  If it changes "
-                          "the value below should be updated.");
-            static_assert(haltReturnCodes::normalTermination == 0,
-                          "normalTermination value is encoded below.  If it "
-                          "changes the value below should be update.");
-
-            /* eax: nativeCodeReturnValue::halt */
-            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
-                       "\xB0\x01"           /* mov al, imm8             */
-                                   /* imm8: nativeCodeReturnValue::halt */
-            /* ebx: 0 - normal termination */
-                       "\x31\xDB"           /* xor ebx, ebx             */
-            /* return */
-                       "\x5A"               /* pop edx                  */
-                       "\xFF\xD2");         /* call edx                 */
-
-            BOOST_ASSERT(size >= recompileStubSize);
+    vector<bool> code;
+    classifyPlatters(decodedPlatters(a), entry, code);
 
-            break;
+    /* Precalculate native code size */
+    rangePlan plan;
+    size_t nativeCodeSize = planRange(a, 0, a.size(), plan, &code);
 
-        case platter::operator_::allocation:
+    /* Stub to prevent execution beyond array length */
+    nativeCodeSize += codeForOOBStub(nullptr);
 
-            static_assert(nativeCodeReturnValue::allocation == 2,
-                          "allocation value is encoded below.  If it "
-                          "changes the value below should be updated.");
+    nativeCodeSize += codeForCommonStubs(nullptr, nullptr);
 
-            /* eax: nativeCodeReturnValue::allocation */
-            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
-                       "\xB0\x02"           /* mov al, imm8             */
-                             /* imm8: nativeCodeReturnValue::allocation */
-            /* ebx: C */
-                       "\x8B\x5E");         /* mov ebx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+    a._nativeCode = nativeCode::create(_mm, nativeCodeSize, slotCount);
 
-            /* return */
-            EMIT_BYTES("\x5A"               /* pop edx                  */
-                       "\xFF\xD2"           /* call edx                 */
+    char * nativeCode = a._nativeCode->begin();
 
-            /* B: eax (new array index) */
-                       "\x89\x46");         /* mov [esi + disp8], eax   */
-            EMIT_REGISTER_AS_BYTE_DISP(B);  /*     [esi + B]            */
+    nativeCode += codeForRange(a, plan, nativeCode,
+                               a._nativeCode->jumpTable()->begin());
 
-            BOOST_ASSERT(size >= recompileStubSize);
+    a._nativeCode->jumpTable()->begin()[a.size()] = nativeCode;
+    nativeCode += codeForOOBStub(nativeCode);
 
-            break;
+    nativeCode += codeForCommonStubs(nativeCode, a._nativeCode->jumpTable());
 
-        case platter::operator_::abandonment:
+    if (_compilation == compilation::traced)
+    {
+        class jumpTable * jumpTable = a._nativeCode->jumpTable();
+        void ** traces = traceTable(a);
 
-            static_assert(nativeCodeReturnValue::abandonment == 3,
-                          "abandonment value is encoded below.  If it "
-                          "changes the value below should be updated.");
+        fill(traces, traces + a.size(),
+             jumpTable->commonStubAddress(jumpTable::commonStub::profile));
+        traces[a.size()] = jumpTable->address(a.size());
+    }
+}
 
-            /* eax: nativeCodeReturnValue::abandonment */
-            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
-                       "\xB0\x03"           /* mov el, imm8             */
-                            /* imm8: nativeCodeReturnValue::abandonment */
-            /* ebx: C */
-                       "\x8B\x5E");         /* mov ebx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+void context::generateStridedNativeCode(::array & a)
+{
+    fusedRun run;
 
-            /* return */
-            EMIT_BYTES("\x5A"               /* pop edx                  */
-                       "\xFF\xD2");         /* call edx                 */
+    /*
+     * Fused runs are compiled into the slot of the first run platter.  Other 
+     * run platters get regular code.
+     */
+    size_t runEnd = 0;
 
-            BOOST_ASSERT(size >= recompileStubSize);
+    knownRegisters known = knownRegisters();
+    directJump jump;
 
-            break;
+    size_t branchSize = codeForBranch(nullptr, nullptr);
 
-        case platter::operator_::output:
+    /* Precalculate size of the code that does not fit into slots */
+    size_t outOfLineSize = 0;
+    for (size_t i = 0, len = a.size(); i < len; ++i)
+    {
+        bool isDirect = directJumpFor(a[i], known, len, jump);
+        propagateConstants(a[i], known);
 
-            static_assert(nativeCodeReturnValue::output == 4,
-                          "output value is encoded below.  If it "
-                          "changes the value below should be updated.");
+        size_t size = codeFor(a[i], nullptr, isDirect ? &jump : nullptr);
 
-            /* eax: nativeCodeReturnValue::output */
-            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
-                       "\xB0\x04"           /* mov el, imm8             */
-                                 /* imm8: nativeCodeReturnValue::output */
-            /* ebx: C */
-                       "\x8B\x5E");         /* mov ebx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+        if (i >= runEnd && fusedRunAt(a, i, len, run))
+        {
+            size += codeForFusedRun(run, nullptr, nullptr);
+            runEnd = i + run.length;
+        }
 
-            /* return */
-            EMIT_BYTES("\x5A"               /* pop edx                  */
-                       "\xFF\xD2");         /* call edx                 */
+        if (size > codeStride)
+            outOfLineSize += size + branchSize;
+    }
 
-            BOOST_ASSERT(size >= recompileStubSize);
+    /* Slots, plus the out of bound stub that is in the slot after the last. */
+    size_t nativeCodeSize = a.size() * codeStride
+                            + codeForOOBStub(nullptr)
+                            + codeForCommonStubs(nullptr, nullptr)
+                            + outOfLineSize;
 
-            break;
+    a._nativeCode = nativeCode::create(_mm, nativeCodeSize, 0);
 
-        case platter::operator_::input:
+    _slotsBase = a._nativeCode->begin();
 
-            static_assert(nativeCodeReturnValue::input == 5,
-                          "input value is encoded below.  If it "
-                          "changes the value below should be updated.");
+    char * outOfLine = _slotsBase + a.size() * codeStride;
+    outOfLine += codeForOOBStub(outOfLine);
+    outOfLine += codeForCommonStubs(outOfLine, a._nativeCode->jumpTable());
 
-            /* eax: nativeCodeReturnValue::input */
-            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
-                       "\xB0\x05"           /* mov al, imm8             */
-                                  /* imm8: nativeCodeReturnValue::input */
+    runEnd = 0;
+    known = knownRegisters();
+    for (size_t i = 0, len = a.size(); i < len; ++i)
+    {
+        char * slot = _slotsBase + i * codeStride;
+        char * slotEnd = slot + codeStride;
 
-                       "\x5A"               /* pop edx                  */
-                       "\xFF\xD2"           /* call edx                 */
+        bool runStart = i >= runEnd && fusedRunAt(a, i, len, run);
 
-            /* C = <input char> */
-                       "\x89\x46");         /* mov [esi + disp8], eax   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*     [esi + C]            */
+        bool isDirect = directJumpFor(a[i], known, len, jump);
+        propagateConstants(a[i], known);
 
-            BOOST_ASSERT(size >= recompileStubSize);
+        size_t size = codeFor(a[i], nullptr, isDirect ? &jump : nullptr);
+        if (runStart)
+        {
+            size += codeForFusedRun(run, nullptr, nullptr);
+            runEnd = i + run.length;
+        }
 
-            break;
+        char * curr = size <= codeStride ? slot : outOfLine;
 
-        case platter::operator_::loadProgram:
+        if (runStart)
+            curr += codeForFusedRun(run, _slotsBase + runEnd * codeStride,
+                                     curr);
 
-            static_assert(nativeCodeReturnValue::loadProgram == 6,
-                          "loadProgram value is encoded below.  If it "
-                          "changes the value below should be updated.");
+        curr += codeFor(a[i], curr, isDirect ? &jump : nullptr);
 
-            /* ebx: B */
-            EMIT_BYTES("\x8B\x5E");         /* mov ebx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
+        /* Slot addresses are known in advance. */
+        if (isDirect)
+            codeForBranch(_slotsBase + jump.target * codeStride, jump.branch);
 
-            /* ecx: C */
-            EMIT_BYTES("\x8B\x4E");         /* mov ecx, [esi + disp8]   */
-            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+        if (size <= codeStride)
+        {
+            codeForPadding(slotEnd - curr, curr);
+            continue;
+        }
 
-            /* if (B == 0) { */
-            EMIT_BYTES("\x83\xFB\x00");     /* cmp ebx, imm8 (0)        */
-            EMIT_BYTES("\x75\x06");         /* jnz rel8: 6              */
-            jmpSource = size;
+        /* All the code is in one block, so branches always reach. */
+        curr += codeForBranch(slotEnd, curr);
+        slot += codeForBranch(outOfLine, slot);
+        codeForPadding(slotEnd - slot, slot);
 
-            /*     eax: jumpTable[C] */
-            EMIT_BYTES("\x8B\x44\x8D\x00"
-                                 /* mov eax, [ebp + ecx * 4 + disp8(0)] */
-            /*     jmp eax */
-                       "\xFF\xE0"); /* jmp eax */
-            /* } */
+        outOfLine = curr;
+    }
+}
 
-            BOOST_ASSERT(jmpSource + 6 == size);
+void context::recompilePlatter(::array & a, size_t i)
+{
+    /*
+     * Lazily compiled code does not record where the code of a platter ends.  
+     * But regeneration is cheap in this case as only the code that is 
+     * actually executed is compiled again.
+     */
+    if (_compilation == compilation::lazy)
+    {
+        generateNativeCode(a);
+        return;
+    }
 
-            /* eax: nativeCodeReturnValue::loadProgram */
-            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
-                       "\xB0\x06"           /* mov el, imm8             */
-                            /* imm8: nativeCodeReturnValue::loadProgram */
+    char * slot    = static_cast<char *>(platterAddress(a, i));
+    char * slotEnd = static_cast<char *>(platterAddress(a, i + 1));
 
-            /* return */
-                       "\x5A"               /* pop edx                  */
-                       "\xFF\xD2");         /* call edx                 */
+    if (_compilation == compilation::strided)
+        _slotsBase = a.nativeCode()->begin();
 
-            BOOST_ASSERT(size >= recompileStubSize);
+    _traceTableOffset = (a.size() + 1) * sizeof(void *);
 
-            break;
+    size_t size = codeFor(a[i], nullptr);
 
-        case platter::operator_::orthography:
-            /* A = value */
-            EMIT_BYTES("\xC7\x46");         /* mov [esi + disp8], imm32 */
-            EMIT_REGISTER_AS_BYTE_DISP(A);  /*     [esi + A]            */
-            EMIT_WORD(value);               /*                    value */
+    if (size <= static_cast<size_t>(slotEnd - slot))
+    {
+        slot += codeFor(a[i], slot);
+        codeForPadding(slotEnd - slot, slot);
+        return;
+    }
 
-            BOOST_ASSERT(size >= recompileStubSize);
+    /*
+     * New code does not fit.  Put it into an overflow area and replace the 
+     * old code with a branch there.  The branch back is part of the overflow 
+     * code.
+     */
+    size_t branchSize = codeForBranch(nullptr, nullptr);
+    if (static_cast<size_t>(slotEnd - slot) >= branchSize)
+    {
+        char * overflow =
+            a._nativeCode->outOfLine(_mm, i, size + branchSize);
 
-            break;
+        if (codeForBranch(slotEnd, overflow + size)
+            && codeForBranch(overflow, slot))
+        {
+            codeFor(a[i], overflow);
 
-        default:
-            throw logic_error("Unexpected operator");
+            codeForPadding(slotEnd - slot - branchSize, slot + branchSize);
+            return;
+        }
     }
 
-    return size;
+    /* Platter `i' is executed, so it should not be compiled as data again. */
+    generateNativeCode(a, i);
 }
 
-size_t context::codeForOOBStub(char * to)
+void context::compileBlock(::array & a, size_t first)
 {
+    void ** jumpTable = a.jumpTable()->begin();
+    void * compileStub =
+        a.jumpTable()->commonStubAddress(jumpTable::commonStub::compile);
+
+    BOOST_ASSERT(first < a.size() && jumpTable[first] == compileStub);
+
+    /* Find where the block ends. */
+    size_t last = first;
+    bool fallsThrough = true;
+    while (last < a.size() && jumpTable[last] == compileStub)
+    {
+        /*
+         * Halt, loadProgram and invalid operators never continue into the 
+         * next platter.
+         */
+        unsigned int operatorNumber = static_cast<unsigned int>(a[last]) >> 28;
+
+        ++last;
+
+        if (operatorNumber == platter::operator_::halt
+            || operatorNumber == platter::operator_::loadProgram
+            || operatorNumber > platter::operator_::orthography)
+        {
+            fallsThrough = false;
+            break;
+        }
+    }
+
+    rangePlan plan;
+    size_t size = planRange(a, first, last, plan);
+    if (fallsThrough)
+        size += last < a.size() ? codeForJump(last, nullptr)
+                                : codeForOOBStub(nullptr);
+
+    char * nativeCode = a._nativeCode->extend(_mm, size);
+
+    nativeCode += codeForRange(a, plan, nativeCode, jumpTable + first);
+    if (fallsThrough)
+        nativeCode += last < a.size() ? codeForJump(last, nativeCode)
+                                      : codeForOOBStub(nativeCode);
+}
+
+size_t context::planRange(const ::array & a, size_t first, size_t last,
+                          rangePlan & plan, const vector<bool> * code)
+{
+    fusedRun run;
+
+    plan.first = first;
+    plan.last = last;
+    plan.steps.clear();
+    plan.steps.reserve(last - first);
+    plan.runs.clear();
+
+    /*
+     * Constants are propagated from the range start, regardless of any jumps 
+     * into the middle of it, as direct jumps check their targets anyway.
+     */
+    knownRegisters known = knownRegisters();
+
     size_t size = 0;
-    char * curr = to;
 
-    static_assert(nativeCodeReturnValue::halt == 1,
-                  "halt value is encoded below.  If it changes "
-                  "the value below should be updated.");
-    static_assert(haltReturnCodes::outOfBoundExecution == 2,
-                  "outOfBoundExecution value is encoded below.  If it "
-                  "changes the value below should be update.");
-
-    /* eax: nativeCodeReturnValue::halt */
-    EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
-               "\xB0\x01"           /* mov al, imm8             */
-                           /* imm8: nativeCodeReturnValue::halt */
-    /* ebx: 2 - out of bound execution */
-               "\x31\xDB"           /* xor ebx, ebx             */
-               "\xB3\x02"           /* mov bl, imm8             */
-                  /* imm8: haltReturnCodes::outOfBoundExecution */
-    /* return */
-               "\x5A"               /* pop edx                  */
-               "\xFF\xD2");         /* call edx                 */
+    /* Fused runs should not include data platters. */
+    size_t codeEnd = first;
+
+    for (size_t i = first; i < last; ++i)
+    {
+        rangePlan::step step =
+            { 0, rangePlan::noRun, rangePlan::noJump, false };
+
+        if (code && !(*code)[i])
+        {
+            step.size = codeForDataStub(nullptr);
+            step.data = true;
+
+            plan.steps.push_back(step);
+            size += step.size;
+
+            known = knownRegisters();
+            continue;
+        }
+
+        if (codeEnd <= i)
+        {
+            codeEnd = i + 1;
+            while (codeEnd < last && (!code || (*code)[codeEnd]))
+                ++codeEnd;
+        }
+
+        if (fusedRunAt(a, i, codeEnd, run))
+        {
+            step.size = codeForFusedRun(run, nullptr, nullptr);
+            for (size_t j = 0; j < run.length; ++j)
+            {
+                step.size += codeFor(a[i + j], nullptr);
+                propagateConstants(a[i + j], known);
+            }
+
+            step.run = plan.runs.size();
+            plan.runs.push_back(run);
+
+            i += run.length - 1;
+        }
+        else
+        {
+            /* Traced code jumps via the trace table, see traceTable(...). */
+            directJump jump;
+            bool isDirect = _compilation != compilation::traced
+                            && directJumpFor(a[i], known, a.size(), jump);
+
+            if (isDirect)
+                step.jumpTarget = jump.target;
+
+            step.size = codeFor(a[i], nullptr, isDirect ? &jump : nullptr);
+            propagateConstants(a[i], known);
+        }
+
+        plan.steps.push_back(step);
+        size += step.size;
+    }
 
     return size;
 }
 
-#undef EMIT_BYTES
-#undef EMIT_REGISTER_AS_BYTE_DISP
-#undef EMIT_BYTE
-#undef EMIT_WORD
+size_t context::codeForRange(const ::array & a, const rangePlan & plan,
+                             char * to, void ** jumpTable)
+{
+    vector<directJump> jumps;
+
+    char * curr = to;
+    size_t i = plan.first;
 
-void context::generateNativeCode(::array & a)
+    for (size_t s = 0; s < plan.steps.size(); ++s)
+    {
+        const rangePlan::step & step = plan.steps[s];
+
+        *jumpTable++ = curr;
+
+        /*
+         * Jump table entry for the first platter of a fused run points to the 
+         * code that executes the whole run.  Code for every platter of the run 
+         * follows it, so a jump into the middle of the run, or an execution 
+         * after array 0 was modified, still run the platters one by one.
+         */
+        if (step.run != rangePlan::noRun)
+        {
+            const fusedRun & run = plan.runs[step.run];
+
+            curr += codeForFusedRun(run, curr + step.size, curr);
+            curr += codeFor(a[i], curr);
+
+            for (size_t j = 1; j < run.length; ++j)
+            {
+                *jumpTable++ = curr;
+                curr += codeFor(a[i + j], curr);
+            }
+
+            i += run.length;
+            continue;
+        }
+
+        if (step.data)
+        {
+            curr += codeForDataStub(curr);
+            ++i;
+            continue;
+        }
+
+        directJump jump = { step.jumpTarget, nullptr };
+        bool isDirect = step.jumpTarget != rangePlan::noJump;
+
+        curr += codeFor(a[i], curr, isDirect ? &jump : nullptr);
+
+        if (isDirect)
+            jumps.push_back(jump);
+
+        ++i;
+    }
+
+    BOOST_ASSERT(i == plan.last);
+
+    /*
+     * Jump table entries of the range are known now.  In the lazy mode 
+     * targets outside of it are only reachable directly if they are already 
+     * compiled.
+     */
+    void * compileStub = _compilation == compilation::lazy
+        ? a.jumpTable()->commonStubAddress(jumpTable::commonStub::compile)
+        : nullptr;
+
+    for (size_t j = 0; j < jumps.size(); ++j)
+    {
+        void * target = a.jumpTable()->begin()[jumps[j].target];
+
+        if (target != compileStub)
+            codeForBranch(static_cast<const char *>(target), jumps[j].branch);
+    }
+
+    return curr - to;
+}
+
+void context::classifyPlatters(const decodedPlatters & decoded, size_t entry,
+                               vector<bool> & code)
 {
-    if (a._nativeCode)
+    size_t size = decoded.size();
+    const unsigned char * operators = decoded.operators();
+    const unsigned int * values = decoded.values();
+
+    code.assign(size, false);
+
+    if (entry < size)
+        code[entry] = true;
+
+    for (size_t i = 0; i < size; ++i)
     {
-        a._nativeCode->destroy(_mm);
-        a._nativeCode = nullptr;
+        if (operators[i] == platter::operator_::orthography
+            && values[i] < size)
+            code[values[i]] = true;
     }
 
-    a.dirty(false);
+    /*
+     * Halt, loadProgram and invalid operators never continue into the next 
+     * platter.
+     */
+    for (size_t i = 0; i + 1 < size; ++i)
+    {
+        if (code[i]
+            && operators[i] != platter::operator_::halt
+            && operators[i] != platter::operator_::loadProgram
+            && operators[i] != decodedPlatters::invalidOperator)
+            code[i + 1] = true;
+    }
+}
 
-    /* Precalculate native code size */
-    size_t nativeCodeSize = 0;
-    for (size_t i = 0, len = a.size(); i < len; ++i)
-        nativeCodeSize += codeFor(a[i], nullptr);
+void context::propagateConstants(const platter & p, knownRegisters & known)
+{
+    unsigned int operatorNumber = static_cast<unsigned int>(p) >> 28;
 
-    /* Stub to prevent execution beyond array length */
-    nativeCodeSize += codeForOOBStub(nullptr);
+    if (operatorNumber > platter::operator_::orthography)
+    {
+        known.mask = 0;
+        return;
+    }
 
-    a._nativeCode = nativeCode::create(_mm, nativeCodeSize, a.size());
+    unsigned int A = 0, B = 0, C = 0, value = 0;
+    p.decode(A, B, C, value);
 
-    char * nativeCode = a._nativeCode->begin();
-    void ** jumpTable = a._nativeCode->jumpTable()->begin();
-    for (size_t i = 0, len = a.size(); i < len; ++i)
+    bool bcKnown = (known.mask & (1 << B)) && (known.mask & (1 << C));
+    unsigned int b = known.values[B];
+    unsigned int c = known.values[C];
+
+    switch (operatorNumber)
     {
-        *jumpTable++ = nativeCode;
-        nativeCode += codeFor(a[i], nativeCode);
+        case platter::operator_::conditionalMove:
+            if (known.mask & (1 << C))
+            {
+                if (c == 0)
+                    return;
+
+                known.mask = (known.mask & ~(1 << A))
+                             | ((known.mask >> B & 1) << A);
+                known.values[A] = b;
+                return;
+            }
+
+            /* A either keeps its value or gets B, that may be the same. */
+            if (!(known.mask & (1 << A)) || !(known.mask & (1 << B))
+                || known.values[A] != b)
+                known.mask &= ~(1 << A);
+            return;
+
+        case platter::operator_::addition:
+            value = b + c;
+            break;
+
+        case platter::operator_::multiplication:
+            value = b * c;
+            break;
+
+        case platter::operator_::division:
+            bcKnown = bcKnown && c != 0;
+            value = bcKnown ? b / c : 0;
+            break;
+
+        case platter::operator_::notAnd:
+            value = ~(b & c);
+            break;
+
+        case platter::operator_::orthography:
+            bcKnown = true;
+            break;
+
+        case platter::operator_::arrayIndex:
+            bcKnown = false;
+            break;
+
+        case platter::operator_::allocation:
+            known.mask &= ~(1 << B);
+            return;
+
+        case platter::operator_::input:
+            known.mask &= ~(1 << C);
+            return;
+
+        case platter::operator_::halt:
+        case platter::operator_::loadProgram:
+            known.mask = 0;
+            return;
+
+        default:
+            /* arrayAmendment, abandonment and output do not change registers. */
+            return;
     }
 
-    nativeCode += codeForOOBStub(nativeCode);
+    if (bcKnown)
+    {
+        known.mask |= 1 << A;
+        known.values[A] = value;
+    }
+    else
+        known.mask &= ~(1 << A);
 }
 
-size_t context::allocation(size_t size)
+bool context::directJumpFor(const platter & p, const knownRegisters & known,
+                            size_t end, directJump & jump)
+{
+    if (static_cast<unsigned int>(p) >> 28 != platter::operator_::loadProgram)
+        return false;
+
+    unsigned int A, B, C, value;
+    p.decode(A, B, C, value);
+
+    if (!(known.mask & (1 << C)) || known.values[C] >= end)
+        return false;
+
+    jump.target = known.values[C];
+    jump.branch = nullptr;
+    return true;
+}
+
+void ** context::traceTable(::array & a)
+{
+    return a.jumpTable()->begin() + _traceTableOffset / sizeof(void *);
+}
+
+void context::resetTraceCounters()
+{
+    _traceCounters.assign(_arrays[0]->size() + 1, traceThreshold);
+    _nativeState.traceCounters = &_traceCounters[0];
+}
+
+bool context::recordTrace(size_t head, trace & t, size_t & fingerPosition)
+{
+    const ::array & array0 = *_arrays[0];
+
+    unsigned int r[8];
+    for (size_t i = 0; i < 8; ++i)
+        r[i] = _registers[i];
+
+    t.head = head;
+    t.steps.clear();
+
+    size_t i = head;
+    bool closed = false;
+
+    while (t.steps.size() < maxTraceLength)
+    {
+        unsigned int operatorNumber = static_cast<unsigned int>(array0[i]) >> 28;
+        if (operatorNumber > platter::operator_::orthography)
+            break;
+
+        unsigned int A = 0, B = 0, C = 0, value = 0;
+        array0[i].decode(A, B, C, value);
+
+        trace::step step = { i, 0 };
+        size_t next = i + 1;
+
+        switch (operatorNumber)
+        {
+            case platter::operator_::conditionalMove:
+                if (r[C])
+                    r[A] = r[B];
+                break;
+
+            case platter::operator_::arrayIndex:
+                /* Platter code reports an invalid index. */
+                if (_boundsChecks && !validIndex(r[B], r[C]))
+                    goto stop;
+
+                r[A] = (*_arrays[r[B]])[r[C]];
+                break;
+
+            case platter::operator_::arrayAmendment:
+                if (r[A] == 0
+                    || (_boundsChecks && !validIndex(r[A], r[B])))
+                    goto stop;
+
+                if (_arrays[r[A]]->shared())
+                    unshare();
+
+                if (_arrays[r[A]]->writeProtected())
+                    unprotect(*_arrays[r[A]]);
+
+                (*_arrays[r[A]])[r[B]] = r[C];
+                _arrays[r[A]]->dirty(true);
+                break;
+
+            case platter::operator_::addition:
+                r[A] = r[B] + r[C];
+                break;
+
+            case platter::operator_::multiplication:
+                r[A] = r[B] * r[C];
+                break;
+
+            case platter::operator_::division:
+                if (r[C] == 0)
+                    goto stop;
+
+                r[A] = r[B] / r[C];
+                break;
+
+            case platter::operator_::notAnd:
+                r[A] = ~(r[B] & r[C]);
+                break;
+
+            case platter::operator_::orthography:
+                r[A] = value;
+                break;
+
+            case platter::operator_::loadProgram:
+                if (r[B] != 0 || r[C] >= array0.size())
+                    goto stop;
+
+                next = step.target = r[C];
+                break;
+
+            default:
+                /* Halt, allocation, abandonment, output and input. */
+                goto stop;
+        }
+
+        t.steps.push_back(step);
+        i = next;
+
+        if (i == head)
+        {
+            closed = true;
+            break;
+        }
+
+        if (i == array0.size())
+            break;
+    }
+
+stop:
+    for (size_t j = 0; j < 8; ++j)
+        _registers[j] = r[j];
+
+    fingerPosition = i;
+    return closed;
+}
+
+size_t context::traceFrom(::array & a, size_t head)
 {
-    /* Find next available index. */
-    while (_minEmptyArrayIndex < _arrays.size() && _arrays[_minEmptyArrayIndex])
-        ++_minEmptyArrayIndex;
+    trace t;
+    size_t fingerPosition;
 
-    if (_minEmptyArrayIndex == _arrays.size())
+    void ** traces = traceTable(a);
+
+    if (!recordTrace(head, t, fingerPosition))
     {
-        _arrays.push_back(nullptr);
-        _minEmptyArrayIndex = _arrays.size() - 1;
+        /* Do not try again. */
+        traces[head] = a.jumpTable()->address(head);
+        return fingerPosition;
     }
 
-    _arrays[_minEmptyArrayIndex] = ::array::create(_mm, size);
+    size_t size = codeForTrace(a, t, nullptr);
+    char * code = a._nativeCode->extend(_mm, size);
+    codeForTrace(a, t, code);
+
+    traces[head] = code;
 
-    return _minEmptyArrayIndex;
+    return fingerPosition;
 }
 
-void context::abandonment(size_t index)
+bool context::outputRunAt(const ::array & a, size_t i, size_t end,
+                          outputRun & run)
 {
-    if (index >= _arrays.size())
+    /*
+     * Every run starts with an orthography.  Most platters are not, so check 
+     * it before any preparations.
+     */
+    if (i >= end
+        || static_cast<unsigned int>(a[i]) >> 28
+           != platter::operator_::orthography)
+        return false;
+
+    run.length = 0;
+    run.bytes.clear();
+    run.assigned = 0;
+
+    /* Registers known at compile time at the current point of the run. */
+    unsigned int known = 0;
+    _registers_type values;
+
+    for (size_t j = i; j < end; ++j)
+    {
+        /*
+         * Do not decode data platters.  Exceptions are too expensive to be 
+         * thrown for every platter that is not an operator.
+         */
+        unsigned int operatorNumber = static_cast<unsigned int>(a[j]) >> 28;
+        if (operatorNumber != platter::operator_::orthography
+            && operatorNumber != platter::operator_::output)
+            break;
+
+        unsigned int A, B, C, value;
+        platter::operator_::value op = a[j].decode(A, B, C, value);
+
+        if (op == platter::operator_::orthography)
+        {
+            values[A] = value;
+            known |= 1 << A;
+            continue;
+        }
+
+        if (!(known & (1 << C)) || values[C] > 0xFF)
+            break;
+
+        run.bytes += static_cast<char>(values[C]);
+        run.length = j - i + 1;
+        run.assigned = known;
+        run.values = values;
+    }
+
+    return run.bytes.size() >= 2;
+}
+
+bool context::bitwiseRunAt(const ::array & a, size_t i, size_t end,
+                           bitwiseRun & run)
+{
+    if (i >= end
+        || static_cast<unsigned int>(a[i]) >> 28 != platter::operator_::notAnd)
+        return false;
+
+    /* Truth tables of the x and y values. */
+    const unsigned char xFunction = 0xA;
+    const unsigned char yFunction = 0xC;
+
+    run.length = 0;
+    run.assigned = 0;
+
+    unsigned int inputs = 0;
+
+    for (size_t j = i; j < end; ++j)
+    {
+        if (static_cast<unsigned int>(a[j]) >> 28 
+            != platter::operator_::notAnd)
+            break;
+
+        unsigned int A, B, C, value;
+        a[j].decode(A, B, C, value);
+
+        unsigned int operands[2] = { B, C };
+        unsigned char functions[2];
+
+        for (size_t k = 0; k < 2; ++k)
+        {
+            unsigned int r = operands[k];
+
+            if (run.assigned & (1 << r))
+                functions[k] = run.functions[r];
+            else if (inputs > 0 && r == run.x)
+                functions[k] = xFunction;
+            else if (inputs > 1 && r == run.y)
+                functions[k] = yFunction;
+            else if (inputs < 2)
+            {
+                if (inputs++ == 0)
+                {
+                    run.x = run.y = r;
+                    functions[k] = xFunction;
+                }
+                else
+                {
+                    run.y = r;
+                    functions[k] = yFunction;
+                }
+            }
+            else
+                /* A third register, the run ends before this platter. */
+                return run.length >= 2;
+        }
+
+        run.functions[A] = ~(functions[0] & functions[1]) & 0xF;
+        run.assigned |= 1 << A;
+        run.length = j - i + 1;
+    }
+
+    return run.length >= 2;
+}
+
+context::bitwiseRecipe context::bitwiseRecipeFor(unsigned char function)
+{
+    const unsigned char sourceFunctions[] = { 0xA, 0xC, 0x0 };
+    const unsigned char otherFunctions[] = { 0xC, 0xA, 0x0 };
+
+    bitwiseRecipe best = bitwiseRecipe();
+    unsigned int bestCost = ~0u;
+
+    for (unsigned int s = bitwiseRecipe::x; s <= bitwiseRecipe::zero; ++s)
+        for (unsigned int ns = 0; ns < 2; ++ns)
+            for (unsigned int op = bitwiseRecipe::none;
+                 op <= bitwiseRecipe::xor_; ++op)
+                for (unsigned int nr = 0; nr < 2; ++nr)
+                {
+                    unsigned char r = sourceFunctions[s];
+                    unsigned char other = otherFunctions[s];
+
+                    if (ns)
+                        r = ~r;
+
+                    switch (op)
+                    {
+                        case bitwiseRecipe::and_: r &= other; break;
+                        case bitwiseRecipe::or_:  r |= other; break;
+                        case bitwiseRecipe::xor_: r ^= other; break;
+                    }
+
+                    if (nr)
+                        r = ~r;
+
+                    unsigned int cost = 1 + ns + (op != bitwiseRecipe::none)
+                                        + nr;
+                    if ((r & 0xF) != function || cost >= bestCost)
+                        continue;
+
+                    best.source = static_cast<bitwiseRecipe::source_type>(s);
+                    best.negateSource = ns != 0;
+                    best.operation =
+                        static_cast<bitwiseRecipe::operation_type>(op);
+                    best.negateResult = nr != 0;
+                    bestCost = cost;
+                }
+
+    BOOST_ASSERT(bestCost != ~0u);
+    return best;
+}
+
+bool context::fusedRunAt(const ::array & a, size_t i, size_t end,
+                         fusedRun & run)
+{
+    if (outputRunAt(a, i, end, run.output))
+    {
+        run.isOutput = true;
+        run.length = run.output.length;
+        return true;
+    }
+
+    if (bitwiseRunAt(a, i, end, run.bitwise))
+    {
+        run.isOutput = false;
+        run.length = run.bitwise.length;
+        return true;
+    }
+
+    return false;
+}
+
+size_t context::codeForFusedRun(const fusedRun & run, const char * continueAt,
+                                char * to)
+{
+    return run.isOutput ? codeForOutputRun(run.output, continueAt, to)
+                        : codeForBitwiseRun(run.bitwise, continueAt, to);
+}
+
+size_t context::allocation(size_t size)
+{
+    if (_nativeState.freeIndexCount == 0)
+    {
+        /*
+         * Add a batch of new indices, so that native code can allocate 
+         * without returning here for a while.  Smaller indices are on the 
+         * top of the stack.
+         */
+        size_t first = _arrays.size();
+        size_t count = max<size_t>(first, 16);
+
+        _arrays.resize(first + count, nullptr);
+        _freeIndices.resize(_arrays.size());
+
+        for (size_t i = 0; i < count; ++i)
+            _freeIndices[i] = static_cast<unsigned int>(first + count - 1 - i);
+
+        _nativeState.freeIndices = &_freeIndices[0];
+        _nativeState.freeIndexCount = count;
+        _nativeState.arrayCount = _arrays.size();
+    }
+
+    size_t index = _freeIndices[--_nativeState.freeIndexCount];
+
+    BOOST_ASSERT(_arrays[index] == nullptr);
+    _arrays[index] = ::array::create(_mm, size);
+
+    return index;
+}
+
+void context::abandonment(size_t index) throw(exceptions::invalidArrayIndex)
+{
+    if (index == 0)
+        throw exceptions::invalidArrayIndex(L"Can not abandon array 0", 0);
+
+    if (index >= _arrays.size() || _arrays[index] == nullptr)
         throw exceptions::invalidArrayIndex
             (L"Attempt to an abandon an unallocated array", index);
 
-    if (_array0Source == index)
-        _array0Source = 0;
+    ::array * a = _arrays[index];
+
+    if (_nativeState.array0Source == index)
+        _nativeState.array0Source = 0;
 
-    _arrays[index]->destroy(_mm);
+    /* Array 0 keeps the array. */
+    if (a->shared())
+        a->shared(false);
+    else
+    {
+        unprotect(*a);
+
+        if (a->_nativeCode && !a->dirty())
+            _programCache.store(a);
+        else
+            a->destroy(_mm);
+    }
     _arrays[index] = 0;
 
-    if (index < _minEmptyArrayIndex)
-        _minEmptyArrayIndex = index;
+    /* _freeIndices has room for every index. */
+    _freeIndices[_nativeState.freeIndexCount++] =
+        static_cast<unsigned int>(index);
+}
+
+ptrdiff_t context::nativeStateOffset() const
+{
+    return reinterpret_cast<const char *>(&_nativeState)
+           - reinterpret_cast<const char *>(&_registers[0]);
 }
 
 void context::output(unsigned char v)
 {
-    _os << static_cast<char>(v);
+    if (_nativeState.outputNext == _nativeState.outputEnd)
+        flushOutput();
+
+    *_nativeState.outputNext++ = static_cast<char>(v);
+}
+
+void context::output(const char * s, size_t size)
+{
+    if (size > static_cast<size_t>(_nativeState.outputEnd
+                                   - _nativeState.outputNext))
+    {
+        flushOutput();
+
+        if (size > _outputBuffer.size())
+        {
+            _os.write(s, size);
+            _os << flush;
+            return;
+        }
+    }
+
+    memcpy(_nativeState.outputNext, s, size);
+    _nativeState.outputNext += size;
+}
+
+void context::flushOutputIfDue()
+{
+    if (_nativeState.outputNext != &_outputBuffer[0]
+        && boost::posix_time::microsec_clock::universal_time()
+           - _lastFlush >= _flushInterval)
+        flushOutput();
+}
+
+void context::flushOutput()
+{
+    char * begin = &_outputBuffer[0];
+
+    if (_nativeState.outputNext != begin)
+    {
+        _os.write(begin, _nativeState.outputNext - begin);
+        _nativeState.outputNext = begin;
 
-    if (v == '\n')
         _os << flush;
+    }
+
+    _lastFlush = boost::posix_time::microsec_clock::universal_time();
 }
 
 unsigned int context::input()
 {
+    if (_nativeState.inputNext != _nativeState.inputEnd)
+        return *_nativeState.inputNext++;
+
+    /*
+     * Output only needs to be visible before the machine waits for input.  
+     * Input that is already buffered will not block.
+     */
+    if (_is.rdbuf()->in_avail() <= 0)
+        flushOutput();
+
     istream::int_type v = _is.get();
 
-    return v == istream::traits_type::eof() ? ~static_cast<unsigned int>(0) : v;
+    if (v == istream::traits_type::eof())
+        return ~static_cast<unsigned int>(0);
+
+    /* Take whatever else the stream has read ahead. */
+    unsigned char * begin = &_inputBuffer[0];
+    streamsize count = _is.readsome(reinterpret_cast<char *>(begin),
+                                    _inputBuffer.size());
+
+    _nativeState.inputNext = begin;
+    _nativeState.inputEnd = begin + max<streamsize>(count, 0);
+
+    return static_cast<unsigned char>(v);
 }
 
-void context::loadProgram(size_t index)
+void context::loadProgram(size_t index) throw(exceptions::invalidArrayIndex)
 {
     if (index == 0)
         throw exceptions::invalidArrayIndex(L"Can not load array 0", 0);
@@ -859,27 +1615,151 @@ void context::loadProgram(size_t index)
 
     ::array * array0 = _arrays[0];
 
-    if (!array0->dirty() && _array0Source != 0)
+    /*
+     * A shared array 0 is still the array it was loaded from, along with its 
+     * native code, it stays write protected in the writeProtection(...) 
+     * mode.  Otherwise code that still matches array 0 may be reused by a 
+     * copy of it.
+     */
+    if (array0->shared())
+        array0->shared(false);
+    else
     {
-        ::array * oldSource = _arrays[_array0Source];
-        if (!oldSource->dirty())
-        {
-            oldSource->_nativeCode = array0->_nativeCode;
-            array0->_nativeCode = nullptr;
-        }
-    }
+        unprotect(*array0);
 
-    array0->destroy(_mm);
+        if (array0->_nativeCode && !array0->dirty())
+            _programCache.store(array0);
+        else
+            array0->destroy(_mm);
+    }
 
     ::array * source = _arrays[index];
 
-    if (source->dirty() || !source->_nativeCode)
-        generateNativeCode(*source);
+    bool cached = (source->dirty() || !source->_nativeCode)
+                  && _compilation != compilation::interpreted
+                  && _programCache.take(*source);
+
+    switch (_compilation)
+    {
+        case compilation::interpreted:
+            break;
 
-    array0 = _arrays[0] = source->clone(_mm);
+        case compilation::tiered:
+            /*
+             * Only arrays that were promoted have native code.  Others start 
+             * tracking modifications from this load.
+             */
+            if (cached)
+                break;
+            else if (!source->_nativeCode)
+                source->dirty(false);
+            else if (source->dirty())
+                generateNativeCode(*source);
+            break;
+
+        default:
+            if (!cached && (source->dirty() || !source->_nativeCode))
+                generateNativeCode(*source);
+    }
+
+    /*
+     * The code may come from an array of another size.  It is the same 
+     * offset generateNativeCode(...) uses, see traceTable(...).
+     */
+    if (source->_nativeCode)
+        _traceTableOffset = (source->size() + 1) * sizeof(void *);
+
+    /* Copied only once either one is amended, see unshare(). */
+    _arrays[0] = source;
+    source->shared(true);
+    ++source->_entryCount;
+
+    _nativeState.array0Source = index;
+}
+
+bool context::validIndex(size_t array, size_t index) const
+{
+    return array < _arrays.size() && _arrays[array]
+           && index < _arrays[array]->size();
+}
+
+void context::checkIndex(size_t array, size_t index,
+                         size_t fingerPosition) const
+    throw(exceptions::invalidArrayIndex)
+{
+    if (validIndex(array, index))
+        return;
+
+    wostringstream msg;
+
+    if (array >= _arrays.size() || !_arrays[array])
+    {
+        msg << L"Array " << array << L" is not allocated at platter "
+            << fingerPosition;
+        throw exceptions::invalidArrayIndex(msg.str(), array);
+    }
+
+    msg << L"Index " << index << L" is out of range of array " << array
+        << L" at platter " << fingerPosition;
+    throw exceptions::invalidArrayIndex(msg.str(), index);
+}
+
+void context::unshare()
+{
+    ::array * array0 = _arrays[0];
+
+    BOOST_ASSERT(array0->shared()
+                 && _arrays[_nativeState.array0Source] == array0);
+
+    /*
+     * Array 0 keeps the native code, as it is the one that is executed.  The 
+     * copy is not compiled yet and may be amended, so it is not linked as 
+     * the array 0 source any more.
+     */
+    _arrays[_nativeState.array0Source] = array0->clone(_mm);
+    _nativeState.array0Source = 0;
+
+    array0->shared(false);
+}
+
+size_t context::protectedSize(const ::array & a)
+{
+    size_t pageSize = memoryManager::pageSize();
+
+    return (a.size() * sizeof(platter) + pageSize - 1) / pageSize * pageSize;
+}
+
+void context::protectArray0()
+{
+    ::array * array0 = _arrays[0];
+
+    if (!_writeProtection || array0->writeProtected()
+        || !array0->_nativeCode || array0->size() == 0)
+        return;
+
+    if (!array0->ownPages())
+    {
+        array0 = array0->moveToOwnPages(_mm);
+
+        if (array0->shared())
+            _arrays[_nativeState.array0Source] = array0;
+        _arrays[0] = array0;
+    }
+
+    memoryManager::protect(array0->platters(), protectedSize(*array0), false);
+
+    array0->writeProtected(true);
+    _protectedArrays.push_back(array0);
+}
+
+void context::unprotect(::array & a)
+{
+    if (!a.writeProtected())
+        return;
 
-    array0->_nativeCode = source->_nativeCode;
-    source->_nativeCode = nullptr;
+    memoryManager::protect(a.platters(), protectedSize(a), true);
 
-    _array0Source = index;
+    a.writeProtected(false);
+    _protectedArrays.erase(find(_protectedArrays.begin(),
+                                _protectedArrays.end(), &a));
 }
@@ -3,18 +3,23 @@
 
 #include "platter.h"
 #include "array.h"
+#include "programCache.h"
 
 #include "exceptions/invalidArrayIndex.h"
 #include "exceptions/invalidOperatorFormat.h"
 
 #include <boost/utility.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include <array>
 #include <vector>
+#include <string>
 #include <iosfwd>
+#include <cstddef>
 
 class memoryManager;
 class array;
+class decodedPlatters;
 
 /*
  * This class instance represents a universal machine context: a set of 
@@ -28,46 +33,305 @@ class array;
 class context: boost::noncopyable
 {
 public:
+    /*
+     * Controls when native code for the array platters is generated.
+     */
+    struct compilation
+    {
+        enum value
+        {
+            /*
+             * All the platters are compiled when an array is loaded as 
+             * array 0.
+             */
+            eager,
+
+            /*
+             * Jump table entries start pointing to a compile stub.  A basic 
+             * block is compiled the first time execution reaches it, so data 
+             * and code that never runs are not compiled at all.
+             */
+            lazy,
+
+            /*
+             * Same as eager, but code for every platter is put into a slot of 
+             * the same size, codeStride bytes.  Code that does not fit is 
+             * placed out of line and the slot just branches there.  Platter 
+             * code address is calculated from the platter index, so there is 
+             * no jump table.
+             */
+            strided,
+
+            /*
+             * No native code is generated at all.  Platters are executed by 
+             * a portable threaded interpreter, see interpret().
+             */
+            interpreted,
+
+            /*
+             * New array 0 contents start in the interpreter.  An array is 
+             * compiled, as in the eager mode, once it was loaded as array 0 
+             * or jumped backwards in enough times, see nativeTier().  Arrays 
+             * that run only a few times are never compiled.
+             */
+            tiered,
+
+            /*
+             * Same as eager, but loadProgram jumps go through a trace table 
+             * that starts pointing to a profile stub.  Once a platter was 
+             * jumped to often enough, a trace is recorded from it: the path 
+             * that execution takes until it gets back to this platter.  The 
+             * trace is compiled as one straight-line block that checks every 
+             * jump on the way and exits into the regular platter code if 
+             * execution goes elsewhere.  See traceFrom().
+             */
+            traced
+        };
+
+    private:
+        /* This struct is just a container for value. */
+        compilation();
+    };
+
     context(memoryManager & mm, std::istream & is, std::ostream & os,
-            array * zeroArray);
+            array * zeroArray,
+            compilation::value compilationMode = compilation::eager);
+
+    /* Arrays that are still write protected are made writable again. */
+    ~context();
+
+    /*
+     * Array 0 translated into C++ ahead of time, see translator.  Returns 
+     * false when the machine halts.  Returns true when array 0 was modified 
+     * or replaced and no longer matches the translation, `fingerPosition' is 
+     * set to where the execution should continue.
+     */
+    typedef bool (*translatedCode)(context & ctx, size_t & fingerPosition);
 
     /*
      * Executes the universal machine until it exits or something fails.
      *
+     * If `translated' is given, it runs array 0 first.  Once it returns true 
+     * the execution continues in the compilation mode given to the 
+     * constructor.
+     *
      * May throw an exception if the machine enters an invalid state.
      */
-    void run() throw(exceptions::invalidArrayIndex, 
-                     exceptions::invalidOperatorFormat);
+    void run(translatedCode translated = nullptr)
+        throw(exceptions::invalidArrayIndex, 
+              exceptions::invalidOperatorFormat);
+
+    /*
+     * Output is buffered and written into the output stream when the buffer 
+     * is full, when the machine halts or needs input and when `milliseconds' 
+     * have passed since the buffer was written last time.  The time is only 
+     * checked when a new line is output and whenever native code returns 
+     * into run() for other reasons, so a line that is not due yet may stay 
+     * in the buffer while the machine runs without output.  0 makes every 
+     * new line write the buffer.
+     */
+    void flushInterval(unsigned int milliseconds);
+
+    /*
+     * Native code of arrays that are no longer array 0 is kept in memory up 
+     * to `bytes', so that loading an array with the same content again does 
+     * not compile it again.  See programCache.  0 disables the cache.
+     */
+    void programCacheBudget(size_t bytes);
+
+    /*
+     * Native code amends arrays with a plain store, without checking if it 
+     * modifies array 0.  Instead, platters of array 0 are write protected 
+     * while it has native code, and a write into them is caught by the page 
+     * fault it causes.  Should be called before run().
+     *
+     * Only implemented for the x86-64 build, ignored otherwise.
+     */
+    void writeProtection(bool enable);
+
+    /*
+     * arrayIndex and arrayAmendment check that the array is allocated and the 
+     * index is within it, and run() throws invalidArrayIndex naming the 
+     * platter otherwise.  Without the checks such a program reads or writes 
+     * memory it does not own.  Should be called before run().
+     *
+     * Native code checks indices only in the x86-64 build.  Reads of an 
+     * abandoned array fault on the null pointer and are reported the same 
+     * way, so they do not need a check of their own.
+     */
+    void boundsChecks(bool enable);
+
+    /*
+     * Generates native code for array 0 from scratch, the same way it is done 
+     * when an array is loaded.  Nothing is executed.  Used to measure code 
+     * generation speed, see the --codegen-benchmark option.
+     */
+    void compile();
 
 private:
+    /* Translated code works with the machine state directly. */
+    friend struct translatedProgram;
+
     memoryManager & _mm;
 
     std::istream & _is;
     std::ostream & _os;
 
+    compilation::value _compilation;
+
+    /* writeProtection(...) value. */
+    bool _writeProtection;
+
+    /* boundsChecks(...) value. */
+    bool _boundsChecks;
+
+    /*
+     * Address of the first slot of the native code block that is being 
+     * generated or modified in the compilation::strided mode.  Native code 
+     * calculates slot addresses relative to it.
+     */
+    char * _slotsBase;
+
     typedef std::array<platter, 8> _registers_type;
     _registers_type _registers;
 
     /*
-     * When array 0 is loaded from another array instead of copying native code 
-     * and jump table both are transfered into array 0.  If both source array 
-     * and array 0 are not modified before another array is duplicated into 
-     * array 0 then native code and jump table are moved back into the 
-     * originating array.  This should save a lot of copying.
+     * State shared with the native code that allocates and abandons small 
+     * arrays and outputs characters without returning into run().  Native 
+     * code finds it at a fixed offset from the registers array, see 
+     * nativeStateOffset().
      *
-     * 0 value means that no back transfer should occur.  For example, when the 
-     * source array is deallocated we break this connection.
+     * Native code only handles the common case and returns into run() when 
+     * anything needs to be refilled or checked more carefully.
      */
-    size_t _array0Source;
+    struct _nativeState_type
+    {
+        /* memoryManager::freeLists() */
+        void ** freeLists;
+
+        /*
+         * Stack of array indices that are not used at the moment.  Holds 
+         * `freeIndexCount' values and has room for all the indices of 
+         * _arrays.
+         */
+        unsigned int * freeIndices;
+        size_t freeIndexCount;
+
+        /* _arrays.size() */
+        size_t arrayCount;
+
+        /*
+         * Index of the array that array 0 was loaded from while they are 
+         * still the same array, see array::shared().  Native code and jump 
+         * table stay with that array when another one is loaded, unless 
+         * either one was amended.
+         *
+         * 0 value means that array 0 is not shared.  For example, when the 
+         * source array is abandoned or amended we break this connection.
+         */
+        size_t array0Source;
+
+        /*
+         * Output buffer free space.  Characters are appended at `outputNext' 
+         * until it reaches `outputEnd'.  See flushOutput().
+         */
+        char * outputNext;
+        char * outputEnd;
+
+        /*
+         * Input buffer content.  Characters are taken from `inputNext' until 
+         * it reaches `inputEnd'.  See input().
+         */
+        const unsigned char * inputNext;
+        const unsigned char * inputEnd;
+
+        /*
+         * Number of times every platter of array 0 can still be jumped to 
+         * via the trace table before a trace is recorded from it.  See 
+         * compilation::traced.
+         */
+        unsigned int * traceCounters;
+    };
+    _nativeState_type _nativeState;
+
+    /* Storage for the output buffer. */
+    std::vector<char> _outputBuffer;
+
+    /* Storage for the input buffer. */
+    std::vector<unsigned char> _inputBuffer;
+
+    /*
+     * Buffered output is written into _os when this much time has passed 
+     * since the last flush.  Checked every time native code returns into 
+     * run(), which it does for every new line, and by interpret() for every 
+     * new line and every now and then.
+     */
+    boost::posix_time::time_duration _flushInterval;
+    boost::posix_time::ptime _lastFlush;
 
     typedef std::vector<array *> _arrays_type;
     _arrays_type _arrays;
 
+    /* Storage for _nativeState.freeIndices. */
+    std::vector<unsigned int> _freeIndices;
+
+    /* Native code that loadProgram(...) may reuse. */
+    programCache _programCache;
+
+    /*
+     * Arrays with write protected platters.  Array 0, if it has native code, 
+     * and arrays that array 0 left its native code with, until they are 
+     * amended.
+     */
+    std::vector<array *> _protectedArrays;
+
+    /* Storage for _nativeState.traceCounters. */
+    std::vector<unsigned int> _traceCounters;
+
     /*
-     * To speed up new array index generation this is the smallest array index 
-     * that is not used at the moment.
+     * Offset of the trace table from the jump table of the native code block 
+     * that is being generated or modified in the compilation::traced mode.  
+     * See traceTable().
      */
-    size_t _minEmptyArrayIndex;
+    size_t _traceTableOffset;
+
+    /*
+     * A loadProgram that is expected to continue at a platter known at compile 
+     * time.  Native code checks that the register still holds the expected 
+     * value and falls back to the jump table otherwise, so the expectation 
+     * does not have to hold for every way the platter may be reached.
+     */
+    struct directJump
+    {
+        /* Platter the loadProgram is expected to jump to. */
+        size_t target;
+
+        /*
+         * Set by codeFor(...) to a branch that should be pointed to the 
+         * target code with codeForBranch(...).  Until then the branch just 
+         * continues into the jump table based code.
+         */
+        char * branch;
+    };
+
+    /*
+     * Offset of _nativeState from the registers array, that native code is 
+     * given the address of.
+     */
+    ptrdiff_t nativeStateOffset() const;
+
+    /*
+     * Returns an address of the native code for platter `i' of `a'.  `i' may 
+     * be equal to the array size, in which case the out of bound stub address 
+     * is returned.
+     */
+    void * platterAddress(array & a, size_t i);
+
+    /*
+     * Returns an address of the native code for platter `i' of `a', compiling 
+     * the basic block that starts at `i' first if necessary.
+     */
+    void * nativeEntry(array & a, size_t i);
 
     /*
      * Calculates finger position based on a native code return address.  Finds 
@@ -92,8 +356,58 @@ private:
      * platter.
      * If `to' is a nullptr just returns the number of bytes required to 
      * represent this platter.
+     *
+     * `jump' may only be given for a loadProgram platter, see directJump.  
+     * The same `jump' should be given when the size is calculated.
+     */
+    size_t codeFor(const platter & p, char * to, directJump * jump = nullptr);
+
+    /*
+     * Register values known at compile time, tracked across the platters of a 
+     * basic block.  Bit r of `mask' is set if register r holds values[r].
+     */
+    struct knownRegisters
+    {
+        unsigned int mask;
+        unsigned int values[8];
+    };
+
+    /*
+     * Updates `known' to the state after `p' is executed.  A platter that 
+     * ends a basic block clears it.
+     */
+    static void propagateConstants(const platter & p, knownRegisters & known);
+
+    /*
+     * Fills `jump' if `p' is a loadProgram that is known to jump to a platter 
+     * of array 0 that is below `end'.
+     */
+    static bool directJumpFor(const platter & p, const knownRegisters & known,
+                              size_t end, directJump & jump);
+
+    /*
+     * Generates native instructions that continue execution at platter `i' 
+     * using the jump table.  Used at the end of a lazily compiled block.
+     *
+     * Returns number of bytes written into `to'.
+     * If `to' is a nullptr just returns the number of bytes required.
+     */
+    size_t codeForJump(size_t i, char * to);
+
+    /*
+     * Generates a branch to `target'.
+     *
+     * Returns number of bytes written into `to' or 0 if `target' is too far 
+     * away from `to' to be reached with a branch.
+     * If `to' is a nullptr just returns the number of bytes required.
+     */
+    size_t codeForBranch(const char * target, char * to);
+
+    /*
+     * Fills `bytes' bytes at `to' with instructions that do nothing but 
+     * continue execution right after them.
      */
-    size_t codeFor(const platter & p, char * to);
+    void codeForPadding(size_t bytes, char * to);
 
     /*
      * Generates native instructions for an out of bound execution stub.
@@ -105,15 +419,363 @@ private:
      */
     size_t codeForOOBStub(char * to);
 
+    /*
+     * Generates a compact stub for a platter that is most likely data, see 
+     * classifyPlatters(...).  It is a recompile stub, padded so that 
+     * recompilePlatter(...) can replace it with a branch to the platter code 
+     * if the platter is executed after all.
+     *
+     * Retuns number of bytes written into `to'.
+     * If `to' is a nullptr just returns the number of bytes required.
+     */
+    size_t codeForDataStub(char * to);
+
+    /*
+     * Generates native instructions that are shared by all the platters of a 
+     * native code block, like the code that recompile stubs call, and stores 
+     * their addresses in `jt'.
+     *
+     * Retuns number of bytes written into `to'.
+     * If `to' is a nullptr just returns the number of bytes required.  `jt' 
+     * may be a nullptr in this case.
+     */
+    size_t codeForCommonStubs(char * to, class jumpTable * jt);
+
+    /*
+     * A sequence of orthography and output platters that outputs a string 
+     * that is known at compile time.  Compiled programs tend to print 
+     * messages by loading every character with an orthography and outputting 
+     * it right away.
+     */
+    struct outputRun
+    {
+        /* Number of platters in the run, the last one is always an output. */
+        size_t length;
+
+        /* Characters output by the run. */
+        std::string bytes;
+
+        /*
+         * Bit N is set if the run assigns register N.  `values' holds the 
+         * values the assigned registers have after the run.
+         */
+        unsigned int assigned;
+        _registers_type values;
+    };
+
+    /*
+     * Checks if an output run starts at platter `i' of `a' and ends before 
+     * platter `end' and fills in `run' if it does.  Runs that output less 
+     * than two characters are not worth compiling separately and are not 
+     * reported.
+     */
+    bool outputRunAt(const array & a, size_t i, size_t end, outputRun & run);
+
+    /*
+     * Generates native instructions that execute `run' as a whole: assign 
+     * registers, output all the characters with a single return into run() 
+     * and continue at `continueAt'.  The code is only used while array 0 is 
+     * not dirty, otherwise it falls through into the code that follows it, 
+     * that should be the code of the first run platter.
+     *
+     * Returns number of bytes written into `to'.
+     * If `to' is a nullptr just returns the number of bytes required.  
+     * `continueAt' may be a nullptr in this case.
+     */
+    size_t codeForOutputRun(const outputRun & run, const char * continueAt,
+                            char * to);
+
+    /*
+     * A sequence of notAnd platters that calculates bitwise functions of at 
+     * most two registers.  Compiled programs build NOT, AND, OR and XOR out 
+     * of several notAnd platters with temporary registers.  A run calculates 
+     * the final value of every register it assigns directly.
+     */
+    struct bitwiseRun
+    {
+        /* Number of platters in the run. */
+        size_t length;
+
+        /* Registers the run reads before assigning them.  May be equal. */
+        unsigned int x, y;
+
+        /*
+         * Bit N is set if the run assigns register N.  `functions' holds 
+         * truth tables of the values the assigned registers have after the 
+         * run: bit (xBit + 2 * yBit) is the result for the corresponding 
+         * bits of x and y.
+         */
+        unsigned int assigned;
+        std::array<unsigned char, 8> functions;
+    };
+
+    /*
+     * Checks if a bitwise run starts at platter `i' of `a' and ends before 
+     * platter `end' and fills in `run' if it does.  Single platter runs are 
+     * not reported.
+     */
+    bool bitwiseRunAt(const array & a, size_t i, size_t end, bitwiseRun & run);
+
+    /*
+     * A way to calculate a bitwise function of x and y with a few 
+     * instructions:
+     *
+     * r = source; if (negateSource) r = ~r; r = r <operation> <the other 
+     * one of x and y>; if (negateResult) r = ~r;
+     */
+    struct bitwiseRecipe
+    {
+        enum source_type { x, y, zero } source;
+        bool negateSource;
+        enum operation_type { none, and_, or_, xor_ } operation;
+        bool negateResult;
+    };
+
+    /* Finds the shortest recipe for truth table `function'. */
+    static bitwiseRecipe bitwiseRecipeFor(unsigned char function);
+
+    /*
+     * Generates native instructions that execute `run' as a whole and 
+     * continue at `continueAt'.  Same as codeForOutputRun(...) the code is 
+     * only used while array 0 is not dirty.
+     *
+     * Returns number of bytes written into `to'.
+     * If `to' is a nullptr just returns the number of bytes required.  
+     * `continueAt' may be a nullptr in this case.
+     */
+    size_t codeForBitwiseRun(const bitwiseRun & run, const char * continueAt,
+                             char * to);
+
+    /*
+     * Any run of platters that is compiled as a whole, in addition to the 
+     * code of every run platter.
+     */
+    struct fusedRun
+    {
+        /* Number of platters in the run. */
+        size_t length;
+
+        /* Which one of the below describes the run. */
+        bool isOutput;
+        outputRun output;
+        bitwiseRun bitwise;
+    };
+
+    /* Checks for a run of any kind, see outputRunAt(...) and others. */
+    bool fusedRunAt(const array & a, size_t i, size_t end, fusedRun & run);
+
+    /* codeForOutputRun(...) or codeForBitwiseRun(...) */
+    size_t codeForFusedRun(const fusedRun & run, const char * continueAt,
+                           char * to);
+
+    /*
+     * What planRange(...) found out about a range of platters: fused runs, 
+     * direct jumps and the code size.  Finding it takes longer than 
+     * generating code for most platters, so it is done only once, when the 
+     * range code size is calculated.
+     */
+    struct rangePlan
+    {
+        /* Platters [first, last) */
+        size_t first;
+        size_t last;
+
+        /* Every fused run and every platter that is not a part of one. */
+        struct step
+        {
+            /* Code size, including the code of all the run platters. */
+            size_t size;
+
+            /* Index in runs, or noRun for a single platter. */
+            size_t run;
+
+            /* Single platters only.  directJump::target or noJump. */
+            size_t jumpTarget;
+
+            /* The platter gets codeForDataStub(...) instead of its code. */
+            bool data;
+        };
+
+        static const size_t noRun = ~static_cast<size_t>(0);
+        static const size_t noJump = ~static_cast<size_t>(0);
+
+        std::vector<step> steps;
+        std::vector<fusedRun> runs;
+    };
+
+    /*
+     * Fills in `plan' for platters [first, last) of `a'.  If `code' is given, 
+     * platters that are false in it are planned as data.
+     *
+     * Returns number of bytes codeForRange(...) will need for the range.
+     */
+    size_t planRange(const array & a, size_t first, size_t last,
+                     rangePlan & plan,
+                     const std::vector<bool> * code = nullptr);
+
+    /*
+     * Finds platters of an array that are likely to be executed and sets 
+     * them to true in `code'.  `decoded' holds all the array platters.  These 
+     * are `entry', every platter that is an orthography value somewhere in 
+     * the array, as that is how jump targets are loaded, and every platter 
+     * that execution falls through into from one of those.  The rest is most 
+     * likely data.
+     *
+     * A platter that is classified wrong still runs correctly, just compiled 
+     * the first time it is executed.
+     */
+    static void classifyPlatters(const decodedPlatters & decoded, size_t entry,
+                                 std::vector<bool> & code);
+
+    /*
+     * Generates native instructions for platters of `plan' and stores 
+     * addresses of the platter code into `jumpTable', that should have an 
+     * entry for every platter.  Fused runs are compiled as a whole.
+     *
+     * Returns number of bytes written into `to'.
+     */
+    size_t codeForRange(const array & a, const rangePlan & plan, char * to,
+                        void ** jumpTable);
+
     /*
      * Constructs a block of native code and a corresponding jump table for 
      * platters in the specified array.
+     *
+     * In the lazy compilation mode no platters are compiled, all jump table 
+     * entries point to the compile stub.  Otherwise only the platters that 
+     * classifyPlatters(...) finds starting from `entry' are compiled.
+     */
+    void generateNativeCode(array & a, size_t entry = 0);
+
+    /*
+     * generateNativeCode(...) implementation for the compilation::strided 
+     * mode.
+     */
+    void generateStridedNativeCode(array & a);
+
+    /*
+     * Replaces native code for platter `i' of `a' with code generated from 
+     * the current platter value.  New code is written over the old one if it 
+     * fits or into an overflow area.  In the later case old code is replaced 
+     * with a branch.  Jump table is not changed.
+     *
+     * Falls back to generateNativeCode(...) if neither is possible.  Dirty 
+     * flag of `a' is not cleared otherwise, as other platters may still be 
+     * modified after they were compiled.
+     */
+    void recompilePlatter(array & a, size_t i);
+
+    /*
+     * Compiles the basic block that starts at platter `first' of `a'.  `a' 
+     * should have a native code block and platter `first' should not be 
+     * compiled yet.
+     *
+     * Block ends with a platter that never falls through into the next one, 
+     * at the end of the array or right before a platter that is already 
+     * compiled.
+     */
+    void compileBlock(array & a, size_t first);
+
+    /*
+     * In the compilation::traced mode the jump table of an array has twice 
+     * as many entries.  The second half is the trace table: addresses that 
+     * loadProgram jumps to.  Entries point to the profile stub, to a trace 
+     * or, if no trace could be recorded, to the platter code.
+     */
+    void ** traceTable(array & a);
+
+    /* Resets _traceCounters for the current array 0. */
+    void resetTraceCounters();
+
+    /* A path through array 0 recorded by recordTrace(...). */
+    struct trace
+    {
+        struct step
+        {
+            /* Platter index. */
+            size_t index;
+
+            /* For loadProgram: the platter it jumped to. */
+            size_t target;
+        };
+
+        /* Platter the trace starts at and returns to at the end. */
+        size_t head;
+
+        std::vector<step> steps;
+    };
+
+    /*
+     * Executes platters of array 0 starting at `head' and records them into 
+     * `t' until execution gets back to `head'.  Platters that may leave 
+     * native code, modify array 0 or load another array stop the recording 
+     * before they are executed, as does a trace that gets too long.
+     *
+     * Returns true if the trace got back to `head'.  `fingerPosition' is set 
+     * to where the execution should continue in either case.
+     */
+    bool recordTrace(size_t head, trace & t, size_t & fingerPosition);
+
+    /*
+     * Records a trace starting at platter `head' of `a', that is array 0, 
+     * compiles it and points the trace table entry of `head' to it.  Returns 
+     * the finger position to continue at.
+     */
+    size_t traceFrom(array & a, size_t head);
+
+    /*
+     * Generates native instructions for trace `t' of `a'.  The trace checks 
+     * the array 0 dirty flag on entry and after every amendment, and checks 
+     * every loadProgram target.  On a mismatch it continues at the platter 
+     * code using the jump table.
+     *
+     * Returns number of bytes written into `to'.
+     * If `to' is a nullptr just returns the number of bytes required.
+     */
+    size_t codeForTrace(const array & a, const trace & t, char * to);
+
+    /*
+     * Executes array 0 as native code starting at `fingerPosition'.
+     *
+     * Returns false when the machine halts.  In the compilation::tiered mode 
+     * returns true when a program that should be interpreted was loaded, 
+     * `fingerPosition' is set to where the execution should continue.
+     */
+    bool runNative(size_t & fingerPosition);
+
+    /*
+     * Executes array 0 in the interpreter starting at `fingerPosition'.  
+     * Defined in contextInterpreter.cpp.
+     *
+     * Returns false when the machine halts.  In the compilation::tiered mode 
+     * returns true when array 0 should be executed as native code, 
+     * `fingerPosition' is set to where the execution should continue.
+     */
+    bool interpret(size_t & fingerPosition);
+
+    /*
+     * For the compilation::tiered mode.  Returns true if array 0 should be 
+     * executed as native code.  Generates native code for it if array 0 
+     * counters have just crossed the thresholds.
+     */
+    bool nativeTier();
+
+    /*
+     * Flushes output and reports why the machine halted, unless it is a 
+     * normal termination.  `value' is the invalid platter value for 
+     * haltReturnCodes::invalidOperator and the platter index for 
+     * haltReturnCodes::divisionByZero.  Division by zero also reports the 
+     * registers and the size and hash of array 0, to tell which program 
+     * divided.
      */
-    void generateNativeCode(array & a);
+    void halt(size_t haltCode, size_t value);
 
     /* operator callbacks helpers */
 
-    /* Allocates new array and returns its index */
+    /*
+     * Allocates new array and returns its index.  Adds more free indices 
+     * when there are none.
+     */
     size_t allocation(size_t size);
 
     /*
@@ -122,23 +784,86 @@ private:
      */
     void abandonment(size_t index) throw(exceptions::invalidArrayIndex);
 
-    /* Outputs v into _os. */
+    /* Appends v to the output buffer. */
     void output(unsigned char v);
 
+    /* Appends `size' characters starting at `s' to the output buffer. */
+    void output(const char * s, size_t size);
+
+    /* Writes the output buffer content into _os and flushes _os. */
+    void flushOutput();
+
+    /* Calls flushOutput() if _flushInterval has passed since the last one. */
+    void flushOutputIfDue();
+
     /*
-     * Reads the next character from _is and returns it or returns ~0 if the 
-     * stream is in an error or EOF states.
+     * Returns the next input character or ~0 if _is is in an error or EOF 
+     * states.
+     *
+     * Characters are taken from the input buffer.  When it is empty, it is 
+     * filled with all the characters _is can provide without blocking, but 
+     * at least one.  Output is flushed first if the read may block.
      */
     unsigned int input();
 
     /*
-     * Duplicates array index into array 0 and prepares it for execution of 
-     * native code.
+     * Makes array `index' array 0 and prepares it for execution of native 
+     * code.  The array is not copied right away.  Array 0 and array `index' 
+     * are the same array, see array::shared(), until either one is amended.
      *
      * Throws invalidArrayIndex if `index' is 0 or is an index of an array that 
      * is not allocated.
      */
     void loadProgram(size_t index) throw(exceptions::invalidArrayIndex);
+
+    /*
+     * True if array `array' is allocated and has platter `index'.  See 
+     * boundsChecks(...).
+     */
+    bool validIndex(size_t array, size_t index) const;
+
+    /*
+     * Throws invalidArrayIndex unless validIndex(array, index).  
+     * `fingerPosition' is the platter that accesses the array.
+     */
+    void checkIndex(size_t array, size_t index, size_t fingerPosition) const
+        throw(exceptions::invalidArrayIndex);
+
+    /*
+     * Puts a copy of array 0 at the index it was loaded from, so that array 0 
+     * is no longer shared.  Called before a shared array is amended.
+     */
+    void unshare();
+
+    /*
+     * In the writeProtection(...) mode write protects array 0, if it has 
+     * native code and is not protected yet.  Array 0 is moved to pages of 
+     * its own first, if necessary, see array::ownPages().
+     */
+    void protectArray0();
+
+    /*
+     * Makes platters of `a' writable again, if they are write protected.  
+     * Called before anything but native code amends `a' and before `a' is 
+     * destroyed or cached.
+     */
+    void unprotect(array & a);
+
+    /* Bytes of the whole pages that hold the platters of `a'. */
+    static size_t protectedSize(const array & a);
+
+    /*
+     * Handles division by zero, writes into write protected arrays and 
+     * bounds checks that read the size of an abandoned array by native code.  
+     * Defined in contextX64.cpp and contextX86.cpp.
+     */
+    struct faultHandler;
+
+    /*
+     * Installs faultHandler for this context or restores the previous 
+     * handler.  Called around native code execution.
+     */
+    void handleFaults(bool enable);
 };
 
 #endif /* __CONTEXT__H */
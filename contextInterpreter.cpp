@@ -0,0 +1,316 @@
+#include "context.h"
+
+#include "nativeCodeProtocol.h"
+#include "decodedPlatters.h"
+
+#include <vector>
+#include <algorithm>
+
+#include <boost/assert.hpp>
+
+
+/*
+ * Portable execution engine, used in the context::compilation::interpreted
+ * mode.  It does not generate any native code, so it works where the code
+ * generators do not and serves as a baseline for them.
+ *
+ * In the compilation::tiered mode it also counts how many times array 0 jumps 
+ * backwards and hands it over to run() as soon as it should be compiled.
+ *
+ * Array 0 is decoded into a vector of operations, one for every platter and
+ * one more after the last that stops execution beyond the array end.  With
+ * GCC compatible compilers every operation holds the address of the code that
+ * executes it and every handler jumps to the next one directly (direct
+ * threading).  Other compilers get a switch in a loop.
+ */
+#if defined(__GNUC__)
+# define THREADED_INTERPRETER
+#endif
+
+using namespace std;
+
+
+namespace
+{
+    /* Handlers that do not correspond to platter operators. */
+    enum
+    {
+        invalidOperatorHandler = platter::operator_::orthography + 1,
+        outOfBoundHandler,
+        handlerCount
+    };
+
+    struct operation
+    {
+#ifdef THREADED_INTERPRETER
+        const void * handler;
+#else
+        unsigned int handler;
+#endif
+        unsigned int value;
+        unsigned char A, B, C;
+    };
+
+    /*
+     * Output buffer flush interval is checked once in this many executed
+     * loadProgram operators, as checking time is relatively expensive.
+     */
+    const unsigned int flushCheckPeriod = 64 * 1024;
+
+    /*
+     * Decodes platter `i' of `a' into program[i].  `handlers' maps operator
+     * numbers and the extra handlers above to operation::handler values.
+     */
+    template <typename Handler>
+    void decode(vector<operation> & program, const ::array & a, size_t i,
+                const Handler * handlers)
+    {
+        operation & op = program[i];
+        unsigned int A = 0, B = 0, C = 0, value = 0;
+
+        try
+        {
+            op.handler = handlers[a[i].decode(A, B, C, value)];
+        }
+        catch (const exceptions::invalidOperatorFormat & /* ex */)
+        {
+            op.handler = handlers[invalidOperatorHandler];
+            value = a[i];
+        }
+
+        op.value = value;
+        op.A = static_cast<unsigned char>(A);
+        op.B = static_cast<unsigned char>(B);
+        op.C = static_cast<unsigned char>(C);
+    }
+
+    /*
+     * Decodes all the platters of `a' and adds the out of bound operation.  
+     * decodedPlatters::invalidOperator is the same as invalidOperatorHandler, 
+     * so the batch decoder output is used as is.
+     */
+    template <typename Handler>
+    void decode(vector<operation> & program, const ::array & a,
+                const Handler * handlers)
+    {
+        static_assert(decodedPlatters::invalidOperator
+                      == invalidOperatorHandler,
+                      "Invalid operators are tagged with their handler index");
+
+        decodedPlatters decoded(a);
+
+        program.resize(a.size() + 1);
+
+        for (size_t i = 0, size = a.size(); i < size; ++i)
+        {
+            operation & op = program[i];
+
+            op.handler = handlers[decoded.operators()[i]];
+            op.value = decoded.values()[i];
+            op.A = decoded.A()[i];
+            op.B = decoded.B()[i];
+            op.C = decoded.C()[i];
+        }
+
+        program.back().handler = handlers[outOfBoundHandler];
+    }
+}
+
+bool context::interpret(size_t & fingerPosition)
+{
+#ifdef THREADED_INTERPRETER
+    static const void * const handlers[handlerCount] = {
+        &&conditionalMove, &&arrayIndex, &&arrayAmendment, &&addition,
+        &&multiplication, &&division, &&notAnd, &&halt,
+        &&allocation, &&abandonment, &&output, &&input,
+        &&loadProgram, &&orthography,
+        &&invalidOperator, &&outOfBound
+    };
+
+# define OPERATION(NAME, NUMBER) NAME:
+# define NEXT(IP) ip = (IP); goto *ip->handler
+#else
+    static const unsigned int handlers[handlerCount] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+        invalidOperatorHandler, outOfBoundHandler
+    };
+
+# define OPERATION(NAME, NUMBER) case NUMBER:
+# define NEXT(IP) ip = (IP); continue
+#endif
+
+    vector<operation> program;
+    decode(program, *_arrays[0], handlers);
+
+    unsigned int r[8];
+    for (size_t i = 0; i < 8; ++i)
+        r[i] = _registers[i];
+
+    unsigned int flushCheckCountdown = flushCheckPeriod;
+
+    const operation * ip = &program[0]
+                           + min(fingerPosition, program.size() - 1);
+
+#ifdef THREADED_INTERPRETER
+    goto *ip->handler;
+#else
+    while (true)
+    {
+        switch (ip->handler)
+        {
+#endif
+
+    OPERATION(conditionalMove, platter::operator_::conditionalMove)
+        if (r[ip->C])
+            r[ip->A] = r[ip->B];
+        NEXT(ip + 1);
+
+    OPERATION(arrayIndex, platter::operator_::arrayIndex)
+        if (_boundsChecks)
+            checkIndex(r[ip->B], r[ip->C], ip - &program[0]);
+        r[ip->A] = (*_arrays[r[ip->B]])[r[ip->C]];
+        NEXT(ip + 1);
+
+    OPERATION(arrayAmendment, platter::operator_::arrayAmendment)
+        {
+            if (_boundsChecks)
+                checkIndex(r[ip->A], r[ip->B], ip - &program[0]);
+
+            if (_arrays[r[ip->A]]->shared())
+                unshare();
+
+            ::array & a = *_arrays[r[ip->A]];
+            if (a.writeProtected())
+                unprotect(a);
+
+            a[r[ip->B]] = r[ip->C];
+            a.dirty(true);
+
+            /* Self modification. */
+            if (r[ip->A] == 0)
+                decode(program, a, r[ip->B], handlers);
+        }
+        NEXT(ip + 1);
+
+    OPERATION(addition, platter::operator_::addition)
+        r[ip->A] = r[ip->B] + r[ip->C];
+        NEXT(ip + 1);
+
+    OPERATION(multiplication, platter::operator_::multiplication)
+        r[ip->A] = r[ip->B] * r[ip->C];
+        NEXT(ip + 1);
+
+    OPERATION(division, platter::operator_::division)
+        if (r[ip->C] == 0)
+        {
+            for (size_t i = 0; i < 8; ++i)
+                _registers[i] = r[i];
+
+            halt(haltReturnCodes::divisionByZero, ip - &program[0]);
+            return false;
+        }
+        r[ip->A] = r[ip->B] / r[ip->C];
+        NEXT(ip + 1);
+
+    OPERATION(notAnd, platter::operator_::notAnd)
+        r[ip->A] = ~(r[ip->B] & r[ip->C]);
+        NEXT(ip + 1);
+
+    OPERATION(halt, platter::operator_::halt)
+        halt(haltReturnCodes::normalTermination, 0);
+        return false;
+
+    OPERATION(allocation, platter::operator_::allocation)
+        r[ip->B] = static_cast<unsigned int>(allocation(r[ip->C]));
+        NEXT(ip + 1);
+
+    OPERATION(abandonment, platter::operator_::abandonment)
+        abandonment(r[ip->C]);
+        NEXT(ip + 1);
+
+    OPERATION(output, platter::operator_::output)
+        output(static_cast<unsigned char>(r[ip->C]));
+
+        /* Same as native code, see context::runNative(...). */
+        if (r[ip->C] == '\n')
+            flushOutputIfDue();
+        NEXT(ip + 1);
+
+    OPERATION(input, platter::operator_::input)
+        r[ip->C] = input();
+        NEXT(ip + 1);
+
+    OPERATION(loadProgram, platter::operator_::loadProgram)
+        if (--flushCheckCountdown == 0)
+        {
+            flushCheckCountdown = flushCheckPeriod;
+            flushOutputIfDue();
+        }
+
+        {
+            size_t newFingerPosition = r[ip->C];
+
+            if (r[ip->B] != 0)
+            {
+                loadProgram(r[ip->B]);
+
+                if (newFingerPosition >= _arrays[0]->size())
+                    throw exceptions::invalidArrayIndex
+                        (L"loadProgram index out of range", newFingerPosition);
+
+                if (_compilation == compilation::tiered && nativeTier())
+                {
+                    fingerPosition = newFingerPosition;
+                    goto leave;
+                }
+
+                decode(program, *_arrays[0], handlers);
+            }
+            else if (_compilation == compilation::tiered
+                     && newFingerPosition
+                        <= static_cast<size_t>(ip - &program[0]))
+            {
+                ++_arrays[0]->_backEdgeCount;
+
+                if (nativeTier())
+                {
+                    fingerPosition = newFingerPosition;
+                    goto leave;
+                }
+            }
+
+            /* Jumps beyond the array end get to the out of bound operation. */
+            NEXT(&program[0]
+                 + min<size_t>(newFingerPosition, program.size() - 1));
+        }
+
+    OPERATION(orthography, platter::operator_::orthography)
+        r[ip->A] = ip->value;
+        NEXT(ip + 1);
+
+    OPERATION(invalidOperator, invalidOperatorHandler)
+        halt(haltReturnCodes::invalidOperator, ip->value);
+        return false;
+
+    OPERATION(outOfBound, outOfBoundHandler)
+        halt(haltReturnCodes::outOfBoundExecution, 0);
+        return false;
+
+#ifndef THREADED_INTERPRETER
+            default:
+                BOOST_ASSERT(false);
+                return false;
+        }
+    }
+#endif
+
+    /* Native code continues at fingerPosition. */
+leave:
+    for (size_t i = 0; i < 8; ++i)
+        _registers[i] = r[i];
+
+    return true;
+
+#undef NEXT
+#undef OPERATION
+}
@@ -0,0 +1,1971 @@
+#include "context.h"
+
+#include "jumpTable.h"
+#include "memoryManager.h"
+#include "nativeCode.h"
+#include "nativeCodeProtocol.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/assert.hpp>
+
+
+/*
+ * Native code generator for the x86-64 System V (Linux) build.
+ *
+ * x86-64 has enough registers to keep all eight UM registers in host
+ * registers for the whole time native code runs.  UM register N lives in
+ * R(8 + N)D.  They are loaded from and stored into context::_registers only by
+ * the entry trampoline, that is every time native code is entered from or
+ * returns into context::run().
+ */
+#if defined(__x86_64__)
+
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+
+/*
+ * System V AMD64 ABI counterpart of the __asm block in context::run() for the
+ * 32-bit build.
+ *
+ * Saves callee saved registers, loads native code registers from the frame and
+ * calls into the native code.  Native code returns with a plain ret, see
+ * EMIT_RETURN, and puts the address to resume at into rdx.  Every call is
+ * matched by a ret, so the return stack buffer predicts both the return and
+ * the ret at the end of this function.
+ *
+ * UM registers are loaded into R8D-R15D right before the call and are stored
+ * back into the register file right after it.
+ *
+ * Stack is 16 byte aligned at the `call rcx', so native code starts with the
+ * same alignment as any other function would.
+ */
+__asm__(
+    ".text\n"
+    ".p2align 4\n"
+    ".globl enterNativeCode\n"
+    ".hidden enterNativeCode\n"
+    ".type enterNativeCode, @function\n"
+    "enterNativeCode:\n"
+    ".intel_syntax noprefix\n"
+    "    push rbx\n"
+    "    push rbp\n"
+    "    push r12\n"
+    "    push r13\n"
+    "    push r14\n"
+    "    push r15\n"
+    "    push rdi\n"
+
+    "    mov rax, [rdi + 0]\n"         /* eaxValue  */
+    "    mov rcx, [rdi + 8]\n"         /* resumeAt  */
+    "    mov rsi, [rdi + 16]\n"        /* registers */
+    "    mov rbp, [rdi + 32]\n"        /* jumpTable */
+    "    mov rdi, [rdi + 24]\n"        /* arrays    */
+
+    "    mov r8d,  [rsi + 0]\n"
+    "    mov r9d,  [rsi + 4]\n"
+    "    mov r10d, [rsi + 8]\n"
+    "    mov r11d, [rsi + 12]\n"
+    "    mov r12d, [rsi + 16]\n"
+    "    mov r13d, [rsi + 20]\n"
+    "    mov r14d, [rsi + 24]\n"
+    "    mov r15d, [rsi + 28]\n"
+
+    "    call rcx\n"
+
+    "    mov [rsi + 0],  r8d\n"
+    "    mov [rsi + 4],  r9d\n"
+    "    mov [rsi + 8],  r10d\n"
+    "    mov [rsi + 12], r11d\n"
+    "    mov [rsi + 16], r12d\n"
+    "    mov [rsi + 20], r13d\n"
+    "    mov [rsi + 24], r14d\n"
+    "    mov [rsi + 28], r15d\n"
+
+    "    pop rdi\n"
+    "    mov [rdi + 8], rdx\n"         /* resumeAt   */
+    "    mov [rdi + 40], rax\n"        /* returnCode */
+    "    mov [rdi + 48], rbx\n"        /* value1     */
+    "    mov [rdi + 56], rcx\n"        /* value2     */
+
+    "    pop r15\n"
+    "    pop r14\n"
+    "    pop r13\n"
+    "    pop r12\n"
+    "    pop rbp\n"
+    "    pop rbx\n"
+    "    ret\n"
+    ".att_syntax prefix\n"
+    ".size enterNativeCode, . - enterNativeCode\n"
+);
+
+/*
+ * --- x86-64 encoding helpers ---
+ *
+ * UM registers are R8D-R15D, so every instruction that uses them as an
+ * operand needs a REX prefix with the bit that extends the corresponding
+ * ModRM or SIB field.  Fields themselves hold the UM register index.
+ */
+
+/* REX prefix bits */
+#define REX     0x40
+#define REX_W   0x08
+#define REX_R   0x04
+#define REX_X   0x02
+#define REX_B   0x01
+
+/* ModRM byte for a register to register operation. */
+#define MODRM_RR(REG, RM) (0xC0 | ((REG) << 3) | (RM))
+
+/*
+ * disp32 of a context::_nativeState field.  RSI points to the registers array 
+ * and _nativeState is at a fixed offset from it.
+ */
+#define EMIT_STATE_DISP(FIELD)                                           \
+    EMIT_WORD(static_cast<unsigned int>(                                \
+                nativeStateOffset() + offsetof(_nativeState_type, FIELD)))
+
+/*
+ * Returns into run(), that continues right after this code.  rdx holds the 
+ * address to resume at and ret goes back to enterNativeCode.  Takes 8 
+ * bytes.
+ */
+#define EMIT_RETURN                                                     \
+    EMIT_BYTES("\x48\x8D\x15\x01\x00\x00\x00"                           \
+                                  /* lea rdx, [rip + disp32(1)]     */  \
+               "\xC3");                 /* ret                      */  \
+    /* */
+
+/*
+ * Parts of the context::boundsChecks(...) checks.  faultHandler recognizes 
+ * EMIT_ARRAY_SIZE_CMP when it reads the size of an abandoned array, that is 
+ * through a null pointer.
+ */
+
+/* cmp ARRAY, [rsi + arrayCount] */
+#define EMIT_ARRAY_COUNT_CMP(ARRAY)                                     \
+    EMIT_BYTE(REX | REX_R);                                             \
+    EMIT_BYTE(0x3B);                    /* cmp ARRAY, [rsi + disp32] */ \
+    EMIT_BYTE(0x86 | ((ARRAY) << 3));                                   \
+    EMIT_STATE_DISP(arrayCount);                                        \
+    /* */
+
+/* rax: array[ARRAY] */
+#define EMIT_ARRAY_LOAD(ARRAY)                                          \
+    EMIT_BYTE(REX | REX_W | REX_X);                                     \
+    EMIT_BYTES("\x8B\x04");             /* mov rax, [rdi + ARRAY * 8] */ \
+    EMIT_BYTE(0xC7 | ((ARRAY) << 3));   /* SIB: scale 8, ARRAY, rdi */  \
+    /* */
+
+/* cmp INDEX, [rax + array::_size] */
+#define EMIT_ARRAY_SIZE_CMP(INDEX)                                      \
+    EMIT_BYTE(REX | REX_R);                                             \
+    EMIT_BYTE(0x3B);                    /* cmp INDEX, [rax + disp8] */  \
+    EMIT_BYTE(0x40 | ((INDEX) << 3));                                   \
+    EMIT_BYTE(static_cast<unsigned char>(offsetof(::array, _size)));    \
+    BOOST_ASSERT(offsetof(::array, _size) < 128);                       \
+    /* */
+
+/*
+ * Platter code part.  Leaves array[ARRAY] in rax, or returns invalidIndex.  
+ * Takes boundsCheckSize bytes.
+ */
+#define EMIT_BOUNDS_CHECK(ARRAY, INDEX)                                 \
+    static_assert(nativeCodeReturnValue::invalidIndex == 12,            \
+                  "invalidIndex value is encoded below.  If it "        \
+                  "changes the value below should be updated.");        \
+                                                                        \
+    /* if (ARRAY >= arrayCount) goto fail */                            \
+    EMIT_ARRAY_COUNT_CMP(ARRAY);                                        \
+    EMIT_BYTES("\x73\x0A");             /* jae rel8: 10             */  \
+    EMIT_ARRAY_LOAD(ARRAY);                                             \
+    /* if (INDEX < array[ARRAY]->_size) goto ok */                      \
+    EMIT_ARRAY_SIZE_CMP(INDEX);                                         \
+    EMIT_BYTES("\x72\x12");             /* jb rel8: 18              */  \
+    /* fail: ebx: INDEX, ecx: ARRAY */                                  \
+    EMIT_BYTE(REX | REX_R);                                             \
+    EMIT_BYTE(0x89);                    /* mov ebx, INDEX           */  \
+    EMIT_BYTE(MODRM_RR(INDEX, 3));                                      \
+    EMIT_BYTE(REX | REX_R);                                             \
+    EMIT_BYTE(0x89);                    /* mov ecx, ARRAY           */  \
+    EMIT_BYTE(MODRM_RR(ARRAY, 1));                                      \
+    /* eax: nativeCodeReturnValue::invalidIndex */                      \
+    EMIT_BYTES("\x31\xC0"               /* xor eax, eax             */  \
+               "\xB0\x0C");             /* mov al, imm8             */  \
+    EMIT_RETURN;                                                        \
+    /* ok: */                                                           \
+    /* */
+
+/*
+ * Conditional jumps into the slow path of the allocation and abandonment 
+ * code.  rel8 values are filled in by PATCH_SLOW_JUMPS once the slow path 
+ * position is known.
+ */
+#define EMIT_SLOW_JUMP(OPCODE)                                          \
+    EMIT_BYTE(OPCODE);                                                  \
+    EMIT_BYTE(0);                                                       \
+    BOOST_ASSERT(slowJumpCount < sizeof(slowJumps) / sizeof(slowJumps[0])); \
+    slowJumps[slowJumpCount++] = size;                                  \
+    /* */
+
+#define PATCH_SLOW_JUMPS                                                \
+    for (size_t i = 0; i < slowJumpCount; ++i)                          \
+    {                                                                   \
+        BOOST_ASSERT(size - slowJumps[i] < 128);                        \
+        if (to)                                                         \
+            to[slowJumps[i] - 1] =                                      \
+                static_cast<char>(size - slowJumps[i]);                 \
+    }                                                                   \
+    slowJumpCount = 0;                                                  \
+    /* */
+
+/*
+ * --- Stencils ---
+ *
+ * Code for operators that do not depend on anything but the registers they 
+ * use, see stencil in nativeCodeProtocol.h.  Comments list the operands every 
+ * stencil expects, in order, and host registers that hold them are named 
+ * after them.
+ */
+#define LOW(OFFSET, OPERAND)                                            \
+    { stencil::hole::lowRegister, OFFSET, OPERAND }
+#define MIDDLE(OFFSET, OPERAND)                                         \
+    { stencil::hole::middleRegister, OFFSET, OPERAND }
+
+namespace
+{
+    struct stencilId
+    {
+        enum value
+        {
+            conditionalMove,
+            arrayIndex,
+            add,
+            moveAdd,
+            multiply,
+            moveMultiply,
+            division,
+            not_,
+            moveNot,
+            andNot,
+            moveAndNot,
+            halt,
+            orthography,
+            count
+        };
+    };
+
+    constexpr stencil stencils[stencilId::count] = {
+        /* conditionalMove: A, B, C */
+        {
+            STENCIL_CODE("\x45\x85\xC0"         /* test C, C                */
+                         "\x45\x0F\x45\xC0"),   /* cmovnz A, B              */
+            { MIDDLE(2, 2), LOW(2, 2), MIDDLE(6, 0), LOW(6, 1) }
+        },
+        /* arrayIndex: A, B, C */
+        {
+            STENCIL_CODE("\x4A\x8B\x04\xC7"     /* mov rax, [rdi + B * 8]   */
+                         "\x46\x8B\x44\x80\x00"),
+                                    /* mov A, [rax + C * 4 + disp8]     */
+                                    /*     <first platter>              */
+            { MIDDLE(3, 1), MIDDLE(6, 0), MIDDLE(7, 2),
+              { stencil::hole::plattersOffset, 8, 0 } }
+        },
+        /* add: A, X */
+        {
+            STENCIL_CODE("\x45\x01\xC0"),       /* add A, X                 */
+            { MIDDLE(2, 1), LOW(2, 0) }
+        },
+        /* moveAdd: A, B, C */
+        {
+            STENCIL_CODE("\x45\x89\xC0"         /* mov A, B                 */
+                         "\x45\x01\xC0"),       /* add A, C                 */
+            { MIDDLE(2, 1), LOW(2, 0), MIDDLE(5, 2), LOW(5, 0) }
+        },
+        /* multiply: A, X */
+        {
+            STENCIL_CODE("\x45\x0F\xAF\xC0"),   /* imul A, X                */
+            { MIDDLE(3, 0), LOW(3, 1) }
+        },
+        /* moveMultiply: A, B, C */
+        {
+            STENCIL_CODE("\x45\x89\xC0"         /* mov A, B                 */
+                         "\x45\x0F\xAF\xC0"),   /* imul A, C                */
+            { MIDDLE(2, 1), LOW(2, 0), MIDDLE(6, 0), LOW(6, 2) }
+        },
+        /* division: A, B, C */
+        {
+            STENCIL_CODE("\x44\x89\xC0"         /* mov eax, B               */
+                         "\x31\xD2"             /* xor edx, edx             */
+                         "\x41\xF7\xF0"         /* div edx:eax, C           */
+                         "\x41\x89\xC0"),       /* mov A, eax               */
+            { MIDDLE(2, 1), LOW(7, 2), LOW(10, 0) }
+        },
+        /* not_: A */
+        {
+            STENCIL_CODE("\x41\xF7\xD0"),       /* not A                    */
+            { LOW(2, 0) }
+        },
+        /* moveNot: A, B */
+        {
+            STENCIL_CODE("\x45\x89\xC0"         /* mov A, B                 */
+                         "\x41\xF7\xD0"),       /* not A                    */
+            { MIDDLE(2, 1), LOW(2, 0), LOW(5, 0) }
+        },
+        /* andNot: A, X */
+        {
+            STENCIL_CODE("\x45\x21\xC0"         /* and A, X                 */
+                         "\x41\xF7\xD0"),       /* not A                    */
+            { MIDDLE(2, 1), LOW(2, 0), LOW(5, 0) }
+        },
+        /* moveAndNot: A, B, C */
+        {
+            STENCIL_CODE("\x45\x89\xC0"         /* mov A, B                 */
+                         "\x45\x21\xC0"         /* and A, C                 */
+                         "\x41\xF7\xD0"),       /* not A                    */
+            { MIDDLE(2, 1), LOW(2, 0), MIDDLE(5, 2), LOW(5, 0), LOW(8, 0) }
+        },
+        /* halt */
+        {
+            /* eax: nativeCodeReturnValue::halt, ebx: normalTermination */
+            STENCIL_CODE("\x31\xC0"             /* xor eax, eax             */
+                         "\xB0\x01"             /* mov al, imm8             */
+                         "\x31\xDB"             /* xor ebx, ebx             */
+                         "\x48\x8D\x15\x01\x00\x00\x00"
+                                    /* lea rdx, [rip + disp32(1)]       */
+                         "\xC3"),               /* ret                      */
+            { }
+        },
+        /* orthography: A */
+        {
+            STENCIL_CODE("\x41\xB8\x00\x00\x00\x00"),
+                                                /* mov A, imm32             */
+            { LOW(1, 0), { stencil::hole::imm32, 2, 0 } }
+        },
+    };
+
+    constexpr preparedStencils<stencilId::count> prepared =
+        prepareStencils(stencils);
+
+    /*
+     * Returns the stencil for an operator and fills in its register 
+     * operands, or nullptr if the operator code depends on more than its 
+     * registers.
+     *
+     * Operators that update a register in place skip the instruction that 
+     * copies the source into the destination, so the stencil depends on 
+     * which of A, B and C are the same register.
+     */
+    const preparedStencil * stencilFor(platter::operator_::value op,
+                                       unsigned int A, unsigned int B,
+                                       unsigned int C, unsigned int * operands)
+    {
+        static_assert(nativeCodeReturnValue::halt == 1
+                      && haltReturnCodes::normalTermination == 0,
+                      "halt stencil encodes these values.  If they change "
+                      "the stencil should be updated.");
+
+        operands[0] = A;
+        operands[1] = B;
+        operands[2] = C;
+
+        switch (op)
+        {
+            case platter::operator_::conditionalMove:
+                return &prepared.at[stencilId::conditionalMove];
+
+            case platter::operator_::arrayIndex:
+                return &prepared.at[stencilId::arrayIndex];
+
+            case platter::operator_::addition:
+                if (A == C)
+                    return &prepared.at[stencilId::add];
+
+                if (A == B)
+                {
+                    operands[1] = C;
+                    return &prepared.at[stencilId::add];
+                }
+
+                return &prepared.at[stencilId::moveAdd];
+
+            /*
+             * Lower 32 bits of a product are the same for signed and 
+             * unsigned multiplication.
+             */
+            case platter::operator_::multiplication:
+                if (A == C)
+                    return &prepared.at[stencilId::multiply];
+
+                if (A == B)
+                {
+                    operands[1] = C;
+                    return &prepared.at[stencilId::multiply];
+                }
+
+                return &prepared.at[stencilId::moveMultiply];
+
+            case platter::operator_::division:
+                return &prepared.at[stencilId::division];
+
+            case platter::operator_::notAnd:
+                if (A == C)
+                    return B == C ? &prepared.at[stencilId::not_]
+                                  : &prepared.at[stencilId::andNot];
+
+                if (A == B)
+                {
+                    operands[1] = C;
+                    return &prepared.at[stencilId::andNot];
+                }
+
+                return B == C ? &prepared.at[stencilId::moveNot]
+                              : &prepared.at[stencilId::moveAndNot];
+
+            case platter::operator_::halt:
+                return &prepared.at[stencilId::halt];
+
+            case platter::operator_::orthography:
+                return &prepared.at[stencilId::orthography];
+
+            default:
+                return nullptr;
+        }
+    }
+}
+
+#undef MIDDLE
+#undef LOW
+
+/*
+ * Native code only allocates arrays that fit into chunks of lists up to this 
+ * one, that is 4KB chunks.  Larger arrays are rare and take a while to zero 
+ * out anyway.
+ */
+const size_t nativeAllocationMaxChunkIndex = 7;
+
+/* Length of the EMIT_BOUNDS_CHECK code. */
+const size_t boundsCheckSize = 37;
+
+size_t context::codeFor(const platter & p, char * to, directJump * jump)
+{
+    /*
+     * Native code assumes:
+     *
+     * R8D-R15D - UM registers 0 to 7
+     * RSI - pointer to the registers array [8 32-bit values].  Only the entry
+     *       trampoline uses it.
+     * RDI - pointer to the collection of array pointers
+     * RBP - jump table first entry address
+     *
+     * In the comments below A, B and C name host registers that hold the
+     * corresponding UM registers.
+     */
+
+    unsigned int A = 0, B = 0, C = 0, value = 0;
+
+    size_t size = 0;
+    char * curr = to;
+
+    size_t jmpSource = 0;
+
+    /* Ends of the EMIT_SLOW_JUMP jumps. */
+    size_t slowJumps[8];
+    size_t slowJumpCount = 0;
+
+    /*
+     * Any instruction should be compiled into at least this many bytes so that
+     * it can always be overwritten by a recompile stub in case the code in the
+     * array 0 will decide to modify itself.
+     *
+     * Stub is a call to the recompile common stub:
+     *
+     * FF 55 F8          call [rbp + disp8(-8)]
+     */
+    const size_t recompileStubSize = 3;
+
+    static_assert(jumpTable::commonStub::recompile == 1
+                  && jumpTable::commonStub::compile == 2,
+                  "Common stub slots are encoded in the code below.  If they "
+                  "change the code below should be updated.");
+
+    /*
+     * Data platters are often not valid operators.  They are checked before 
+     * decoding, as throwing invalidOperatorFormat for every one of them takes 
+     * longer than compiling a valid platter.
+     */
+    if (static_cast<unsigned int>(p) >> 28 > platter::operator_::orthography)
+    {
+        static_assert(nativeCodeReturnValue::halt == 1,
+                      "halt value is encoded below.  If it changes "
+                      "the value below should be updated.");
+        static_assert(haltReturnCodes::invalidOperator == 1,
+                      "invalidOperator value is encoded below.  If it changes "
+                      "the value below should be update.");
+
+        /* eax: nativeCodeReturnValue::halt */
+        EMIT_BYTES("\x31\xC0"               /* xor eax, eax             */
+                   "\xB0\x01"               /* mov al, imm8             */
+                                   /* imm8: nativeCodeReturnValue::halt */
+        /* ebx: 1 - invalid operator */
+                   "\x31\xDB"               /* xor ebx, ebx             */
+                   "\xB3\x01"               /* mov bl, imm8             */
+                              /* imm8: haltReturnCodes::invalidOperator */
+        /* ecx: Invalid platter value */
+                   "\xB9");                 /* mov ecx, imm32           */
+        EMIT_WORD(p);
+        /* return */
+        EMIT_RETURN;
+
+        BOOST_ASSERT(size >= recompileStubSize);
+
+        return size;
+    }
+
+    platter::operator_::value op = p.decode(A, B, C, value);
+
+    static_assert(minStencilSize(stencils) >= recompileStubSize,
+                  "Stencil code should fit a recompile stub.");
+
+    /* Checked arrayIndex is not a stencil, see below. */
+    unsigned int operands[stencilOperand::count];
+    const preparedStencil * s = stencilFor(op, A, B, C, operands);
+    if (s && !(_boundsChecks && op == platter::operator_::arrayIndex))
+    {
+        operands[stencilOperand::imm32] = value;
+        operands[stencilOperand::plattersOffset] =
+            static_cast<unsigned int>(::array::_plattersOffset);
+        BOOST_ASSERT(::array::_plattersOffset < 128);
+
+        return emitStencil(*s, operands, to);
+    }
+
+    switch (op)
+    {
+        case platter::operator_::arrayIndex:
+
+            /* Only in the boundsChecks(...) mode. */
+            EMIT_BOUNDS_CHECK(B, C);
+            BOOST_ASSERT(size == boundsCheckSize);
+
+            /* A = array[B]->platters()[C] */
+            EMIT_BYTE(REX | REX_R | REX_X);
+            EMIT_BYTE(0x8B);          /* mov A, [rax + C * 4 + disp8]   */
+            EMIT_BYTE(0x44 | (A << 3));
+            EMIT_BYTE(0x80 | (C << 3));     /* SIB: scale 4, C, rax     */
+            EMIT_BYTE(::array::_plattersOffset);     /* <first platter> */
+            BOOST_ASSERT(::array::_plattersOffset < 128);
+
+            break;
+
+        case platter::operator_::arrayAmendment:
+
+            static_assert(nativeCodeReturnValue::unshare == 11,
+                          "unshare value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            /* rax: array[A] */
+            if (_boundsChecks)
+            {
+                EMIT_BOUNDS_CHECK(A, B);
+                BOOST_ASSERT(size == boundsCheckSize);
+            }
+            else
+            {
+                EMIT_ARRAY_LOAD(A);
+            }
+
+            /*
+             * In the write protection mode faultHandler does everything 
+             * below but the store itself, only when it is necessary.  It 
+             * expects the store right after the code above.
+             */
+            if (!_writeProtection)
+            {
+                /*
+                 * if (array[A]->_flags & shared) { 
+                 *     return unshare; 
+                 *     <start over> 
+                 * }
+                 */
+                EMIT_BYTES("\xF6\x40");     /* test byte [rax + disp8], */
+                EMIT_BYTE(static_cast<unsigned char>(
+                              offsetof(::array, _flags)));
+                                            /*   [rax + array::_flags], */
+                EMIT_BYTE(static_cast<unsigned char>(::array::flag::shared));
+                                            /* imm8: array::flag::shared */
+                EMIT_BYTES("\x74\x0E"       /* jz rel8: 14              */
+                           "\x31\xC0"       /* xor eax, eax             */
+                           "\xB0\x0B");     /* mov al, imm8             */
+                            /* imm8: nativeCodeReturnValue::unshare     */
+                EMIT_RETURN;
+                EMIT_BYTE(0xEB);            /* jmp rel8                 */
+                EMIT_BYTE(static_cast<unsigned char>(
+                              -static_cast<int>(size + 1)));
+                                            /*   rel8: <start>          */
+                BOOST_ASSERT(offsetof(::array, _flags) < 128);
+                BOOST_ASSERT(size
+                             == (_boundsChecks ? boundsCheckSize : 4) + 20);
+
+                /* array[A]->_flags |= dirty */
+                EMIT_BYTES("\x80\x48");     /* or [rax + disp8], imm8   */
+                EMIT_BYTE(static_cast<unsigned char>(
+                              offsetof(::array, _flags)));
+                                            /*    [rax + array::_flags] */
+                EMIT_BYTE(static_cast<unsigned char>(::array::flag::dirty));
+                                            /* imm8: array::flag::dirty */
+                BOOST_ASSERT(offsetof(::array, _flags) < 128);
+            }
+
+            /* array[A]->platters()[B] = C */
+            EMIT_BYTE(REX | REX_R | REX_X);
+            EMIT_BYTE(0x89);          /* mov [rax + B * 4 + disp8], C   */
+            EMIT_BYTE(0x44 | (C << 3));
+            EMIT_BYTE(0x80 | (B << 3));     /* SIB: scale 4, B, rax     */
+            EMIT_BYTE(::array::_plattersOffset);     /* <first platter> */
+            BOOST_ASSERT(::array::_plattersOffset < 128);
+
+            if (_writeProtection)
+            {
+                BOOST_ASSERT(size == (_boundsChecks ? boundsCheckSize : 4) + 5);
+                BOOST_ASSERT(size >= recompileStubSize);
+                break;
+            }
+
+            /* if (A == 0) { */
+            EMIT_BYTE(REX | REX_R | REX_B);
+            EMIT_BYTE(0x85);                /* test A, A                */
+            EMIT_BYTE(MODRM_RR(A, A));
+            EMIT_BYTE(0x75);                /* jnz rel8                 */
+
+            if (_compilation == compilation::strided)
+            {
+                EMIT_BYTE(0x1C);            /*   rel8: 28               */
+                jmpSource = size;
+
+                /*     rax: <slot B> */
+                EMIT_BYTE(REX | REX_R);
+                EMIT_BYTE(0x89);            /* mov eax, B               */
+                EMIT_BYTE(MODRM_RR(B, 0));
+                EMIT_BYTES("\x48\xC1\xE0");  /* shl rax, imm8            */
+                EMIT_BYTE(codeStrideShift); /*   codeStrideShift        */
+                EMIT_BYTES("\x48\x8D\x15");  /* lea rdx, [rip + disp32]  */
+                EMIT_WORD(to ? static_cast<unsigned int>
+                                (_slotsBase - (curr + sizeof(unsigned int)))
+                             : 0);          /*   _slotsBase             */
+                EMIT_BYTES("\x48\x01\xD0");  /* add rax, rdx             */
+            }
+            else
+            {
+                EMIT_BYTE(0x16);            /*   rel8: 22               */
+                jmpSource = size;
+
+                /*     rax: jumpTable[B] */
+                EMIT_BYTE(REX | REX_W | REX_X);
+                EMIT_BYTES("\x8B\x44");
+                                      /* mov rax, [rbp + B * 8 + disp8] */
+                EMIT_BYTE(0xC5 | (B << 3)); /* SIB: scale 8, B, rbp     */
+                EMIT_BYTE(0x00);            /* disp8: 0                 */
+
+                /*
+                 *     Platters that are not compiled yet will be compiled 
+                 *     from the new value.  Compile stub itself should not be 
+                 *     touched.
+                 *
+                 *     if (rax != <compile stub>)
+                 */
+                EMIT_BYTES("\x48\x3B\x45\xF0"
+                                        /* cmp rax, [rbp + disp8(-16)]  */
+                           "\x74\x09");     /* je rel8: 9               */
+            }
+
+            /*
+             *     *rax = asm {
+             *                  call [rbp - 8]
+             *            }
+             *
+             * FF 55 F8          call [rbp + disp8(-8)]
+             */
+            EMIT_BYTES("\x66\xC7\x00\xFF\x55"
+                                       /* mov word [rax], imm16 (0x55FF) */
+                       "\xC6\x40\x02\xF8"
+                                   /* mov byte [rax + disp8(2)], imm8 (F8) */
+
+            /*     jmp rel8 (0) */
+                       "\xEB\x00");
+
+            /* } */
+            BOOST_ASSERT(jmpSource + 22 == size
+                         || (_compilation == compilation::strided
+                             && jmpSource + 28 == size));
+
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::allocation:
+
+            static_assert(nativeCodeReturnValue::allocation == 2,
+                          "allocation value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            {
+                /*
+                 * Fast path.  Takes a chunk from the memory manager free list 
+                 * and an index from context::_nativeState.freeIndices.  Returns 
+                 * into run() if either is empty or the array is too large.
+                 *
+                 * Chunk list index is ceil(log2(chunk bytes)) - 
+                 * minChunkSizeShift, where chunk bytes are the chunk header, 
+                 * the array header and C platters.
+                 */
+                const size_t headerSize = memoryManager::chunkHeaderSize
+                                          + ::array::_plattersOffset;
+                const size_t maxPlatters =
+                    ((static_cast<size_t>(1)
+                      << (memoryManager::minChunkSizeShift
+                          + nativeAllocationMaxChunkIndex))
+                     - headerSize) / sizeof(platter);
+
+                BOOST_ASSERT(headerSize
+                             > (static_cast<size_t>(1)
+                                << (memoryManager::minChunkSizeShift - 1)));
+                BOOST_ASSERT(offsetof(::array, _nativeCode) < 128
+                             && offsetof(::array, _backEdgeCount) < 128
+                             && ::array::_plattersOffset < 128);
+
+                /* if (C > maxPlatters) goto slow */
+                EMIT_BYTE(REX | REX_B);
+                EMIT_BYTE(0x81);            /* cmp C, imm32             */
+                EMIT_BYTE(MODRM_RR(7, C));
+                EMIT_WORD(static_cast<unsigned int>(maxPlatters));
+                EMIT_SLOW_JUMP(0x77);       /* ja rel8                  */
+
+                /* if (freeIndexCount == 0) goto slow */
+                EMIT_BYTES("\x48\x8B\x86"); /* mov rax, [rsi + disp32]  */
+                EMIT_STATE_DISP(freeIndexCount);
+                EMIT_BYTES("\x48\x85\xC0"); /* test rax, rax            */
+                EMIT_SLOW_JUMP(0x74);       /* jz rel8                  */
+
+                /* ecx: chunk list index */
+                EMIT_BYTE(REX | REX_X);
+                EMIT_BYTES("\x8D\x0C");     /* lea ecx,                 */
+                EMIT_BYTE(0x85 | (C << 3)); /*   [C * 4 + disp32]       */
+                EMIT_WORD(static_cast<unsigned int>(headerSize - 1));
+                EMIT_BYTES("\x0F\xBD\xC9"   /* bsr ecx, ecx             */
+                           "\x83\xE9");     /* sub ecx, imm8            */
+                EMIT_BYTE(memoryManager::minChunkSizeShift - 1);
+
+                /* rbx: free chunk, if (rbx == 0) goto slow */
+                EMIT_BYTES("\x48\x8B\x96"); /* mov rdx, [rsi + disp32]  */
+                EMIT_STATE_DISP(freeLists);
+                EMIT_BYTES("\x48\x8B\x1C\xCA" /* mov rbx, [rdx + rcx * 8] */
+                           "\x48\x85\xDB"); /* test rbx, rbx            */
+                EMIT_SLOW_JUMP(0x74);       /* jz rel8                  */
+
+                /* Unlink the chunk and store the list index in its header. */
+                EMIT_BYTES("\x48\x8B\x03"   /* mov rax, [rbx]           */
+                           "\x48\x89\x04\xCA" /* mov [rdx + rcx * 8], rax */
+                           "\x48\x89\x0B"); /* mov [rbx], rcx           */
+
+                /* rdx: array */
+                EMIT_BYTES("\x48\x8D\x53"); /* lea rdx, [rbx + disp8]   */
+                EMIT_BYTE(memoryManager::chunkHeaderSize);
+
+                /*
+                 * _size: C, _flags: 0, _nativeCode: nullptr, 
+                 * _entryCount: 0, _backEdgeCount: 0
+                 */
+                EMIT_BYTE(REX | REX_R);
+                EMIT_BYTE(0x89);            /* mov ecx, C               */
+                EMIT_BYTE(MODRM_RR(C, 1));
+                EMIT_BYTES("\x48\x89\x4A"); /* mov [rdx + disp8], rcx   */
+                EMIT_BYTE(offsetof(::array, _size));
+                EMIT_BYTES("\x31\xC0"       /* xor eax, eax             */
+                           "\x48\x89\x42"); /* mov [rdx + disp8], rax   */
+                EMIT_BYTE(offsetof(::array, _flags));
+                EMIT_BYTES("\x48\x89\x42"); /* mov [rdx + disp8], rax   */
+                EMIT_BYTE(offsetof(::array, _nativeCode));
+                EMIT_BYTES("\x48\x89\x42"); /* mov [rdx + disp8], rax   */
+                EMIT_BYTE(offsetof(::array, _entryCount));
+                EMIT_BYTES("\x48\x89\x42"); /* mov [rdx + disp8], rax   */
+                EMIT_BYTE(offsetof(::array, _backEdgeCount));
+
+                /* Zero out C platters. */
+                EMIT_BYTES("\x57"           /* push rdi                 */
+                           "\x48\x8D\x7A"); /* lea rdi, [rdx + disp8]   */
+                EMIT_BYTE(::array::_plattersOffset);
+                EMIT_BYTES("\xF3\xAB"       /* rep stosd                */
+                           "\x5F");         /* pop rdi                  */
+
+                /* eax: freeIndices[--freeIndexCount] */
+                EMIT_BYTES("\x48\x8B\x86"); /* mov rax, [rsi + disp32]  */
+                EMIT_STATE_DISP(freeIndexCount);
+                EMIT_BYTES("\x48\xFF\xC8"   /* dec rax                  */
+                           "\x48\x89\x86"); /* mov [rsi + disp32], rax  */
+                EMIT_STATE_DISP(freeIndexCount);
+                EMIT_BYTES("\x48\x8B\x8E"); /* mov rcx, [rsi + disp32]  */
+                EMIT_STATE_DISP(freeIndices);
+                EMIT_BYTES("\x8B\x04\x81"   /* mov eax, [rcx + rax * 4] */
+
+                /* arrays[eax]: rdx */
+                           "\x48\x89\x14\xC7"); /* mov [rdi + rax * 8], rdx */
+
+                EMIT_BYTES("\xEB\x0F");     /* jmp rel8: 15             */
+                jmpSource = size;
+
+                PATCH_SLOW_JUMPS;
+            }
+
+            /* eax: nativeCodeReturnValue::allocation */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x02");         /* mov al, imm8             */
+                             /* imm8: nativeCodeReturnValue::allocation */
+            /* ebx: C */
+            EMIT_BYTE(REX | REX_R);
+            EMIT_BYTE(0x89);                /* mov ebx, C               */
+            EMIT_BYTE(MODRM_RR(C, 3));
+
+            /* return */
+            EMIT_RETURN;
+
+            BOOST_ASSERT(jmpSource + 15 == size);
+
+            /* B: eax (new array index) */
+            EMIT_BYTE(REX | REX_B);
+            EMIT_BYTE(0x89);                /* mov B, eax               */
+            EMIT_BYTE(MODRM_RR(0, B));
+
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::abandonment:
+
+            static_assert(nativeCodeReturnValue::abandonment == 3,
+                          "abandonment value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            {
+                /*
+                 * Fast path.  Puts the array chunk back into the memory 
+                 * manager free list and the index into 
+                 * context::_nativeState.freeIndices.  Anything unusual, like 
+                 * an invalid index, an array that has native code or is the 
+                 * array 0 source, is handled by run().
+                 */
+
+                /* eax: C, if (eax == 0) goto slow */
+                EMIT_BYTE(REX | REX_R);
+                EMIT_BYTE(0x89);            /* mov eax, C               */
+                EMIT_BYTE(MODRM_RR(C, 0));
+                EMIT_BYTES("\x85\xC0");     /* test eax, eax            */
+                EMIT_SLOW_JUMP(0x74);       /* jz rel8                  */
+
+                /* if (rax >= arrayCount) goto slow */
+                EMIT_BYTES("\x48\x3B\x86"); /* cmp rax, [rsi + disp32]  */
+                EMIT_STATE_DISP(arrayCount);
+                EMIT_SLOW_JUMP(0x73);       /* jae rel8                 */
+
+                /* if (rax == array0Source) goto slow */
+                EMIT_BYTES("\x48\x3B\x86"); /* cmp rax, [rsi + disp32]  */
+                EMIT_STATE_DISP(array0Source);
+                EMIT_SLOW_JUMP(0x74);       /* je rel8                  */
+
+                /* rdx: arrays[rax], if (rdx == 0) goto slow */
+                EMIT_BYTES("\x48\x8B\x14\xC7" /* mov rdx, [rdi + rax * 8] */
+                           "\x48\x85\xD2"); /* test rdx, rdx            */
+                EMIT_SLOW_JUMP(0x74);       /* jz rel8                  */
+
+                /* if (rdx->_nativeCode) goto slow */
+                EMIT_BYTES("\x48\x83\x7A"); /* cmp qword [rdx + disp8], */
+                EMIT_BYTE(offsetof(::array, _nativeCode));
+                EMIT_BYTE(0x00);            /*   imm8(0)                */
+                EMIT_SLOW_JUMP(0x75);       /* jnz rel8                 */
+
+                /*
+                 * rcx: chunk list index, 
+                 * if (rcx > nativeAllocationMaxChunkIndex) goto slow
+                 */
+                EMIT_BYTES("\x48\x8B\x4A"); /* mov rcx, [rdx + disp8]   */
+                EMIT_BYTE(static_cast<unsigned char>(
+                            -static_cast<int>(memoryManager::chunkHeaderSize)));
+                EMIT_BYTES("\x48\x83\xF9"); /* cmp rcx, imm8            */
+                EMIT_BYTE(nativeAllocationMaxChunkIndex);
+                EMIT_SLOW_JUMP(0x77);       /* ja rel8                  */
+
+                /* arrays[rax]: 0 */
+                EMIT_BYTES("\x48\xC7\x04\xC7" /* mov qword [rdi + rax * 8], */
+                           "\x00\x00\x00\x00" /*   imm32(0)               */
+
+                /* Link the chunk into the free list. */
+                           "\x48\x8D\x5A"); /* lea rbx, [rdx + disp8]   */
+                EMIT_BYTE(static_cast<unsigned char>(
+                            -static_cast<int>(memoryManager::chunkHeaderSize)));
+                EMIT_BYTES("\x48\x8B\x96"); /* mov rdx, [rsi + disp32]  */
+                EMIT_STATE_DISP(freeLists);
+                EMIT_BYTES("\x50"           /* push rax                 */
+                           "\x48\x8B\x04\xCA" /* mov rax, [rdx + rcx * 8] */
+                           "\x48\x89\x03"   /* mov [rbx], rax           */
+                           "\x48\x89\x1C\xCA" /* mov [rdx + rcx * 8], rbx */
+                           "\x58");         /* pop rax                  */
+
+                /* freeIndices[freeIndexCount++]: eax */
+                EMIT_BYTES("\x48\x8B\x8E"); /* mov rcx, [rsi + disp32]  */
+                EMIT_STATE_DISP(freeIndexCount);
+                EMIT_BYTES("\x48\x8B\x96"); /* mov rdx, [rsi + disp32]  */
+                EMIT_STATE_DISP(freeIndices);
+                EMIT_BYTES("\x89\x04\x8A"   /* mov [rdx + rcx * 4], eax */
+                           "\x48\xFF\xC1"   /* inc rcx                  */
+                           "\x48\x89\x8E"); /* mov [rsi + disp32], rcx  */
+                EMIT_STATE_DISP(freeIndexCount);
+
+                EMIT_BYTES("\xEB\x0F");     /* jmp rel8: 15             */
+                jmpSource = size;
+
+                PATCH_SLOW_JUMPS;
+            }
+
+            /* eax: nativeCodeReturnValue::abandonment */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x03");         /* mov al, imm8             */
+                            /* imm8: nativeCodeReturnValue::abandonment */
+            /* ebx: C */
+            EMIT_BYTE(REX | REX_R);
+            EMIT_BYTE(0x89);                /* mov ebx, C               */
+            EMIT_BYTE(MODRM_RR(C, 3));
+
+            /* return */
+            EMIT_RETURN;
+
+            BOOST_ASSERT(jmpSource + 15 == size);
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::output:
+
+            static_assert(nativeCodeReturnValue::output == 4,
+                          "output value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            /*
+             * Fast path.  Appends the character to the output buffer, unless 
+             * it is full or the character is a new line.  New lines return 
+             * into run(), so that it can write the buffer when it is due.
+             *
+             * if (outputNext < outputEnd && C != '\n') {
+             */
+            EMIT_BYTES("\x48\x8B\x86");     /* mov rax, [rsi + disp32]  */
+            EMIT_STATE_DISP(outputNext);
+            EMIT_BYTES("\x48\x3B\x86");     /* cmp rax, [rsi + disp32]  */
+            EMIT_STATE_DISP(outputEnd);
+            EMIT_BYTES("\x73\x15");         /* jae rel8: 21             */
+            jmpSource = size;
+
+            EMIT_BYTE(REX | REX_B);
+            EMIT_BYTE(0x80);                /* cmp C (byte), imm8       */
+            EMIT_BYTE(MODRM_RR(7, C));
+            EMIT_BYTE('\n');                /* imm8: '\n'               */
+            EMIT_BYTES("\x74\x0F");         /* je rel8: 15              */
+
+            /*     *outputNext++ = C */
+            EMIT_BYTE(REX | REX_R);
+            EMIT_BYTE(0x88);                /* mov [rax], C (byte)      */
+            EMIT_BYTE((C << 3) | 0x00);
+            EMIT_BYTES("\x48\xFF\xC0"       /* inc rax                  */
+                       "\x48\x89\x86");     /* mov [rsi + disp32], rax  */
+            EMIT_STATE_DISP(outputNext);
+            EMIT_BYTES("\xEB\x0F");         /* jmp rel8: 15             */
+            /* } */
+
+            BOOST_ASSERT(jmpSource + 21 == size);
+            jmpSource = size;
+
+            /* eax: nativeCodeReturnValue::output */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x04");         /* mov al, imm8             */
+                                 /* imm8: nativeCodeReturnValue::output */
+            /* ebx: C */
+            EMIT_BYTE(REX | REX_R);
+            EMIT_BYTE(0x89);                /* mov ebx, C               */
+            EMIT_BYTE(MODRM_RR(C, 3));
+
+            /* return */
+            EMIT_RETURN;
+
+            BOOST_ASSERT(jmpSource + 15 == size);
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::input:
+
+            static_assert(nativeCodeReturnValue::input == 5,
+                          "input value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            /*
+             * Fast path.  Takes the next character from the input buffer, 
+             * unless it is empty.
+             *
+             * if (inputNext < inputEnd) {
+             */
+            EMIT_BYTES("\x48\x8B\x86");     /* mov rax, [rsi + disp32]  */
+            EMIT_STATE_DISP(inputNext);
+            EMIT_BYTES("\x48\x3B\x86");     /* cmp rax, [rsi + disp32]  */
+            EMIT_STATE_DISP(inputEnd);
+            EMIT_BYTES("\x73\x10");         /* jae rel8: 16             */
+            jmpSource = size;
+
+            /*     C = *inputNext++ */
+            EMIT_BYTE(REX | REX_R);
+            EMIT_BYTES("\x0F\xB6");         /* movzx C, byte [rax]      */
+            EMIT_BYTE((C << 3) | 0x00);
+            EMIT_BYTES("\x48\xFF\xC0"       /* inc rax                  */
+                       "\x48\x89\x86");     /* mov [rsi + disp32], rax  */
+            EMIT_STATE_DISP(inputNext);
+            EMIT_BYTES("\xEB\x0F");         /* jmp rel8: 15             */
+            /* } */
+
+            BOOST_ASSERT(jmpSource + 16 == size);
+            jmpSource = size;
+
+            /* eax: nativeCodeReturnValue::input */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x05");         /* mov al, imm8             */
+                                  /* imm8: nativeCodeReturnValue::input */
+            /* return */
+            EMIT_RETURN;
+
+            /* C = <input char> */
+            EMIT_BYTE(REX | REX_B);
+            EMIT_BYTE(0x89);                /* mov C, eax               */
+            EMIT_BYTE(MODRM_RR(0, C));
+
+            BOOST_ASSERT(jmpSource + 15 == size);
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::loadProgram:
+
+            static_assert(nativeCodeReturnValue::loadProgram == 6,
+                          "loadProgram value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            /* ecx: C */
+            EMIT_BYTE(REX | REX_R);
+            EMIT_BYTE(0x89);                /* mov ecx, C               */
+            EMIT_BYTE(MODRM_RR(C, 1));
+
+            /* if (B == 0) { */
+            EMIT_BYTE(REX | REX_R | REX_B);
+            EMIT_BYTE(0x85);                /* test B, B                */
+            EMIT_BYTE(MODRM_RR(B, B));
+
+            if (_compilation == compilation::strided)
+            {
+                EMIT_BYTE(0x75);            /* jnz rel8                 */
+                EMIT_BYTE(jump ? 16 + directJumpSize : 16);
+                jmpSource = size;
+
+                EMIT_DIRECT_JUMP;
+
+                /*     rax: <slot C> */
+                EMIT_BYTES("\x48\x8D\x05");  /* lea rax, [rip + disp32]  */
+                EMIT_WORD(to ? static_cast<unsigned int>
+                                (_slotsBase - (curr + sizeof(unsigned int)))
+                             : 0);          /*   _slotsBase             */
+                EMIT_BYTES("\x48\xC1\xE1");  /* shl rcx, imm8            */
+                EMIT_BYTE(codeStrideShift); /*   codeStrideShift        */
+                EMIT_BYTES("\x48\x01\xC8");  /* add rax, rcx             */
+                /*     jmp rax */
+                EMIT_BYTES("\xFF\xE0");     /* jmp rax                  */
+                /* } */
+
+                BOOST_ASSERT(jmpSource + 16 + (jump ? directJumpSize : 0)
+                             == size);
+            }
+            else if (_compilation == compilation::traced)
+            {
+                EMIT_BYTES("\x75\x0A");     /* jnz rel8: 10             */
+                jmpSource = size;
+
+                /*
+                 *     rax: traceTable[C]
+                 *
+                 *     Profile stub expects the platter index in ecx.
+                 */
+                EMIT_BYTES("\x48\x8B\x84\xCD");
+                               /* mov rax, [rbp + rcx * 8 + disp32]     */
+                EMIT_WORD(static_cast<unsigned int>(_traceTableOffset));
+                                            /*   <trace table>          */
+                /*     jmp rax */
+                EMIT_BYTES("\xFF\xE0");     /* jmp rax                  */
+                /* } */
+
+                BOOST_ASSERT(jmpSource + 10 == size);
+            }
+            else
+            {
+                EMIT_BYTE(0x75);            /* jnz rel8                 */
+                EMIT_BYTE(jump ? 7 + directJumpSize : 7);
+                jmpSource = size;
+
+                EMIT_DIRECT_JUMP;
+
+                /*
+                 *     rax: jumpTable[C]
+                 *
+                 *     Compile stub expects the platter index in ecx.
+                 */
+                EMIT_BYTES("\x48\x8B\x44\xCD\x00");
+                                 /* mov rax, [rbp + rcx * 8 + disp8(0)] */
+                /*     jmp rax */
+                EMIT_BYTES("\xFF\xE0");     /* jmp rax                  */
+                /* } */
+
+                BOOST_ASSERT(jmpSource + 7 + (jump ? directJumpSize : 0)
+                             == size);
+            }
+
+            /* ebx: B */
+            EMIT_BYTE(REX | REX_R);
+            EMIT_BYTE(0x89);                /* mov ebx, B               */
+            EMIT_BYTE(MODRM_RR(B, 3));
+
+            /* eax: nativeCodeReturnValue::loadProgram */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x06");         /* mov al, imm8             */
+                            /* imm8: nativeCodeReturnValue::loadProgram */
+
+            /* return */
+            EMIT_RETURN;
+
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        default:
+            throw logic_error("Unexpected operator");
+    }
+
+    return size;
+}
+
+size_t context::codeForOutputRun(const outputRun & run,
+                                 const char * continueAt, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    unsigned int assignedCount = 0;
+    for (unsigned int r = 0; r < 8; ++r)
+        if (run.assigned & (1 << r))
+            ++assignedCount;
+
+    /*
+     * Characters are stored right after the code, so all the offsets are 
+     * known in advance.
+     */
+    const size_t headerSize = 13;
+    const size_t codeSize = headerSize + 6 * assignedCount + 29;
+    const size_t totalSize = codeSize + run.bytes.size();
+
+    static_assert(nativeCodeReturnValue::outputString == 8,
+                  "outputString value is encoded below.  If it "
+                  "changes the value below should be updated.");
+
+    /* if (!(array[0]->_flags & dirty)) { */
+    EMIT_BYTES("\x48\x8B\x07");         /* mov rax, [rdi]           */
+    EMIT_BYTES("\xF6\x40");             /* test byte [rax + disp8], imm8 */
+    EMIT_BYTE(static_cast<unsigned char>(offsetof(::array, _flags)));
+                                        /*    [rax + array::_flags] */
+    EMIT_BYTE(static_cast<unsigned char>(::array::flag::dirty));
+                                        /* imm8: array::flag::dirty */
+    BOOST_ASSERT(offsetof(::array, _flags) < 128);
+    EMIT_BYTES("\x0F\x85");             /* jnz rel32                */
+    EMIT_WORD(static_cast<unsigned int>(totalSize - headerSize));
+                                        /*   <run platters code>    */
+    BOOST_ASSERT(size == headerSize);
+
+    /*     A = value, for every register the run assigns */
+    for (unsigned int r = 0; r < 8; ++r)
+    {
+        if (!(run.assigned & (1 << r)))
+            continue;
+
+        EMIT_BYTE(REX | REX_B);
+        EMIT_BYTE(0xB8 | r);            /* mov r, imm32             */
+        EMIT_WORD(run.values[r]);       /*        value             */
+    }
+
+    /*     ebx: characters */
+    EMIT_BYTES("\x48\x8D\x1D");         /* lea rbx, [rip + disp32]  */
+    EMIT_WORD(static_cast<unsigned int>(codeSize - (size + 4)));
+                                        /*   <characters>           */
+    /*     ecx: number of characters */
+    EMIT_BYTE(0xB9);                    /* mov ecx, imm32           */
+    EMIT_WORD(static_cast<unsigned int>(run.bytes.size()));
+
+    /*     eax: nativeCodeReturnValue::outputString */
+    EMIT_BYTES("\x31\xC0"               /* xor eax, eax             */
+               "\xB0\x08");             /* mov al, imm8             */
+                          /* imm8: nativeCodeReturnValue::outputString */
+    /*     return */
+    EMIT_RETURN;
+
+    /*     continue after the run */
+    EMIT_BYTE(0xE9);                    /* jmp rel32                */
+    EMIT_WORD(to ? static_cast<unsigned int>(continueAt - (to + codeSize))
+                 : 0);
+    /* } */
+    BOOST_ASSERT(size == codeSize);
+
+    if (to)
+    {
+        memcpy(curr, run.bytes.data(), run.bytes.size());
+        curr += run.bytes.size();
+    }
+    size += run.bytes.size();
+
+    return size;
+}
+
+size_t context::codeForBitwiseRun(const bitwiseRun & run,
+                                  const char * continueAt, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    /* Host registers that hold x and y while the run is executed. */
+    const unsigned int hostX = 0;       /* eax */
+    const unsigned int hostY = 2;       /* edx */
+
+    const size_t headerSize = 13;
+
+    /* if (!(array[0]->_flags & dirty)) { */
+    EMIT_BYTES("\x48\x8B\x07");         /* mov rax, [rdi]           */
+    EMIT_BYTES("\xF6\x40");             /* test byte [rax + disp8], imm8 */
+    EMIT_BYTE(static_cast<unsigned char>(offsetof(::array, _flags)));
+                                        /*    [rax + array::_flags] */
+    EMIT_BYTE(static_cast<unsigned char>(::array::flag::dirty));
+                                        /* imm8: array::flag::dirty */
+    BOOST_ASSERT(offsetof(::array, _flags) < 128);
+    EMIT_BYTES("\x0F\x85");             /* jnz rel32                */
+    EMIT_WORD(0);                       /*   <run platters code>    */
+                                        /*   patched below          */
+    BOOST_ASSERT(size == headerSize);
+
+    /*     eax: x, edx: y */
+    EMIT_BYTE(REX | REX_R);
+    EMIT_BYTE(0x89);                    /* mov eax, x               */
+    EMIT_BYTE(MODRM_RR(run.x, hostX));
+    EMIT_BYTE(REX | REX_R);
+    EMIT_BYTE(0x89);                    /* mov edx, y               */
+    EMIT_BYTE(MODRM_RR(run.y, hostY));
+
+    /*     r = function(x, y), for every register the run assigns */
+    for (unsigned int r = 0; r < 8; ++r)
+    {
+        if (!(run.assigned & (1 << r)))
+            continue;
+
+        bitwiseRecipe recipe = bitwiseRecipeFor(run.functions[r]);
+        unsigned int other = hostY;
+
+        switch (recipe.source)
+        {
+            case bitwiseRecipe::x:
+                EMIT_BYTE(REX | REX_B);
+                EMIT_BYTE(0x89);        /* mov r, eax               */
+                EMIT_BYTE(MODRM_RR(hostX, r));
+                break;
+
+            case bitwiseRecipe::y:
+                EMIT_BYTE(REX | REX_B);
+                EMIT_BYTE(0x89);        /* mov r, edx               */
+                EMIT_BYTE(MODRM_RR(hostY, r));
+                other = hostX;
+                break;
+
+            case bitwiseRecipe::zero:
+                EMIT_BYTE(REX | REX_R | REX_B);
+                EMIT_BYTE(0x31);        /* xor r, r                 */
+                EMIT_BYTE(MODRM_RR(r, r));
+                break;
+        }
+
+        if (recipe.negateSource)
+        {
+            EMIT_BYTE(REX | REX_B);
+            EMIT_BYTE(0xF7);            /* not r                    */
+            EMIT_BYTE(MODRM_RR(2, r));
+        }
+
+        if (recipe.operation != bitwiseRecipe::none)
+        {
+            EMIT_BYTE(REX | REX_B);
+            switch (recipe.operation)
+            {
+                case bitwiseRecipe::and_:
+                    EMIT_BYTE(0x21);    /* and r, other             */
+                    break;
+                case bitwiseRecipe::or_:
+                    EMIT_BYTE(0x09);    /* or r, other              */
+                    break;
+                default:
+                    EMIT_BYTE(0x31);    /* xor r, other             */
+            }
+            EMIT_BYTE(MODRM_RR(other, r));
+        }
+
+        if (recipe.negateResult)
+        {
+            EMIT_BYTE(REX | REX_B);
+            EMIT_BYTE(0xF7);            /* not r                    */
+            EMIT_BYTE(MODRM_RR(2, r));
+        }
+    }
+
+    /*     continue after the run */
+    EMIT_BYTE(0xE9);                    /* jmp rel32                */
+    EMIT_WORD(to ? static_cast<unsigned int>(continueAt - (to + size + 4))
+                 : 0);
+    /* } */
+
+    if (to)
+        *reinterpret_cast<unsigned int *>(to + headerSize - 4) =
+            static_cast<unsigned int>(size - headerSize);
+
+    return size;
+}
+
+size_t context::codeForTrace(const ::array & a, const trace & t, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    /*
+     * Guards jump to exits that follow the trace code.  Every exit continues 
+     * at the platter code via the jump table.  Exit i ends its guard rel32 
+     * at exitSources[i] and continues at platter exitTargets[i].
+     */
+    vector<size_t> exitSources;
+    vector<size_t> exitTargets;
+
+#define EMIT_TRACE_EXIT(TARGET)                                         \
+    EMIT_WORD(0);                       /*   <exit>                 */  \
+    exitSources.push_back(size);                                        \
+    exitTargets.push_back(TARGET);                                      \
+    /* */
+
+#define EMIT_DIRTY_GUARD(TARGET)                                        \
+    EMIT_BYTES("\x48\x8B\x07");         /* mov rax, [rdi]           */  \
+    EMIT_BYTES("\xF6\x40");             /* test byte [rax + disp8], imm8 */ \
+    EMIT_BYTE(static_cast<unsigned char>(offsetof(::array, _flags)));   \
+                                        /*    [rax + array::_flags] */  \
+    EMIT_BYTE(static_cast<unsigned char>(::array::flag::dirty));        \
+                                        /* imm8: array::flag::dirty */  \
+    BOOST_ASSERT(offsetof(::array, _flags) < 128);                      \
+    EMIT_BYTES("\x0F\x85");             /* jnz rel32                */  \
+    EMIT_TRACE_EXIT(TARGET);                                            \
+    /* */
+
+    /* Array 0 was modified after the trace was recorded. */
+    EMIT_DIRTY_GUARD(t.head);
+
+    size_t loopStart = size;
+
+    for (size_t s = 0; s < t.steps.size(); ++s)
+    {
+        const trace::step & step = t.steps[s];
+        const platter & p = a[step.index];
+
+        unsigned int A = 0, B = 0, C = 0, value = 0;
+        platter::operator_::value op = p.decode(A, B, C, value);
+
+        switch (op)
+        {
+            case platter::operator_::loadProgram:
+                /* if (B != 0 || C != target) exit */
+                EMIT_BYTE(REX | REX_R | REX_B);
+                EMIT_BYTE(0x85);            /* test B, B                */
+                EMIT_BYTE(MODRM_RR(B, B));
+                EMIT_BYTES("\x0F\x85");     /* jnz rel32                */
+                EMIT_TRACE_EXIT(step.index);
+
+                EMIT_BYTE(REX | REX_B);
+                EMIT_BYTE(0x81);            /* cmp C, imm32             */
+                EMIT_BYTE(MODRM_RR(7, C));
+                EMIT_WORD(static_cast<unsigned int>(step.target));
+                EMIT_BYTES("\x0F\x85");     /* jne rel32                */
+                EMIT_TRACE_EXIT(step.index);
+                continue;
+
+            case platter::operator_::division:
+                /* Platter code reports division by zero. */
+                EMIT_BYTE(REX | REX_R | REX_B);
+                EMIT_BYTE(0x85);            /* test C, C                */
+                EMIT_BYTE(MODRM_RR(C, C));
+                EMIT_BYTES("\x0F\x84");     /* jz rel32                 */
+                EMIT_TRACE_EXIT(step.index);
+                break;
+
+            case platter::operator_::arrayIndex:
+            case platter::operator_::arrayAmendment:
+                if (!_boundsChecks)
+                    break;
+
+                {
+                    /* Platter code reports an invalid index. */
+                    unsigned int array =
+                        op == platter::operator_::arrayIndex ? B : A;
+                    unsigned int index =
+                        op == platter::operator_::arrayIndex ? C : B;
+
+                    EMIT_ARRAY_COUNT_CMP(array);
+                    EMIT_BYTES("\x0F\x83"); /* jae rel32                */
+                    EMIT_TRACE_EXIT(step.index);
+
+                    EMIT_ARRAY_LOAD(array);
+                    EMIT_ARRAY_SIZE_CMP(index);
+                    EMIT_BYTES("\x0F\x83"); /* jae rel32                */
+                    EMIT_TRACE_EXIT(step.index);
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        size_t platterSize = codeFor(p, to ? curr : nullptr);
+        size += platterSize;
+        if (to)
+            curr += platterSize;
+
+        /* Amendment may have modified array 0. */
+        if (op == platter::operator_::arrayAmendment)
+        {
+            EMIT_DIRTY_GUARD(step.index + 1);
+        }
+    }
+
+    /* Back at the head. */
+    EMIT_BYTE(0xE9);                    /* jmp rel32                */
+    EMIT_WORD(static_cast<unsigned int>(loopStart - (size + 4)));
+
+    for (size_t i = 0; i < exitSources.size(); ++i)
+    {
+        if (to)
+            *reinterpret_cast<unsigned int *>(to + exitSources[i] - 4) =
+                static_cast<unsigned int>(size - exitSources[i]);
+
+        size_t exitSize = codeForJump(exitTargets[i], to ? curr : nullptr);
+        size += exitSize;
+        if (to)
+            curr += exitSize;
+    }
+
+#undef EMIT_DIRTY_GUARD
+#undef EMIT_TRACE_EXIT
+
+    return size;
+}
+
+size_t context::codeForJump(size_t i, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    /* ecx: i */
+    EMIT_BYTE(0xB9);                /* mov ecx, imm32           */
+    EMIT_WORD(static_cast<unsigned int>(i));
+    /* jmp jumpTable[i] */
+    EMIT_BYTES("\xFF\x64\xCD\x00");
+                        /* jmp [rbp + rcx * 8 + disp8(0)]       */
+
+    return size;
+}
+
+size_t context::codeForBranch(const char * target, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    ptrdiff_t rel = 0;
+    if (to)
+    {
+        rel = target - (to + 5);
+        if (rel != static_cast<int>(rel))
+            return 0;
+    }
+
+    EMIT_BYTE(0xE9);                /* jmp rel32                */
+    EMIT_WORD(static_cast<unsigned int>(rel));
+
+    return size;
+}
+
+void context::codeForPadding(size_t bytes, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    /*
+     * Recommended multi-byte nop sequences.  Short padding is cheaper to 
+     * execute as a single nop than as a jump.
+     */
+    static const char * const nops[] = {
+        "",
+        "\x90",                                /* nop                   */
+        "\x66\x90",                            /* xchg ax, ax           */
+        "\x0F\x1F\x00",                        /* nop [rax]             */
+        "\x0F\x1F\x40\x00",                    /* nop [rax + 0]         */
+        "\x0F\x1F\x44\x00\x00",                /* nop [rax + rax + 0]   */
+        "\x66\x0F\x1F\x44\x00\x00",            /* nop [rax + rax + 0]   */
+        "\x0F\x1F\x80\x00\x00\x00\x00",        /* nop [rax + 0]         */
+        "\x0F\x1F\x84\x00\x00\x00\x00\x00",    /* nop [rax + rax + 0]   */
+    };
+
+    const size_t maxNop = sizeof(nops) / sizeof(nops[0]) - 1;
+
+    /*
+     * A few nops are still cheaper than a taken jump.  Bytes after a jump 
+     * are never executed and are left as they are.
+     */
+    if (bytes <= 3 * maxNop)
+    {
+        while (size < bytes)
+        {
+            size_t nop = std::min(bytes - size, maxNop);
+            memcpy(curr, nops[nop], nop);
+            curr += nop;
+            size += nop;
+        }
+    }
+    else if (bytes - 2 < 128)
+    {
+        EMIT_BYTE(0xEB);            /* jmp rel8                 */
+        EMIT_BYTE(static_cast<unsigned char>(bytes - 2));
+    }
+    else
+    {
+        EMIT_BYTE(0xE9);            /* jmp rel32                */
+        EMIT_WORD(static_cast<unsigned int>(bytes - 5));
+    }
+
+    BOOST_ASSERT(size <= bytes);
+}
+
+size_t context::codeForOOBStub(char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    static_assert(nativeCodeReturnValue::halt == 1,
+                  "halt value is encoded below.  If it changes "
+                  "the value below should be updated.");
+    static_assert(haltReturnCodes::outOfBoundExecution == 2,
+                  "outOfBoundExecution value is encoded below.  If it "
+                  "changes the value below should be update.");
+
+    /* eax: nativeCodeReturnValue::halt */
+    EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+               "\xB0\x01"           /* mov al, imm8             */
+                           /* imm8: nativeCodeReturnValue::halt */
+    /* ebx: 2 - out of bound execution */
+               "\x31\xDB"           /* xor ebx, ebx             */
+               "\xB3\x02");         /* mov bl, imm8             */
+                  /* imm8: haltReturnCodes::outOfBoundExecution */
+    /* return */
+    EMIT_RETURN;
+
+    return size;
+}
+
+size_t context::codeForDataStub(char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    static_assert(jumpTable::commonStub::recompile == 1,
+                  "Common stub slot is encoded in the code below.  If it "
+                  "changes the code below should be updated.");
+
+    EMIT_BYTES("\xFF\x55\xF8");       /* call [rbp + disp8(-8)]   */
+
+    size_t branchSize = codeForBranch(nullptr, nullptr);
+    if (size < branchSize)
+    {
+        if (to)
+            codeForPadding(branchSize - size, curr);
+        size = branchSize;
+    }
+
+    return size;
+}
+
+size_t context::codeForCommonStubs(char * to, class jumpTable * jt)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    /*
+     * Recompile stub calls this code.  On entry the stack holds the address
+     * right after the recompile stub, followed by the entry trampoline return
+     * address.  The former is the address to resume at.  The ret does not
+     * match the call, but recompilation is rare.
+     */
+    if (to)
+        jt->commonStubAddress(jumpTable::commonStub::recompile, curr);
+
+    static_assert(nativeCodeReturnValue::recompile == 7,
+                  "recompile value is encoded below.  If it changes "
+                  "the value below should be updated.");
+
+    /* eax: nativeCodeReturnValue::recompile */
+    EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+               "\xB0\x07"           /* mov al, imm8             */
+                      /* imm8: nativeCodeReturnValue::recompile */
+    /* return */
+               "\x5A"               /* pop rdx                  */
+               "\xC3");             /* ret                      */
+
+    /*
+     * Jump table entries of platters that are not compiled yet point here.  
+     * Everyone who jumps via the jump table puts the platter index into ecx.
+     */
+    if (to)
+        jt->commonStubAddress(jumpTable::commonStub::compile, curr);
+
+    static_assert(nativeCodeReturnValue::compile == 9,
+                  "compile value is encoded below.  If it changes "
+                  "the value below should be updated.");
+
+    /* ebx: platter index */
+    EMIT_BYTES("\x89\xCB"           /* mov ebx, ecx             */
+    /* eax: nativeCodeReturnValue::compile */
+               "\x31\xC0"           /* xor eax, eax             */
+               "\xB0\x09");         /* mov al, imm8             */
+                        /* imm8: nativeCodeReturnValue::compile */
+    /* return */
+    EMIT_RETURN;
+
+    /*
+     * Trace table entries of platters that are not traced yet point here.  
+     * Everyone who jumps via the trace table puts the platter index into 
+     * ecx.
+     */
+    if (to)
+        jt->commonStubAddress(jumpTable::commonStub::profile, curr);
+
+    static_assert(nativeCodeReturnValue::trace == 10,
+                  "trace value is encoded below.  If it changes "
+                  "the value below should be updated.");
+
+    /* if (--traceCounters[ecx] != 0) */
+    EMIT_BYTES("\x48\x8B\x86");     /* mov rax, [rsi + disp32]  */
+    EMIT_STATE_DISP(traceCounters);
+    EMIT_BYTES("\xFF\x0C\x88"       /* dec dword [rax + rcx * 4] */
+               "\x74\x04"           /* jz rel8: 4               */
+    /*     jmp jumpTable[ecx] */
+               "\xFF\x64\xCD\x00"   /* jmp [rbp + rcx * 8 + disp8(0)] */
+    /* ebx: platter index */
+               "\x89\xCB"           /* mov ebx, ecx             */
+    /* eax: nativeCodeReturnValue::trace */
+               "\x31\xC0"           /* xor eax, eax             */
+               "\xB0\x0A");         /* mov al, imm8             */
+                          /* imm8: nativeCodeReturnValue::trace */
+    /* return */
+    EMIT_RETURN;
+
+    return size;
+}
+
+/*
+ * --- Fault handling ---
+ *
+ * In the context::writeProtection(...) mode arrayAmendment code is just
+ *
+ *     mov rax, [rdi + A * 8]
+ *     mov [rax + B * 4 + disp8], C
+ *
+ * and the store faults if it writes into a write protected array.  The 
+ * handler finishes the amendment the way the full arrayAmendment code would 
+ * and continues the native code.  In the context::boundsChecks(...) mode the 
+ * load is a part of EMIT_BOUNDS_CHECK instead.
+ *
+ * In the context::boundsChecks(...) mode abandoned arrays are not checked 
+ * for.  Their pointers are null, so EMIT_ARRAY_SIZE_CMP faults and the 
+ * handler makes the check fail.
+ *
+ * Division does not check the divisor either.  div raises SIGFPE and the 
+ * division handler halts the machine the same way the interpreter does.
+ */
+
+struct context::faultHandler
+{
+    /* Context that runs native code at the moment. */
+    static context * active;
+
+    /* Handlers that were installed before, for faults that are not ours. */
+    static struct sigaction previous;
+    static struct sigaction previousDivision;
+
+    /* SIGSEGV */
+    static void handle(int signal, siginfo_t * info, void * ucontext);
+
+    /* SIGFPE */
+    static void handleDivision(int signal, siginfo_t * info, void * ucontext);
+
+    /*
+     * Whether `rip' is in native code of array 0 of the active context.  
+     * Faults anywhere else are not ours, even if the instruction looks the 
+     * same.
+     */
+    static bool inNativeCode(const void * rip);
+
+    /* Length of the array pointer load that precedes the store. */
+    static const size_t loadSize = 4;
+
+    /* Length of the store. */
+    static const size_t storeSize = 5;
+
+    /* Length of EMIT_ARRAY_SIZE_CMP. */
+    static const size_t sizeCmpSize = 4;
+};
+
+context * context::faultHandler::active = nullptr;
+struct sigaction context::faultHandler::previous;
+struct sigaction context::faultHandler::previousDivision;
+
+bool context::faultHandler::inNativeCode(const void * rip)
+{
+    if (!active)
+        return false;
+
+    const ::nativeCode * code = active->_arrays[0]->nativeCode();
+
+    return code && code->contains(rip);
+}
+
+void context::faultHandler::handle(int /* signal */, siginfo_t * info,
+                                   void * ucontext)
+{
+    greg_t * gregs = static_cast<ucontext_t *>(ucontext)->uc_mcontext.gregs;
+    const unsigned char * rip =
+        reinterpret_cast<const unsigned char *>(gregs[REG_RIP]);
+    char * address = static_cast<char *>(info->si_addr);
+
+    if (!inNativeCode(rip))
+    {
+        /* The instruction faults again, now with the usual outcome. */
+        sigaction(SIGSEGV, &previous, nullptr);
+        return;
+    }
+
+    context * ctx = active;
+
+    /*
+     * cmp INDEX, [rax + array::_size] with a null rax.  The check continues 
+     * as if INDEX was not below the size, that is with the carry flag clear.
+     */
+    if (ctx->_boundsChecks
+        && reinterpret_cast<size_t>(address) < memoryManager::pageSize()
+        && rip[0] == (REX | REX_R) && rip[1] == 0x3B
+        && (rip[2] & 0xC7) == 0x40 && rip[3] == offsetof(::array, _size))
+    {
+        gregs[REG_EFL] &= ~static_cast<greg_t>(0x1);    /* CF */
+        gregs[REG_RIP] += sizeCmpSize;
+        return;
+    }
+
+    ::array * a = nullptr;
+
+    for (size_t i = 0; i < ctx->_protectedArrays.size(); ++i)
+    {
+        ::array * p = ctx->_protectedArrays[i];
+        char * first = reinterpret_cast<char *>(p->platters());
+
+        if (address >= first
+            && address < first + p->size() * sizeof(platter))
+            a = p;
+    }
+
+    /* mov [rax + B * 4 + disp8], C */
+    if (!a
+        || rip[0] != (REX | REX_R | REX_X) || rip[1] != 0x89
+        || (rip[2] & 0xC7) != 0x44 || (rip[3] & 0xC7) != 0x80
+        || rip[4] != ::array::_plattersOffset)
+    {
+        /* The instruction faults again, now with the usual outcome. */
+        sigaction(SIGSEGV, &previous, nullptr);
+        return;
+    }
+
+    size_t i = (address - reinterpret_cast<char *>(a->platters()))
+               / sizeof(platter);
+
+    if (a != ctx->_arrays[0])
+    {
+        /*
+         * Array 0 left its native code with `a'.  It is only checked once 
+         * `a' is loaded again, so the first amendment is the only one that 
+         * matters.
+         */
+        mprotect(a->platters(), protectedSize(*a),
+                 PROT_READ | PROT_WRITE | PROT_EXEC);
+
+        a->dirty(true);
+        a->writeProtected(false);
+
+        vector< ::array *> & arrays = ctx->_protectedArrays;
+        arrays.erase(std::find(arrays.begin(), arrays.end(), a));
+
+        /* The store is executed again. */
+        return;
+    }
+
+    static_assert(nativeCodeReturnValue::unshare == 11,
+                  "unshare value is set below.  If it changes the value "
+                  "below should be updated.");
+
+    if (a->shared())
+    {
+        /*
+         * Same as EMIT_RETURN of unshare with the array pointer load, or the 
+         * bounds check that does it, as the address to resume at.  It reads 
+         * the copy once run() made it.
+         */
+        greg_t * rsp = reinterpret_cast<greg_t *>(gregs[REG_RSP]);
+
+        gregs[REG_RDX] = gregs[REG_RIP] - (ctx->_boundsChecks
+                                           ? boundsCheckSize : loadSize);
+
+        gregs[REG_RAX] = nativeCodeReturnValue::unshare;
+        gregs[REG_RIP] = *rsp;
+        gregs[REG_RSP] += sizeof(greg_t);
+        return;
+    }
+
+    /* Array 0 stays write protected, the store is done here. */
+    size_t pageSize = memoryManager::pageSize();
+    char * page = address - reinterpret_cast<size_t>(address) % pageSize;
+
+    mprotect(page, pageSize, PROT_READ | PROT_WRITE | PROT_EXEC);
+    *reinterpret_cast<unsigned int *>(address) =
+        static_cast<unsigned int>(gregs[REG_R8 + ((rip[2] >> 3) & 0x7)]);
+    mprotect(page, pageSize, PROT_READ | PROT_EXEC);
+
+    a->dirty(true);
+
+    /*
+     * Platters that are not compiled yet will be compiled from the new 
+     * value.  Compile stub itself should not be touched.
+     */
+    char * code = static_cast<char *>(ctx->platterAddress(*a, i));
+
+    if (ctx->_compilation == compilation::strided
+        || code != a->jumpTable()->commonStubAddress(
+                        jumpTable::commonStub::compile))
+    {
+        /* call [rbp + disp8(-8)] */
+        code[0] = '\xFF';
+        code[1] = '\x55';
+        code[2] = '\xF8';
+    }
+
+    gregs[REG_RIP] += storeSize;
+}
+
+void context::faultHandler::handleDivision(int /* signal */, siginfo_t * info,
+                                           void * ucontext)
+{
+    greg_t * gregs = static_cast<ucontext_t *>(ucontext)->uc_mcontext.gregs;
+    const unsigned char * rip =
+        reinterpret_cast<const unsigned char *>(gregs[REG_RIP]);
+
+    /* div C */
+    if (!inNativeCode(rip) || info->si_code != FPE_INTDIV
+        || rip[0] != (REX | REX_B) || rip[1] != 0xF7
+        || (rip[2] & 0xF8) != MODRM_RR(6, 0))
+    {
+        /* The instruction faults again, now with the usual outcome. */
+        sigaction(SIGFPE, &previousDivision, nullptr);
+        return;
+    }
+
+    static_assert(nativeCodeReturnValue::halt == 1
+                  && haltReturnCodes::divisionByZero == 3,
+                  "halt values are set below.  If they change the values "
+                  "below should be updated.");
+
+    /*
+     * Same as EMIT_RETURN of halt with divisionByZero in ebx and the 
+     * division as the address to resume at, so that run() can tell the 
+     * platter.
+     */
+    greg_t * rsp = reinterpret_cast<greg_t *>(gregs[REG_RSP]);
+
+    gregs[REG_RDX] = gregs[REG_RIP];
+
+    gregs[REG_RAX] = nativeCodeReturnValue::halt;
+    gregs[REG_RBX] = haltReturnCodes::divisionByZero;
+    gregs[REG_RIP] = *rsp;
+    gregs[REG_RSP] += sizeof(greg_t);
+}
+
+void context::handleFaults(bool enable)
+{
+    if (!enable)
+    {
+        BOOST_ASSERT(faultHandler::active == this);
+
+        sigaction(SIGSEGV, &faultHandler::previous, nullptr);
+        sigaction(SIGFPE, &faultHandler::previousDivision, nullptr);
+        faultHandler::active = nullptr;
+        return;
+    }
+
+    /* Only one context may run native code at a time. */
+    BOOST_ASSERT(!faultHandler::active);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+
+    action.sa_sigaction = &faultHandler::handle;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGSEGV, &action, &faultHandler::previous) != 0)
+        throw exceptions::systemError(L"sigaction() failed",
+                                      exceptions::systemError::getLast);
+
+    action.sa_sigaction = &faultHandler::handleDivision;
+
+    if (sigaction(SIGFPE, &action, &faultHandler::previousDivision) != 0)
+    {
+        sigaction(SIGSEGV, &faultHandler::previous, nullptr);
+        throw exceptions::systemError(L"sigaction() failed",
+                                      exceptions::systemError::getLast);
+    }
+
+    faultHandler::active = this;
+}
+
+#undef REX
+#undef REX_W
+#undef REX_R
+#undef REX_X
+#undef REX_B
+#undef MODRM_RR
+
+#endif /* __x86_64__ */
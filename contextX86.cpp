@@ -0,0 +1,1122 @@
+#include "context.h"
+
+#include "jumpTable.h"
+#include "nativeCode.h"
+#include "nativeCodeProtocol.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/assert.hpp>
+
+
+/*
+ * Native code generator for the 32-bit x86 Win32 build.
+ */
+#if defined(_M_IX86)
+
+#include "windows.h"
+#include "exceptions/systemError.h"
+
+using namespace std;
+
+
+/*
+ * --- Stencils ---
+ *
+ * Code for operators that do not depend on anything but the registers they 
+ * use, see stencil in nativeCodeProtocol.h.  All of them take A, B and C as 
+ * the operands, in this order.
+ */
+#define DISP(OFFSET, OPERAND)                                           \
+    { stencil::hole::registerDisp, OFFSET, OPERAND }
+
+namespace
+{
+    constexpr stencil stencils[] = {
+        /* conditionalMove */
+        {
+            STENCIL_CODE("\x8B\x4E\x00"     /* mov ecx, [esi + C]       */
+                         "\xE3\x06"         /* jcxz rel8 (6)            */
+                         "\x8B\x46\x00"     /* mov eax, [esi + B]       */
+                         "\x89\x46\x00"),   /* mov [esi + A], eax       */
+            { DISP(2, 2), DISP(7, 1), DISP(10, 0) }
+        },
+        /* arrayIndex */
+        {
+            STENCIL_CODE("\x8B\x5E\x00"     /* mov ebx, [esi + B]       */
+                         "\x8B\x04\x9F"     /* mov eax, [edi + ebx * 4] */
+                         "\x8B\x4E\x00"     /* mov ecx, [esi + C]       */
+                         "\x8B\x44\x88\x00"
+                          /* mov eax, [eax + ecx * 4 + <first platter>] */
+                         "\x89\x46\x00"),   /* mov [esi + A], eax       */
+            { DISP(2, 1), DISP(8, 2),
+              { stencil::hole::plattersOffset, 12, 0 }, DISP(15, 0) }
+        },
+        /* arrayAmendment */
+        { },
+        /* addition */
+        {
+            STENCIL_CODE("\x8B\x46\x00"     /* mov eax, [esi + B]       */
+                         "\x03\x46\x00"     /* add eax, [esi + C]       */
+                         "\x89\x46\x00"),   /* mov [esi + A], eax       */
+            { DISP(2, 1), DISP(5, 2), DISP(8, 0) }
+        },
+        /* multiplication */
+        {
+            STENCIL_CODE("\x8B\x46\x00"     /* mov eax, [esi + B]       */
+                         "\xF7\x66\x00"     /* mul edx:eax, [esi + C]   */
+                         "\x89\x46\x00"),   /* mov [esi + A], eax       */
+            { DISP(2, 1), DISP(5, 2), DISP(8, 0) }
+        },
+        /* division */
+        {
+            STENCIL_CODE("\x8B\x46\x00"     /* mov eax, [esi + B]       */
+                         "\x31\xD2"         /* xor edx, edx             */
+                         "\xF7\x76\x00"     /* div edx:eax, [esi + C]   */
+                         "\x89\x46\x00"),   /* mov [esi + A], eax       */
+            { DISP(2, 1), DISP(7, 2), DISP(10, 0) }
+        },
+        /* notAnd */
+        {
+            STENCIL_CODE("\x8B\x46\x00"     /* mov eax, [esi + B]       */
+                         "\x23\x46\x00"     /* and eax, [esi + C]       */
+                         "\xF7\xD0"         /* not eax                  */
+                         "\x89\x46\x00"),   /* mov [esi + A], eax       */
+            { DISP(2, 1), DISP(5, 2), DISP(10, 0) }
+        },
+        /* halt */
+        {
+            /* eax: nativeCodeReturnValue::halt, ebx: normalTermination */
+            STENCIL_CODE("\x31\xC0"         /* xor eax, eax             */
+                         "\xB0\x01"         /* mov al, imm8             */
+                         "\x31\xDB"         /* xor ebx, ebx             */
+                         "\x5A"             /* pop edx                  */
+                         "\xFF\xD2"),       /* call edx                 */
+            { }
+        },
+    };
+
+    /* Operators after halt have no stencils, except for orthography. */
+    constexpr stencil orthographyStencil = {
+        STENCIL_CODE("\xC7\x46\x00"         /* mov [esi + A], imm32     */
+                     "\x00\x00\x00\x00"),   /*                    value */
+        { DISP(2, 0), { stencil::hole::imm32, 3, 0 } }
+    };
+
+    constexpr preparedStencils<platter::operator_::halt + 1> prepared =
+        prepareStencils(stencils);
+
+    constexpr preparedStencil preparedOrthography =
+        prepareStencil(orthographyStencil);
+
+    /*
+     * Returns the stencil for an operator, or nullptr if the operator code 
+     * depends on more than its registers.
+     */
+    const preparedStencil * stencilFor(platter::operator_::value op)
+    {
+        static_assert(nativeCodeReturnValue::halt == 1
+                      && haltReturnCodes::normalTermination == 0,
+                      "halt stencil encodes these values.  If they change "
+                      "the stencil should be updated.");
+
+        if (op == platter::operator_::orthography)
+            return &preparedOrthography;
+
+        if (op > platter::operator_::halt
+            || op == platter::operator_::arrayAmendment)
+            return nullptr;
+
+        return &prepared.at[op];
+    }
+}
+
+#undef DISP
+
+size_t context::codeFor(const platter & p, char * to, directJump * jump)
+{
+    /*
+     * Native code assumes:
+     *
+     * ESI - pointer to the registers array [8 32-bit values]
+     * EDI - pointer to the collection of array pointers
+     * EBP - jump table first entry address
+     */
+
+    unsigned int A = 0, B = 0, C = 0, value = 0;
+
+    size_t size = 0;
+    char * curr = to;
+
+    size_t jmpSource = 0;
+
+    /*
+     * Any instruction should be compiled into at least this many bytes so that 
+     * it can always be overwritten by a recompile stub in case the code in the 
+     * array 0 will decide to modify itself.
+     */
+    const size_t recompileStubSize = 7;
+
+    /*
+     * Data platters are often not valid operators.  They are checked before 
+     * decoding, as throwing invalidOperatorFormat for every one of them takes 
+     * longer than compiling a valid platter.
+     */
+    if (static_cast<unsigned int>(p) >> 28 > platter::operator_::orthography)
+    {
+        static_assert(nativeCodeReturnValue::halt == 1,
+                      "halt value is encoded below.  If it changes "
+                      "the value below should be updated.");
+        static_assert(haltReturnCodes::invalidOperator == 1,
+                      "invalidOperator value is encoded below.  If it changes "
+                      "the value below should be update.");
+
+        /* eax: nativeCodeReturnValue::halt */
+        EMIT_BYTES("\x31\xC0"               /* xor eax, eax             */
+                   "\xB0\x01"               /* mov al, imm8             */
+                                   /* imm8: nativeCodeReturnValue::halt */
+        /* ecx: 1 - invalid operator */
+                   "\x31\xDB"               /* xor ebx, ebx             */
+                   "\xB3\x01"               /* mov bl, imm8             */
+                              /* imm8: haltReturnCodes::invalidOperator */
+        /* edx: Invalid platter value */
+                   "\xB9");                 /* mov ecx, imm32           */
+        EMIT_WORD(p);
+        /* return */
+        EMIT_BYTES("\x5A"                   /* pop edx                  */
+                   "\xFF\xD2");             /* call edx                 */
+
+        BOOST_ASSERT(size >= recompileStubSize);
+
+        return size;
+    }
+
+    platter::operator_::value op = p.decode(A, B, C, value);
+
+    static_assert(sizeof(stencils) / sizeof(stencils[0])
+                  == platter::operator_::halt + 1,
+                  "stencils are indexed by operator numbers.");
+    static_assert(orthographyStencil.size >= recompileStubSize,
+                  "Stencil code should fit a recompile stub.");
+
+    if (const preparedStencil * s = stencilFor(op))
+    {
+        /* Operators without a stencil have a size of 0 in the table. */
+        BOOST_ASSERT(s->size >= recompileStubSize);
+        BOOST_ASSERT(::array::_plattersOffset < 256);
+
+        unsigned int operands[stencilOperand::count] = {
+            A, B, C, value,
+            static_cast<unsigned int>(::array::_plattersOffset)
+        };
+
+        return emitStencil(*s, operands, to);
+    }
+
+    switch (op)
+    {
+        case platter::operator_::arrayAmendment:
+            /* ecx: A */
+            EMIT_BYTES("\x8B\x4E");         /* mov ecx, [esi + disp8]   */
+            EMIT_REGISTER_AS_BYTE_DISP(A);  /*          [esi + A]       */
+            /* ebx: B */
+            EMIT_BYTES("\x8B\x5E");         /* mov ebx, [esi + disp8]   */
+            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
+            /* edx: C */
+            EMIT_BYTES("\x8B\x56");         /* mov edx, [esi + disp8]   */
+            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+
+            /* eax: array[A] */
+            EMIT_BYTES("\x8B\x04\x8F");     /* mov eax, [edi + ecx * 4] */
+
+            /*
+             * if (array[A]->_flags & shared) { 
+             *     return unshare; 
+             *     <start over> 
+             * }
+             */
+            static_assert(nativeCodeReturnValue::unshare == 11,
+                          "unshare value is encoded below.  If it "
+                          "changes the value below should be updated.");
+            EMIT_BYTES("\xF6\x40");         /* test byte [eax + disp8], */
+            EMIT_BYTE(static_cast<unsigned char>(offsetof(::array, _flags)));
+                                            /*   [eax + array::_flags], */
+            EMIT_BYTE(static_cast<unsigned char>(::array::flag::shared));
+                                            /* imm8: array::flag::shared */
+            BOOST_ASSERT(offsetof(::array, _flags) < 128);
+            EMIT_BYTES("\x74\x09"           /* jz rel8: 9               */
+                       "\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x0B"           /* mov al, imm8             */
+                            /* imm8: nativeCodeReturnValue::unshare     */
+                       "\x5A"               /* pop edx                  */
+                       "\xFF\xD2"           /* call edx                 */
+                       "\xEB\xE5");         /* jmp rel8: -27            */
+            BOOST_ASSERT(size == 27);
+
+            /* array[A]->_flags |= dirty */
+            EMIT_BYTES("\x83\x88");         /* or [eax + disp32], imm8  */
+            EMIT_WORD(static_cast<unsigned int>(offsetof(::array, _flags)));
+                                            /*    [eax + array::_flags] */
+            EMIT_BYTE(static_cast<unsigned char>(::array::flag::dirty));
+                                            /* imm8: array::flag::dirty */
+
+            /* array[A]->platters()[B] = C */
+            EMIT_BYTES("\x89\x54\x98");    
+                               /* mov [eax + ebx * 4 + disp8], edx      */
+                               /*     [eax + ebx * 4 + <first platter>] */
+            EMIT_BYTE(::array::_plattersOffset);     /* <first platter> */
+            BOOST_ASSERT(::array::_plattersOffset < 256);
+
+            /* if (A == 0) { */
+            EMIT_BYTES("\x83\xF9\x00");     /* cmp ecx, imm8 (0)        */
+            EMIT_BYTE(0x75);                /* jnz rel8                 */
+
+            if (_compilation == compilation::strided)
+            {
+                EMIT_BYTE(0x19);            /*   rel8: 25               */
+                jmpSource = size;
+
+                /*     eax: <slot B> */
+                EMIT_BYTES("\x89\xD8"       /* mov eax, ebx             */
+                           "\xC1\xE0");     /* shl eax, imm8            */
+                EMIT_BYTE(codeStrideShift); /*   codeStrideShift        */
+                EMIT_BYTE(0x05);            /* add eax, imm32           */
+                EMIT_WORD(reinterpret_cast<size_t>(_slotsBase));
+            }
+            else
+            {
+                EMIT_BYTE(0x18);            /*   rel8: 24               */
+                jmpSource = size;
+
+                /*     eax: jumpTable[B] */
+                EMIT_BYTES("\x8B\x44\x9D\x00"); 
+                                 /* mov eax, [ebp + ebx * 4 + disp8(0)] */
+
+                /*
+                 *     Platters that are not compiled yet will be compiled 
+                 *     from the new value.  Compile stub itself should not be 
+                 *     touched.
+                 *
+                 *     if (eax != <compile stub>)
+                 */
+                static_assert(jumpTable::commonStub::compile == 2,
+                              "compile stub slot is encoded in the code "
+                              "below.  If it changes code below should be "
+                              "updated.");
+                EMIT_BYTES("\x3B\x45\xF8"   /* cmp eax, [ebp + disp8(-8)] */
+                           "\x74\x0D");     /* je rel8: 13              */
+            }
+
+            /*
+             *     *eax = asm {
+             *                  xor eax, eax
+             *                  mov al, imm8
+             *                   ... nativeCodeReturnValue::recompile
+             *                  pop edx
+             *                  call edx
+             *            }
+             */
+
+            static_assert(nativeCodeReturnValue::recompile == 7,
+                          "recompile is encoded in the code below.  If it "
+                          "value changes code below should be updated.");
+            /*
+             * 31 C0             xor eax, eax
+             * B0 07             mov al, imm8 - B0+ al(0)
+             *                            nativeCodeReturnValue::recompile
+             * 5A                pop edx
+             * FF D2             (near abs) call edx
+             */
+
+            EMIT_BYTES("\xC7\x00\x31\xC0\xB0\x00"
+                                       /* mov [eax], imm32 (0x31C0B000) */
+
+                       "\xC7\x40\x03\x07\x5A\xFF\xD2"
+                            /* mov [eax + disp8(3)], imm32 (0x075AFFD2) */
+
+            /*     jmp rel8 (0) */
+                       "\xEB\x00");
+
+            /* } */
+            BOOST_ASSERT(jmpSource + 24 == size
+                         || (_compilation == compilation::strided
+                             && jmpSource + 25 == size));
+
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::allocation:
+
+            static_assert(nativeCodeReturnValue::allocation == 2,
+                          "allocation value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            /* eax: nativeCodeReturnValue::allocation */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x02"           /* mov al, imm8             */
+                             /* imm8: nativeCodeReturnValue::allocation */
+            /* ebx: C */
+                       "\x8B\x5E");         /* mov ebx, [esi + disp8]   */
+            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+
+            /* return */
+            EMIT_BYTES("\x5A"               /* pop edx                  */
+                       "\xFF\xD2"           /* call edx                 */
+
+            /* B: eax (new array index) */
+                       "\x89\x46");         /* mov [esi + disp8], eax   */
+            EMIT_REGISTER_AS_BYTE_DISP(B);  /*     [esi + B]            */
+
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::abandonment:
+
+            static_assert(nativeCodeReturnValue::abandonment == 3,
+                          "abandonment value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            /* eax: nativeCodeReturnValue::abandonment */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x03"           /* mov el, imm8             */
+                            /* imm8: nativeCodeReturnValue::abandonment */
+            /* ebx: C */
+                       "\x8B\x5E");         /* mov ebx, [esi + disp8]   */
+            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+
+            /* return */
+            EMIT_BYTES("\x5A"               /* pop edx                  */
+                       "\xFF\xD2");         /* call edx                 */
+
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::output:
+
+            static_assert(nativeCodeReturnValue::output == 4,
+                          "output value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            /* eax: nativeCodeReturnValue::output */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x04"           /* mov el, imm8             */
+                                 /* imm8: nativeCodeReturnValue::output */
+            /* ebx: C */
+                       "\x8B\x5E");         /* mov ebx, [esi + disp8]   */
+            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+
+            /* return */
+            EMIT_BYTES("\x5A"               /* pop edx                  */
+                       "\xFF\xD2");         /* call edx                 */
+
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::input:
+
+            static_assert(nativeCodeReturnValue::input == 5,
+                          "input value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            /* eax: nativeCodeReturnValue::input */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x05"           /* mov al, imm8             */
+                                  /* imm8: nativeCodeReturnValue::input */
+
+                       "\x5A"               /* pop edx                  */
+                       "\xFF\xD2"           /* call edx                 */
+
+            /* C = <input char> */
+                       "\x89\x46");         /* mov [esi + disp8], eax   */
+            EMIT_REGISTER_AS_BYTE_DISP(C);  /*     [esi + C]            */
+
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        case platter::operator_::loadProgram:
+
+            static_assert(nativeCodeReturnValue::loadProgram == 6,
+                          "loadProgram value is encoded below.  If it "
+                          "changes the value below should be updated.");
+
+            /* ebx: B */
+            EMIT_BYTES("\x8B\x5E");         /* mov ebx, [esi + disp8]   */
+            EMIT_REGISTER_AS_BYTE_DISP(B);  /*          [esi + B]       */
+
+            /* ecx: C */
+            EMIT_BYTES("\x8B\x4E");         /* mov ecx, [esi + disp8]   */
+            EMIT_REGISTER_AS_BYTE_DISP(C);  /*          [esi + C]       */
+
+            /* if (B == 0) { */
+            EMIT_BYTES("\x83\xFB\x00");     /* cmp ebx, imm8 (0)        */
+
+            if (_compilation == compilation::strided)
+            {
+                EMIT_BYTE(0x75);            /* jnz rel8                 */
+                EMIT_BYTE(jump ? 12 + directJumpSize : 12);
+                jmpSource = size;
+
+                EMIT_DIRECT_JUMP;
+
+                /*     eax: <slot C> */
+                EMIT_BYTES("\x89\xC8"       /* mov eax, ecx             */
+                           "\xC1\xE0");     /* shl eax, imm8            */
+                EMIT_BYTE(codeStrideShift); /*   codeStrideShift        */
+                EMIT_BYTE(0x05);            /* add eax, imm32           */
+                EMIT_WORD(reinterpret_cast<size_t>(_slotsBase));
+                /*     jmp eax */
+                EMIT_BYTES("\xFF\xE0");     /* jmp eax                  */
+                /* } */
+
+                BOOST_ASSERT(jmpSource + 12 + (jump ? directJumpSize : 0)
+                             == size);
+            }
+            else if (_compilation == compilation::traced)
+            {
+                EMIT_BYTES("\x75\x09");     /* jnz rel8: 9              */
+                jmpSource = size;
+
+                /*
+                 *     eax: traceTable[C]
+                 *
+                 *     Profile stub expects the platter index in ecx.
+                 */
+                EMIT_BYTES("\x8B\x84\x8D");
+                               /* mov eax, [ebp + ecx * 4 + disp32]     */
+                EMIT_WORD(static_cast<unsigned int>(_traceTableOffset));
+                                            /*   <trace table>          */
+                /*     jmp eax */
+                EMIT_BYTES("\xFF\xE0");     /* jmp eax                  */
+                /* } */
+
+                BOOST_ASSERT(jmpSource + 9 == size);
+            }
+            else
+            {
+                EMIT_BYTE(0x75);            /* jnz rel8                 */
+                EMIT_BYTE(jump ? 6 + directJumpSize : 6);
+                jmpSource = size;
+
+                EMIT_DIRECT_JUMP;
+
+                /*     eax: jumpTable[C] */
+                EMIT_BYTES("\x8B\x44\x8D\x00"
+                                 /* mov eax, [ebp + ecx * 4 + disp8(0)] */
+                /*     jmp eax */
+                           "\xFF\xE0");     /* jmp eax                  */
+                /* } */
+
+                BOOST_ASSERT(jmpSource + 6 + (jump ? directJumpSize : 0)
+                             == size);
+            }
+
+            /* eax: nativeCodeReturnValue::loadProgram */
+            EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+                       "\xB0\x06"           /* mov el, imm8             */
+                            /* imm8: nativeCodeReturnValue::loadProgram */
+
+            /* return */
+                       "\x5A"               /* pop edx                  */
+                       "\xFF\xD2");         /* call edx                 */
+
+            BOOST_ASSERT(size >= recompileStubSize);
+
+            break;
+
+        default:
+            throw logic_error("Unexpected operator");
+    }
+
+    return size;
+}
+
+size_t context::codeForOutputRun(const outputRun & run,
+                                 const char * continueAt, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    unsigned int assignedCount = 0;
+    for (unsigned int r = 0; r < 8; ++r)
+        if (run.assigned & (1 << r))
+            ++assignedCount;
+
+    /*
+     * Characters are stored right after the code, so all the offsets are 
+     * known in advance.
+     */
+    const size_t headerSize = 12;
+    const size_t codeSize = headerSize + 7 * assignedCount + 22;
+    const size_t totalSize = codeSize + run.bytes.size();
+
+    static_assert(nativeCodeReturnValue::outputString == 8,
+                  "outputString value is encoded below.  If it "
+                  "changes the value below should be updated.");
+
+    /* if (!(array[0]->_flags & dirty)) { */
+    EMIT_BYTES("\x8B\x07");             /* mov eax, [edi]           */
+    EMIT_BYTES("\xF6\x40");             /* test byte [eax + disp8], imm8 */
+    EMIT_BYTE(static_cast<unsigned char>(offsetof(::array, _flags)));
+                                        /*    [eax + array::_flags] */
+    EMIT_BYTE(static_cast<unsigned char>(::array::flag::dirty));
+                                        /* imm8: array::flag::dirty */
+    BOOST_ASSERT(offsetof(::array, _flags) < 128);
+    EMIT_BYTES("\x0F\x85");             /* jnz rel32                */
+    EMIT_WORD(static_cast<unsigned int>(totalSize - headerSize));
+                                        /*   <run platters code>    */
+    BOOST_ASSERT(size == headerSize);
+
+    /*     A = value, for every register the run assigns */
+    for (unsigned int r = 0; r < 8; ++r)
+    {
+        if (!(run.assigned & (1 << r)))
+            continue;
+
+        EMIT_BYTES("\xC7\x46");         /* mov [esi + disp8], imm32 */
+        EMIT_REGISTER_AS_BYTE_DISP(r);  /*     [esi + r]            */
+        EMIT_WORD(run.values[r]);       /*                    value */
+    }
+
+    /*     ebx: characters */
+    EMIT_BYTE(0xBB);                    /* mov ebx, imm32           */
+    EMIT_WORD(to ? reinterpret_cast<unsigned int>(to + codeSize) : 0);
+                                        /*   <characters>           */
+    /*     ecx: number of characters */
+    EMIT_BYTE(0xB9);                    /* mov ecx, imm32           */
+    EMIT_WORD(static_cast<unsigned int>(run.bytes.size()));
+
+    /*     eax: nativeCodeReturnValue::outputString */
+    EMIT_BYTES("\x31\xC0"               /* xor eax, eax             */
+               "\xB0\x08"               /* mov al, imm8             */
+                          /* imm8: nativeCodeReturnValue::outputString */
+    /*     return */
+               "\x5A"                   /* pop edx                  */
+               "\xFF\xD2");             /* call edx                 */
+
+    /*     continue after the run */
+    EMIT_BYTE(0xE9);                    /* jmp rel32                */
+    EMIT_WORD(to ? static_cast<unsigned int>(continueAt - (to + codeSize))
+                 : 0);
+    /* } */
+    BOOST_ASSERT(size == codeSize);
+
+    if (to)
+    {
+        memcpy(curr, run.bytes.data(), run.bytes.size());
+        curr += run.bytes.size();
+    }
+    size += run.bytes.size();
+
+    return size;
+}
+
+size_t context::codeForBitwiseRun(const bitwiseRun & run,
+                                  const char * continueAt, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    const size_t headerSize = 12;
+
+    /* if (!(array[0]->_flags & dirty)) { */
+    EMIT_BYTES("\x8B\x07");             /* mov eax, [edi]           */
+    EMIT_BYTES("\xF6\x40");             /* test byte [eax + disp8], imm8 */
+    EMIT_BYTE(static_cast<unsigned char>(offsetof(::array, _flags)));
+                                        /*    [eax + array::_flags] */
+    EMIT_BYTE(static_cast<unsigned char>(::array::flag::dirty));
+                                        /* imm8: array::flag::dirty */
+    BOOST_ASSERT(offsetof(::array, _flags) < 128);
+    EMIT_BYTES("\x0F\x85");             /* jnz rel32                */
+    EMIT_WORD(0);                       /*   <run platters code>    */
+                                        /*   patched below          */
+    BOOST_ASSERT(size == headerSize);
+
+    /*     eax: x, edx: y */
+    EMIT_BYTES("\x8B\x46");             /* mov eax, [esi + disp8]   */
+    EMIT_REGISTER_AS_BYTE_DISP(run.x);  /*     [esi + x]            */
+    EMIT_BYTES("\x8B\x56");             /* mov edx, [esi + disp8]   */
+    EMIT_REGISTER_AS_BYTE_DISP(run.y);  /*     [esi + y]            */
+
+    /*     r = function(x, y), for every register the run assigns */
+    for (unsigned int r = 0; r < 8; ++r)
+    {
+        if (!(run.assigned & (1 << r)))
+            continue;
+
+        bitwiseRecipe recipe = bitwiseRecipeFor(run.functions[r]);
+        bool otherIsX = false;
+
+        /*     ecx: function(x, y) */
+        switch (recipe.source)
+        {
+            case bitwiseRecipe::x:
+                EMIT_BYTES("\x89\xC1"); /* mov ecx, eax             */
+                break;
+
+            case bitwiseRecipe::y:
+                EMIT_BYTES("\x89\xD1"); /* mov ecx, edx             */
+                otherIsX = true;
+                break;
+
+            case bitwiseRecipe::zero:
+                EMIT_BYTES("\x31\xC9"); /* xor ecx, ecx             */
+                break;
+        }
+
+        if (recipe.negateSource)
+            EMIT_BYTES("\xF7\xD1");     /* not ecx                  */
+
+        if (recipe.operation != bitwiseRecipe::none)
+        {
+            switch (recipe.operation)
+            {
+                case bitwiseRecipe::and_:
+                    EMIT_BYTE(0x21);    /* and ecx, other           */
+                    break;
+                case bitwiseRecipe::or_:
+                    EMIT_BYTE(0x09);    /* or ecx, other            */
+                    break;
+                default:
+                    EMIT_BYTE(0x31);    /* xor ecx, other           */
+            }
+            EMIT_BYTE(otherIsX ? 0xC1 : 0xD1);
+                                        /*   other: eax or edx      */
+        }
+
+        if (recipe.negateResult)
+            EMIT_BYTES("\xF7\xD1");     /* not ecx                  */
+
+        EMIT_BYTES("\x89\x4E");         /* mov [esi + disp8], ecx   */
+        EMIT_REGISTER_AS_BYTE_DISP(r);  /*     [esi + r]            */
+    }
+
+    /*     continue after the run */
+    EMIT_BYTE(0xE9);                    /* jmp rel32                */
+    EMIT_WORD(to ? static_cast<unsigned int>(continueAt - (to + size + 4))
+                 : 0);
+    /* } */
+
+    if (to)
+        *reinterpret_cast<unsigned int *>(to + headerSize - 4) =
+            static_cast<unsigned int>(size - headerSize);
+
+    return size;
+}
+
+size_t context::codeForBranch(const char * target, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    ptrdiff_t rel = 0;
+    if (to)
+    {
+        rel = target - (to + 5);
+        if (rel != static_cast<int>(rel))
+            return 0;
+    }
+
+    EMIT_BYTE(0xE9);                /* jmp rel32                */
+    EMIT_WORD(static_cast<unsigned int>(rel));
+
+    return size;
+}
+
+void context::codeForPadding(size_t bytes, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    /*
+     * Recommended multi-byte nop sequences.  Short padding is cheaper to 
+     * execute as a single nop than as a jump.
+     */
+    static const char * const nops[] = {
+        "",
+        "\x90",                                /* nop                   */
+        "\x66\x90",                            /* xchg ax, ax           */
+        "\x0F\x1F\x00",                        /* nop [eax]             */
+        "\x0F\x1F\x40\x00",                    /* nop [eax + 0]         */
+        "\x0F\x1F\x44\x00\x00",                /* nop [eax + eax + 0]   */
+        "\x66\x0F\x1F\x44\x00\x00",            /* nop [eax + eax + 0]   */
+        "\x0F\x1F\x80\x00\x00\x00\x00",        /* nop [eax + 0]         */
+        "\x0F\x1F\x84\x00\x00\x00\x00\x00",    /* nop [eax + eax + 0]   */
+    };
+
+    const size_t maxNop = sizeof(nops) / sizeof(nops[0]) - 1;
+
+    /*
+     * A few nops are still cheaper than a taken jump.  Bytes after a jump 
+     * are never executed and are left as they are.
+     */
+    if (bytes <= 3 * maxNop)
+    {
+        while (size < bytes)
+        {
+            size_t nop = std::min(bytes - size, maxNop);
+            memcpy(curr, nops[nop], nop);
+            curr += nop;
+            size += nop;
+        }
+    }
+    else if (bytes - 2 < 128)
+    {
+        EMIT_BYTE(0xEB);            /* jmp rel8                 */
+        EMIT_BYTE(static_cast<unsigned char>(bytes - 2));
+    }
+    else
+    {
+        EMIT_BYTE(0xE9);            /* jmp rel32                */
+        EMIT_WORD(static_cast<unsigned int>(bytes - 5));
+    }
+
+    BOOST_ASSERT(size <= bytes);
+}
+
+size_t context::codeForOOBStub(char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    static_assert(nativeCodeReturnValue::halt == 1,
+                  "halt value is encoded below.  If it changes "
+                  "the value below should be updated.");
+    static_assert(haltReturnCodes::outOfBoundExecution == 2,
+                  "outOfBoundExecution value is encoded below.  If it "
+                  "changes the value below should be update.");
+
+    /* eax: nativeCodeReturnValue::halt */
+    EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+               "\xB0\x01"           /* mov al, imm8             */
+                           /* imm8: nativeCodeReturnValue::halt */
+    /* ebx: 2 - out of bound execution */
+               "\x31\xDB"           /* xor ebx, ebx             */
+               "\xB3\x02"           /* mov bl, imm8             */
+                  /* imm8: haltReturnCodes::outOfBoundExecution */
+    /* return */
+               "\x5A"               /* pop edx                  */
+               "\xFF\xD2");         /* call edx                 */
+
+    return size;
+}
+
+size_t context::codeForDataStub(char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    static_assert(nativeCodeReturnValue::recompile == 7,
+                  "recompile value is encoded below.  If it changes "
+                  "the value below should be updated.");
+
+    /* eax: nativeCodeReturnValue::recompile */
+    EMIT_BYTES("\x31\xC0"           /* xor eax, eax             */
+               "\xB0\x07"           /* mov al, imm8             */
+                      /* imm8: nativeCodeReturnValue::recompile */
+    /* return */
+               "\x5A"               /* pop edx                  */
+               "\xFF\xD2");         /* call edx                 */
+
+    size_t branchSize = codeForBranch(nullptr, nullptr);
+    if (size < branchSize)
+    {
+        if (to)
+            codeForPadding(branchSize - size, curr);
+        size = branchSize;
+    }
+
+    return size;
+}
+
+size_t context::codeForTrace(const ::array & a, const trace & t, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    /*
+     * Guards jump to exits that follow the trace code.  Every exit continues 
+     * at the platter code via the jump table.  Exit i ends its guard rel32 
+     * at exitSources[i] and continues at platter exitTargets[i].
+     */
+    vector<size_t> exitSources;
+    vector<size_t> exitTargets;
+
+#define EMIT_TRACE_EXIT(TARGET)                                         \
+    EMIT_WORD(0);                       /*   <exit>                 */  \
+    exitSources.push_back(size);                                        \
+    exitTargets.push_back(TARGET);                                      \
+    /* */
+
+#define EMIT_DIRTY_GUARD(TARGET)                                        \
+    EMIT_BYTES("\x8B\x07");             /* mov eax, [edi]           */  \
+    EMIT_BYTES("\xF6\x40");             /* test byte [eax + disp8], imm8 */ \
+    EMIT_BYTE(static_cast<unsigned char>(offsetof(::array, _flags)));   \
+                                        /*    [eax + array::_flags] */  \
+    EMIT_BYTE(static_cast<unsigned char>(::array::flag::dirty));        \
+                                        /* imm8: array::flag::dirty */  \
+    BOOST_ASSERT(offsetof(::array, _flags) < 128);                      \
+    EMIT_BYTES("\x0F\x85");             /* jnz rel32                */  \
+    EMIT_TRACE_EXIT(TARGET);                                            \
+    /* */
+
+    /* Array 0 was modified after the trace was recorded. */
+    EMIT_DIRTY_GUARD(t.head);
+
+    size_t loopStart = size;
+
+    for (size_t s = 0; s < t.steps.size(); ++s)
+    {
+        const trace::step & step = t.steps[s];
+        const platter & p = a[step.index];
+
+        unsigned int A = 0, B = 0, C = 0, value = 0;
+        platter::operator_::value op = p.decode(A, B, C, value);
+
+        switch (op)
+        {
+            case platter::operator_::loadProgram:
+                /* if (B != 0 || C != target) exit */
+                EMIT_BYTES("\x83\x7E");     /* cmp dword [esi + disp8], imm8 */
+                EMIT_REGISTER_AS_BYTE_DISP(B);  /*     [esi + B]        */
+                EMIT_BYTE(0);               /*   imm8: 0                */
+                EMIT_BYTES("\x0F\x85");     /* jnz rel32                */
+                EMIT_TRACE_EXIT(step.index);
+
+                EMIT_BYTES("\x81\x7E");     /* cmp dword [esi + disp8], imm32 */
+                EMIT_REGISTER_AS_BYTE_DISP(C);  /*     [esi + C]        */
+                EMIT_WORD(static_cast<unsigned int>(step.target));
+                EMIT_BYTES("\x0F\x85");     /* jne rel32                */
+                EMIT_TRACE_EXIT(step.index);
+                continue;
+
+            case platter::operator_::division:
+                /* Platter code reports division by zero. */
+                EMIT_BYTES("\x83\x7E");     /* cmp dword [esi + disp8], imm8 */
+                EMIT_REGISTER_AS_BYTE_DISP(C);  /*     [esi + C]        */
+                EMIT_BYTE(0);               /*   imm8: 0                */
+                EMIT_BYTES("\x0F\x84");     /* jz rel32                 */
+                EMIT_TRACE_EXIT(step.index);
+                break;
+
+            default:
+                break;
+        }
+
+        size_t platterSize = codeFor(p, to ? curr : nullptr);
+        size += platterSize;
+        if (to)
+            curr += platterSize;
+
+        /* Amendment may have modified array 0. */
+        if (op == platter::operator_::arrayAmendment)
+        {
+            EMIT_DIRTY_GUARD(step.index + 1);
+        }
+    }
+
+    /* Back at the head. */
+    EMIT_BYTE(0xE9);                    /* jmp rel32                */
+    EMIT_WORD(static_cast<unsigned int>(loopStart - (size + 4)));
+
+    for (size_t i = 0; i < exitSources.size(); ++i)
+    {
+        if (to)
+            *reinterpret_cast<unsigned int *>(to + exitSources[i] - 4) =
+                static_cast<unsigned int>(size - exitSources[i]);
+
+        size_t exitSize = codeForJump(exitTargets[i], to ? curr : nullptr);
+        size += exitSize;
+        if (to)
+            curr += exitSize;
+    }
+
+#undef EMIT_DIRTY_GUARD
+#undef EMIT_TRACE_EXIT
+
+    return size;
+}
+
+size_t context::codeForJump(size_t i, char * to)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    /* ecx: i */
+    EMIT_BYTE(0xB9);                /* mov ecx, imm32           */
+    EMIT_WORD(static_cast<unsigned int>(i));
+    /* jmp jumpTable[i] */
+    EMIT_BYTES("\xFF\x64\x8D\x00");
+                        /* jmp [ebp + ecx * 4 + disp8(0)]       */
+
+    return size;
+}
+
+size_t context::codeForCommonStubs(char * to, class jumpTable * jt)
+{
+    size_t size = 0;
+    char * curr = to;
+
+    /* Recompile stubs are completely inline. */
+
+    /*
+     * Jump table entries of platters that are not compiled yet point here.  
+     * Everyone who jumps via the jump table puts the platter index into ecx.
+     */
+    if (to)
+        jt->commonStubAddress(jumpTable::commonStub::compile, curr);
+
+    static_assert(nativeCodeReturnValue::compile == 9,
+                  "compile value is encoded below.  If it changes "
+                  "the value below should be updated.");
+
+    /* ebx: platter index */
+    EMIT_BYTES("\x89\xCB"           /* mov ebx, ecx             */
+    /* eax: nativeCodeReturnValue::compile */
+               "\x31\xC0"           /* xor eax, eax             */
+               "\xB0\x09"           /* mov al, imm8             */
+                        /* imm8: nativeCodeReturnValue::compile */
+    /* return */
+               "\x5A"               /* pop edx                  */
+               "\xFF\xD2");         /* call edx                 */
+
+    /*
+     * Trace table entries of platters that are not traced yet point here.  
+     * Everyone who jumps via the trace table puts the platter index into 
+     * ecx.
+     */
+    if (to)
+        jt->commonStubAddress(jumpTable::commonStub::profile, curr);
+
+    static_assert(nativeCodeReturnValue::trace == 10,
+                  "trace value is encoded below.  If it changes "
+                  "the value below should be updated.");
+
+    /* if (--traceCounters[ecx] != 0) */
+    EMIT_BYTES("\x8B\x86");         /* mov eax, [esi + disp32]  */
+    EMIT_WORD(static_cast<unsigned int>(
+                nativeStateOffset()
+                + offsetof(_nativeState_type, traceCounters)));
+    EMIT_BYTES("\xFF\x0C\x88"       /* dec dword [eax + ecx * 4] */
+               "\x74\x04"           /* jz rel8: 4               */
+    /*     jmp jumpTable[ecx] */
+               "\xFF\x64\x8D\x00"   /* jmp [ebp + ecx * 4 + disp8(0)] */
+    /* ebx: platter index */
+               "\x89\xCB"           /* mov ebx, ecx             */
+    /* eax: nativeCodeReturnValue::trace */
+               "\x31\xC0"           /* xor eax, eax             */
+               "\xB0\x0A"           /* mov al, imm8             */
+                          /* imm8: nativeCodeReturnValue::trace */
+    /* return */
+               "\x5A"               /* pop edx                  */
+               "\xFF\xD2");         /* call edx                 */
+
+    return size;
+}
+
+/*
+ * --- Fault handling ---
+ *
+ * Division does not check the divisor.  div raises 
+ * EXCEPTION_INT_DIVIDE_BY_ZERO and the handler halts the machine the same 
+ * way the interpreter does.
+ *
+ * writeProtection(...) is ignored by this build and native code does not 
+ * check bounds, so nothing else faults on purpose.
+ */
+
+struct context::faultHandler
+{
+    /* Context that runs native code at the moment. */
+    static context * active;
+
+    /* AddVectoredExceptionHandler() result. */
+    static void * registration;
+
+    static LONG CALLBACK handle(EXCEPTION_POINTERS * info);
+
+    /*
+     * Whether `eip' is in native code of array 0 of the active context.  
+     * Exceptions anywhere else are not ours, even if the instruction looks 
+     * the same.
+     */
+    static bool inNativeCode(const void * eip);
+};
+
+context * context::faultHandler::active = nullptr;
+void * context::faultHandler::registration = nullptr;
+
+bool context::faultHandler::inNativeCode(const void * eip)
+{
+    if (!active)
+        return false;
+
+    const ::nativeCode * code = active->_arrays[0]->nativeCode();
+
+    return code && code->contains(eip);
+}
+
+LONG CALLBACK context::faultHandler::handle(EXCEPTION_POINTERS * info)
+{
+    CONTEXT * registers = info->ContextRecord;
+    const unsigned char * eip =
+        reinterpret_cast<const unsigned char *>(registers->Eip);
+
+    /* div [esi + C] */
+    if (info->ExceptionRecord->ExceptionCode != EXCEPTION_INT_DIVIDE_BY_ZERO
+        || !inNativeCode(eip)
+        || eip[0] != 0xF7 || eip[1] != 0x76)
+        return EXCEPTION_CONTINUE_SEARCH;
+
+    static_assert(nativeCodeReturnValue::halt == 1
+                  && haltReturnCodes::divisionByZero == 3,
+                  "halt values are set below.  If they change the values "
+                  "below should be updated.");
+
+    /*
+     * Same as "return halt" with divisionByZero in ebx and the division as 
+     * the return address, so that run() can tell the platter.
+     */
+    DWORD * esp = reinterpret_cast<DWORD *>(registers->Esp);
+
+    registers->Edx = *esp;
+    *esp = registers->Eip;
+
+    registers->Eax = nativeCodeReturnValue::halt;
+    registers->Ebx = haltReturnCodes::divisionByZero;
+    registers->Eip = registers->Edx;
+
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+
+void context::handleFaults(bool enable)
+{
+    if (!enable)
+    {
+        BOOST_ASSERT(faultHandler::active == this);
+
+        RemoveVectoredExceptionHandler(faultHandler::registration);
+        faultHandler::registration = nullptr;
+        faultHandler::active = nullptr;
+        return;
+    }
+
+    /* Only one context may run native code at a time. */
+    BOOST_ASSERT(!faultHandler::active);
+
+    faultHandler::registration =
+        AddVectoredExceptionHandler(1, &faultHandler::handle);
+    if (!faultHandler::registration)
+        throw exceptions::systemError(L"AddVectoredExceptionHandler() failed",
+                                      exceptions::systemError::getLast);
+
+    faultHandler::active = this;
+}
+
+#endif /* _M_IX86 */
@@ -0,0 +1,179 @@
+#include "decodedPlatters.h"
+
+#include "array.h"
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define SSE2_DECODER
+# include <emmintrin.h>
+#endif
+
+
+using namespace std;
+
+
+namespace
+{
+    static_assert(sizeof(platter) == sizeof(unsigned int),
+                  "Platters are decoded as an array of unsigned int");
+
+    const unsigned int valueMask = (1u << 25) - 1;
+
+    /*
+     * Decodes platters [first, last) of `words' into the field arrays.  The 
+     * vector code below does exactly the same, 16 platters at a time.
+     */
+    void decodeScalar(const unsigned int * words, size_t first, size_t last,
+                      unsigned char * operators, unsigned char * A,
+                      unsigned char * B, unsigned char * C,
+                      unsigned int * values)
+    {
+        for (size_t i = first; i < last; ++i)
+        {
+            unsigned int p = words[i];
+            unsigned int operatorNumber = p >> 28;
+
+            if (operatorNumber > platter::operator_::orthography)
+            {
+                operators[i] = decodedPlatters::invalidOperator;
+                values[i] = p;
+            }
+            else
+            {
+                operators[i] = static_cast<unsigned char>(operatorNumber);
+                values[i] = p & valueMask;
+            }
+
+            A[i] = static_cast<unsigned char>(
+                (operatorNumber == platter::operator_::orthography
+                 ? p >> 25 : p >> 6) & 0x7);
+            B[i] = static_cast<unsigned char>((p >> 3) & 0x7);
+            C[i] = static_cast<unsigned char>(p & 0x7);
+        }
+    }
+
+#ifdef SSE2_DECODER
+    /* Fields of 4 platters, one in every 32 bit lane. */
+    struct fields
+    {
+        __m128i operator_;
+        __m128i A, B, C;
+    };
+
+    fields decodeVector(const unsigned int * words, unsigned int * values)
+    {
+        const __m128i seven = _mm_set1_epi32(0x7);
+        const __m128i orthography =
+            _mm_set1_epi32(platter::operator_::orthography);
+        const __m128i invalid =
+            _mm_set1_epi32(decodedPlatters::invalidOperator);
+
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words));
+
+        fields res;
+        res.operator_ = _mm_srli_epi32(p, 28);
+
+        __m128i isOrthography = _mm_cmpeq_epi32(res.operator_, orthography);
+        __m128i isInvalid = _mm_cmpgt_epi32(res.operator_, orthography);
+
+        res.operator_ = _mm_or_si128(_mm_andnot_si128(isInvalid, res.operator_),
+                                     _mm_and_si128(isInvalid, invalid));
+
+        res.A = _mm_or_si128(
+            _mm_andnot_si128(isOrthography,
+                             _mm_and_si128(_mm_srli_epi32(p, 6), seven)),
+            _mm_and_si128(isOrthography,
+                          _mm_and_si128(_mm_srli_epi32(p, 25), seven)));
+        res.B = _mm_and_si128(_mm_srli_epi32(p, 3), seven);
+        res.C = _mm_and_si128(p, seven);
+
+        __m128i value = _mm_and_si128(
+            p, _mm_or_si128(_mm_set1_epi32(valueMask), isInvalid));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(values), value);
+
+        return res;
+    }
+
+    /* Narrows 16 values below 128 from 32 to 8 bits and stores them. */
+    void store(__m128i v0, __m128i v1, __m128i v2, __m128i v3,
+               unsigned char * to)
+    {
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v0, v1),
+                                         _mm_packs_epi32(v2, v3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(to), bytes);
+    }
+#endif /* SSE2_DECODER */
+}
+
+decodedPlatters::decodedPlatters()
+{ }
+
+decodedPlatters::decodedPlatters(const ::array & a)
+{
+    decode(a);
+}
+
+void decodedPlatters::decode(const ::array & a)
+{
+    decode(a.platters(), a.size());
+}
+
+void decodedPlatters::decode(const platter * first, size_t count)
+{
+    _operators.resize(count);
+    _A.resize(count);
+    _B.resize(count);
+    _C.resize(count);
+    _values.resize(count);
+
+    const unsigned int * words = reinterpret_cast<const unsigned int *>(first);
+    size_t i = 0;
+
+#ifdef SSE2_DECODER
+    for (; i + 16 <= count; i += 16)
+    {
+        fields f[4];
+        for (size_t j = 0; j < 4; ++j)
+            f[j] = decodeVector(words + i + j * 4, &_values[i + j * 4]);
+
+        store(f[0].operator_, f[1].operator_, f[2].operator_, f[3].operator_,
+              &_operators[i]);
+        store(f[0].A, f[1].A, f[2].A, f[3].A, &_A[i]);
+        store(f[0].B, f[1].B, f[2].B, f[3].B, &_B[i]);
+        store(f[0].C, f[1].C, f[2].C, f[3].C, &_C[i]);
+    }
+#endif
+
+    decodeScalar(words, i, count, _operators.data(), _A.data(), _B.data(),
+                 _C.data(), _values.data());
+}
+
+size_t decodedPlatters::size() const
+{
+    return _operators.size();
+}
+
+const unsigned char * decodedPlatters::operators() const
+{
+    return _operators.data();
+}
+
+const unsigned char * decodedPlatters::A() const
+{
+    return _A.data();
+}
+
+const unsigned char * decodedPlatters::B() const
+{
+    return _B.data();
+}
+
+const unsigned char * decodedPlatters::C() const
+{
+    return _C.data();
+}
+
+const unsigned int * decodedPlatters::values() const
+{
+    return _values.data();
+}
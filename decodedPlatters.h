@@ -0,0 +1,67 @@
+#ifndef __DECODED_PLATTERS__H
+#define __DECODED_PLATTERS__H
+
+#include "platter.h"
+
+#include <vector>
+#include <cstddef>
+
+class array;
+
+/*
+ * Operator fields of a whole array of platters, decoded in one pass.  Every 
+ * field is kept in its own vector, so that a pass that only looks at 
+ * operators or only at orthography values does not touch the rest.
+ *
+ * Unlike platter::decode(...) invalid operators are not an error.  They are 
+ * marked with the invalidOperator tag, as arrays that are loaded as programs 
+ * usually hold data as well as code.
+ */
+class decodedPlatters
+{
+public:
+    /* operators() value of platters with operator number 14 or 15. */
+    static const unsigned char invalidOperator =
+        platter::operator_::orthography + 1;
+
+    decodedPlatters();
+
+    /* Same as decode(a). */
+    explicit decodedPlatters(const array & a);
+
+    /* Replaces the content with the fields of all the platters of `a'. */
+    void decode(const array & a);
+
+    /* Same for platters [first, first + count) */
+    void decode(const platter * first, size_t count);
+
+    size_t size() const;
+
+    /*
+     * platter::operator_::value of every platter or invalidOperator.
+     */
+    const unsigned char * operators() const;
+
+    /*
+     * Register fields as platter::decode(...) returns them.  For orthography 
+     * A is the register that gets the value, B and C are not relevant.
+     */
+    const unsigned char * A() const;
+    const unsigned char * B() const;
+    const unsigned char * C() const;
+
+    /*
+     * Orthography value or, for invalid operators, the platter itself, so 
+     * that it can be reported.  Not relevant for other operators.
+     */
+    const unsigned int * values() const;
+
+private:
+    std::vector<unsigned char> _operators;
+    std::vector<unsigned char> _A;
+    std::vector<unsigned char> _B;
+    std::vector<unsigned char> _C;
+    std::vector<unsigned int> _values;
+};
+
+#endif /* __DECODED_PLATTERS__H */
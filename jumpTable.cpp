@@ -2,15 +2,19 @@
 
 #include "memoryManager.h"
 
+#include <cstddef>
+
 jumpTable * jumpTable::create(memoryManager & mm, size_t slotCount)
 {
-    void * p = mm.alloc(slotCount * sizeof(void *), false);
+    void * p = mm.alloc((commonStub::count + slotCount) * sizeof(void *),
+                        false);
 
     /*
      * See nativeCode::craete(...) implementation for an exmplanation why 
      * explicit '::' is required here.
      */
-    return ::new (p) jumpTable();
+    return ::new (reinterpret_cast<void **>(p) + commonStub::count)
+        jumpTable();
 }
 
 jumpTable::~jumpTable()
@@ -20,7 +24,7 @@ void jumpTable::destroy(memoryManager & mm)
 {
     jumpTable::~jumpTable();
 
-    mm.release(this);
+    mm.release(begin() - commonStub::count);
 }
 
 void ** jumpTable::begin()
@@ -37,3 +41,13 @@ void * jumpTable::address(size_t i) const
 {
     return begin()[i];
 }
+
+void * jumpTable::commonStubAddress(commonStub::value s) const
+{
+    return begin()[-static_cast<ptrdiff_t>(s)];
+}
+
+void jumpTable::commonStubAddress(commonStub::value s, void * address)
+{
+    begin()[-static_cast<ptrdiff_t>(s)] = address;
+}
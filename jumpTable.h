@@ -7,7 +7,10 @@ class memoryManager;
 
 /*
  * Contains addresses of instructions in a nativeCode block that coresponds to 
- * platters in an array.  Has the same size as the source array.
+ * platters in an array.  Has one entry more than the source array has 
+ * platters.  The last one is the address of the out of bound execution stub, 
+ * so in the eagerly compiled code entry i + 1 is always where the code for 
+ * platter i ends.
  *
  * Instances of this class are created by nativeCode::create(...).
  */
@@ -36,6 +39,43 @@ public:
      */
     void * address(size_t i) const;
 
+    /*
+     * Native code that is shared by all the platters of a nativeCode block is 
+     * called via slots that are stored right before the first jump table 
+     * entry.  This way native code can reach them with a fixed negative 
+     * displacement from the jump table base.  Slot `s' is at begin()[-s].
+     */
+    struct commonStub
+    {
+        enum value
+        {
+            /* Called by recompile stubs. */
+            recompile = 1,
+
+            /*
+             * Jump table entries of platters that were not compiled yet point 
+             * here.  See context::compilation::lazy.
+             */
+            compile   = 2,
+
+            /*
+             * Trace table entries of loadProgram targets that are still 
+             * counted point here.  See context::compilation::traced.
+             */
+            profile   = 3,
+        };
+
+        /* Number of slots reserved before the first entry. */
+        static const size_t count = 3;
+
+    private:
+        /* This struct is just a container for value. */
+        commonStub();
+    };
+
+    void * commonStubAddress(commonStub::value s) const;
+    void commonStubAddress(commonStub::value s, void * address);
+
 private:
     /*
      * Actual jump table goes here.  It is allocated by the 
@@ -1,17 +1,26 @@
 #include <iostream>
 #include <iomanip>
 #include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <memory>
 
-#include <io.h>
-#include <fcntl.h>
+#ifdef _WIN32
+# include <io.h>
+# include <fcntl.h>
+#endif
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "memoryManager.h"
 #include "scrollReader.h"
 #include "array.h"
 #include "context.h"
+#include "codeCache.h"
+#include "translator.h"
 
 
 using namespace std;
@@ -20,15 +29,145 @@ using namespace boost::filesystem;
 
 
 void usage(ostream & os);
+void codegenBenchmark(context & ctx, size_t platters, long rounds);
 
 int main(int argc, const char * argv[])
 {
-    if (argc != 2)
+    context::compilation::value compilation = context::compilation::eager;
+    /* Negative means context default. */
+    long flushInterval = -1;
+    /* Negative means context default. */
+    long programCacheMegabytes = -1;
+    /* Zero means run the program. */
+    long codegenRounds = 0;
+    /* Empty means no code cache. */
+    path codeCacheDirectory;
+    /* Empty means run the program. */
+    path translationPath;
+    bool writeProtection = false;
+    bool boundsChecks = false;
+
+    int argi = 1;
+    for (; argi < argc - 1; ++argi)
+    {
+        if (strcmp(argv[argi], "--lazy") == 0)
+            compilation = context::compilation::lazy;
+        else if (strcmp(argv[argi], "--strided") == 0)
+            compilation = context::compilation::strided;
+        else if (strcmp(argv[argi], "--interpret") == 0)
+            compilation = context::compilation::interpreted;
+        else if (strcmp(argv[argi], "--tiered") == 0)
+            compilation = context::compilation::tiered;
+        else if (strcmp(argv[argi], "--traced") == 0)
+            compilation = context::compilation::traced;
+        else if (strcmp(argv[argi], "--write-protect") == 0)
+            writeProtection = true;
+        else if (strcmp(argv[argi], "--check-bounds") == 0)
+            boundsChecks = true;
+        else if (strcmp(argv[argi], "--flush-interval") == 0
+                 && argi + 1 < argc - 1)
+        {
+            char * end;
+            flushInterval = strtol(argv[++argi], &end, 10);
+
+            if (*end != '\0' || flushInterval < 0)
+            {
+                cerr << "Error: Invalid flush interval '" << argv[argi]
+                    << "'." << endl;
+                usage(cerr);
+                return 2;
+            }
+        }
+        else if (strcmp(argv[argi], "--program-cache") == 0
+                 && argi + 1 < argc - 1)
+        {
+            char * end;
+            programCacheMegabytes = strtol(argv[++argi], &end, 10);
+
+            if (*end != '\0' || programCacheMegabytes < 0)
+            {
+                cerr << "Error: Invalid program cache size '" << argv[argi]
+                    << "'." << endl;
+                usage(cerr);
+                return 2;
+            }
+        }
+        else if (strcmp(argv[argi], "--codegen-benchmark") == 0
+                 && argi + 1 < argc - 1)
+        {
+            char * end;
+            codegenRounds = strtol(argv[++argi], &end, 10);
+
+            if (*end != '\0' || codegenRounds <= 0)
+            {
+                cerr << "Error: Invalid number of rounds '" << argv[argi]
+                    << "'." << endl;
+                usage(cerr);
+                return 2;
+            }
+        }
+        else if (strcmp(argv[argi], "--code-cache") == 0
+                 && argi + 1 < argc - 1)
+        {
+            codeCacheDirectory = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "--translate") == 0
+                 && argi + 1 < argc - 1)
+        {
+            translationPath = argv[++argi];
+        }
+        else
+        {
+            cerr << "Error: Unknown option '" << argv[argi] << "'." << endl;
+            usage(cerr);
+            return 2;
+        }
+    }
+
+    if (argi != argc - 1)
+    {
+        usage(cerr);
+        return 2;
+    }
+
+    if (!codeCacheDirectory.empty()
+        && compilation != context::compilation::eager)
+    {
+        cerr << "Error: --code-cache only works with the default eager "
+                    "compilation." << endl;
+        usage(cerr);
+        return 2;
+    }
+
+    /* Cached code would not check amendments when run without it. */
+    if (!codeCacheDirectory.empty() && writeProtection)
+    {
+        cerr << "Error: --code-cache does not work with --write-protect."
+            << endl;
+        usage(cerr);
+        return 2;
+    }
+
+    /* Cached code may have been generated with or without the checks. */
+    if (!codeCacheDirectory.empty() && boundsChecks)
     {
+        cerr << "Error: --code-cache does not work with --check-bounds."
+            << endl;
         usage(cerr);
         return 2;
     }
 
+    /*
+     * context buffers output itself and needs to know if there is buffered 
+     * input, which only works if cin has its own buffer.
+     */
+    ios::sync_with_stdio(false);
+
+    /* Larger buffer means fewer reads when a lot of input is piped in. */
+    static char inputBuffer[64 * 1024];
+    cin.rdbuf()->pubsetbuf(inputBuffer, sizeof(inputBuffer));
+
+#ifdef _WIN32
     if (_setmode(_fileno(stdin), _O_BINARY) == -1)
     {
         cerr << "Error: _setmode(stdin, BINARY) failed: " << errno << endl;
@@ -40,10 +179,11 @@ int main(int argc, const char * argv[])
         cerr << "Error: _setmode(stdout, BINARY) failed: " << errno << endl;
         return 2;
     }
+#endif
 
     try
     {
-        path scrollPath(argv[1]);
+        path scrollPath(argv[argi]);
 
         if (!exists(scrollPath))
         {
@@ -84,11 +224,85 @@ int main(int argc, const char * argv[])
 
         memoryManager mm;
 
-        ::array * zeroArray =
-            scrollReader::readLegacy(mm, scroll, 
-                                     static_cast<size_t>(scrollSize));
+        ::array * zeroArray = nullptr;
+
+        /*
+         * The cache needs the whole scroll content to find its file, and the 
+         * scroll is decoded from the same copy if there is none.
+         */
+        unique_ptr<codeCache> cache;
+        vector<char> scrollContent;
+
+        if (!codeCacheDirectory.empty())
+        {
+            cache.reset(new codeCache(codeCacheDirectory));
+
+            scrollContent.resize(static_cast<size_t>(scrollSize));
+            if (!scrollContent.empty()
+                && !scroll.read(&scrollContent[0], scrollContent.size()))
+            {
+                cerr << "Error: Failed to read '" << scrollPath << "'."
+                    << endl;
+                return 2;
+            }
+
+            const char * content =
+                scrollContent.empty() ? "" : &scrollContent[0];
+
+            zeroArray = cache->load(mm, content, scrollContent.size());
+            if (!zeroArray)
+                zeroArray = scrollReader::readLegacy(mm, content,
+                                                     scrollContent.size());
+        }
+        else
+        {
+            zeroArray = scrollReader::readLegacy(
+                mm, scroll, static_cast<size_t>(scrollSize));
+        }
+
+        if (!translationPath.empty())
+        {
+            filesystem::ofstream translation(translationPath,
+                                             ios::out | ios::trunc);
+            translator::translate(*zeroArray, scrollPath.string(),
+                                  translation);
+
+            translation.close();
+            if (!translation)
+            {
+                cerr << "Error: Failed to write '" << translationPath
+                    << "'." << endl;
+                return 2;
+            }
+
+            return 0;
+        }
+
+        context ctx(mm, cin, cout, zeroArray, compilation);
+
+        ctx.writeProtection(writeProtection);
+        ctx.boundsChecks(boundsChecks);
+
+        if (flushInterval >= 0)
+            ctx.flushInterval(static_cast<unsigned int>(flushInterval));
+
+        if (programCacheMegabytes >= 0)
+            ctx.programCacheBudget(
+                static_cast<size_t>(programCacheMegabytes) * 1024 * 1024);
+
+        if (codegenRounds > 0)
+        {
+            codegenBenchmark(ctx, zeroArray->size(), codegenRounds);
+            return 0;
+        }
+
+        if (cache && !zeroArray->nativeCode())
+        {
+            ctx.compile();
+            cache->store(scrollContent.empty() ? "" : &scrollContent[0],
+                         scrollContent.size(), *zeroArray);
+        }
 
-        context ctx(mm, cin, cout, zeroArray);
         ctx.run();
     }
     catch (const std::exception & e)
@@ -103,5 +317,93 @@ int main(int argc, const char * argv[])
 void usage(ostream & os)
 {
     os << "Usage:" << endl
-        << "    um <\"program\" scroll file name>" << endl;
+        << "    um [--lazy | --strided | --interpret | --tiered | --traced]"
+        << endl
+        << "       [--write-protect] [--check-bounds]" << endl
+        << "       [--flush-interval <ms>] [--program-cache <megabytes>]"
+        << endl
+        << "       [--codegen-benchmark <rounds>] [--code-cache <directory>]"
+        << endl
+        << "       [--translate <file>]" << endl
+        << "       <\"program\" scroll file name>" << endl
+        << endl
+        << "    --lazy  Compile basic blocks the first time they are executed "
+                       "instead of" << endl
+        << "            compiling whole arrays up front." << endl
+        << "    --strided" << endl
+        << "            Put code for every platter into a slot of the same "
+                       "size, so that" << endl
+        << "            platter code is addressed without a jump table." << endl
+        << "    --interpret" << endl
+        << "            Do not generate native code, run the program with a "
+                       "portable" << endl
+        << "            interpreter." << endl
+        << "    --tiered" << endl
+        << "            Interpret programs first and compile only the ones "
+                       "that are" << endl
+        << "            loaded or loop often enough." << endl
+        << "    --traced" << endl
+        << "            Compile whole arrays and additionally record and "
+                       "compile traces" << endl
+        << "            of loops that jump back often enough." << endl
+        << "    --write-protect" << endl
+        << "            Write protect array 0 instead of checking every array "
+                       "amendment" << endl
+        << "            for a modification of array 0.  Only works on x86-64."
+        << endl
+        << "    --check-bounds" << endl
+        << "            Stop with an error naming the platter when a program "
+                       "accesses an" << endl
+        << "            array that is not allocated or an index past its end."
+        << endl
+        << "            Native code only checks on x86-64." << endl
+        << "    --flush-interval <ms>" << endl
+        << "            Write buffered output once this many milliseconds "
+                       "have passed" << endl
+        << "            since it was written last.  Output is always written "
+                       "when the" << endl
+        << "            program needs input or halts.  0 writes every "
+                       "line.  Default is 100." << endl
+        << "    --program-cache <megabytes>" << endl
+        << "            Keep up to this much native code of arrays that are "
+                       "no longer" << endl
+        << "            array 0, so that loading an array with the same "
+                       "content again" << endl
+        << "            does not compile it.  0 disables the cache.  Default "
+                       "is 64." << endl
+        << "    --codegen-benchmark <rounds>" << endl
+        << "            Do not run the program.  Generate native code for it "
+                       "<rounds>" << endl
+        << "            times and report code generation speed." << endl
+        << "    --code-cache <directory>" << endl
+        << "            Keep native code generated for scrolls in "
+                       "<directory> and reuse" << endl
+        << "            it when the same scroll is run by the same um "
+                       "binary again." << endl
+        << "            Only works with the eager compilation on x86-64."
+        << endl
+        << "    --translate <file>" << endl
+        << "            Do not run the program.  Write C++ source into "
+                       "<file> that, once" << endl
+        << "            compiled with the um sources but main.cpp, runs "
+                       "this program." << endl;
+}
+
+void codegenBenchmark(context & ctx, size_t platters, long rounds)
+{
+    posix_time::ptime start = posix_time::microsec_clock::universal_time();
+
+    for (long i = 0; i < rounds; ++i)
+        ctx.compile();
+
+    posix_time::time_duration elapsed =
+        posix_time::microsec_clock::universal_time() - start;
+
+    double seconds = elapsed.total_microseconds() / 1e6;
+
+    cout << platters << " platters compiled " << rounds << " times in "
+        << fixed << setprecision(3) << seconds << "s, "
+        << setprecision(1)
+        << platters * static_cast<double>(rounds) / seconds / 1e6
+        << "M platters/s" << endl;
 }
@@ -7,7 +7,13 @@
 #include <algorithm>
 #include <sstream>
 
-#include "windows.h"
+#ifdef _WIN32
+# include "windows.h"
+#else
+# include <sys/mman.h>
+# include <unistd.h>
+# include <cerrno>
+#endif
 
 using namespace std;
 
@@ -39,6 +45,30 @@ struct memoryManager::_allocedChunk
 };
 
 
+/*
+ * === memoryManager::_bigChunk ===
+ */
+
+/*
+ * Big chunks are allocated individualy via allocHelper(...).  munmap() needs to 
+ * know the size of the mapping to release it, so it is stored right before 
+ * the usual header.
+ */
+struct memoryManager::_bigChunk
+{
+    /* Value passed to allocHelper(...) when this chunk was allocated. */
+    size_t size;
+
+    /*
+     * Bytes between the start of the mapping and this structure.  Non zero 
+     * only for allocPageAligned(...) chunks.
+     */
+    size_t offset;
+
+    _allocedChunk header;
+};
+
+
 /*
  * === memoryManager ===
  */
@@ -60,6 +90,10 @@ memoryManager::memoryManager()
                   "Smallest chunks should be big enough to contian a header "
                   "and something else.");
 
+    static_assert(sizeof(_allocedChunk) == chunkHeaderSize
+                  && sizeof(_freeChunk) == chunkHeaderSize,
+                  "Native code expects chunk headers of this size.");
+
     /*
      * End of global checks.
      */
@@ -82,7 +116,7 @@ memoryManager::memoryManager()
 memoryManager::~memoryManager()
 {
     BOOST_FOREACH (void * p, _blocks)
-        releaseHelper(p);
+        releaseHelper(p, _allocationSize);
 
     _blocks.clear();
 
@@ -95,13 +129,16 @@ void * memoryManager::alloc(size_t size, bool zero)
     /* Large allocations are forwarded to the default memory allocator. */
     if (size + sizeof(_allocedChunk) > _allChunkSizes.back())
     {
-        void * block = allocHelper(size + sizeof(_allocedChunk), zero);
+        size_t blockSize = size + sizeof(_bigChunk);
+        void * block = allocHelper(blockSize, zero);
 
-        _allocedChunk * header = reinterpret_cast<_allocedChunk *>(block);
+        _bigChunk * bigChunk = reinterpret_cast<_bigChunk *>(block);
 
-        header->index = _bigChunkIndex;
+        bigChunk->size = blockSize;
+        bigChunk->offset = 0;
+        bigChunk->header.index = _bigChunkIndex;
 
-        return reinterpret_cast<char *>(block) + sizeof(header);
+        return reinterpret_cast<char *>(block) + sizeof(_bigChunk);
     }
 
     /*
@@ -134,6 +171,27 @@ void * memoryManager::alloc(size_t size, bool zero)
     return body;
 }
 
+void * memoryManager::allocPageAligned(size_t size, size_t aligned, bool zero)
+{
+    BOOST_ASSERT(aligned <= size);
+
+    size_t page = pageSize();
+
+    /* Mapping starts at a page boundary, byte `aligned' should as well. */
+    size_t offset = (page - (sizeof(_bigChunk) + aligned) % page) % page;
+    size_t blockSize = offset + sizeof(_bigChunk) + size;
+
+    char * block = static_cast<char *>(allocHelper(blockSize, zero));
+
+    _bigChunk * bigChunk = reinterpret_cast<_bigChunk *>(block + offset);
+
+    bigChunk->size = blockSize;
+    bigChunk->offset = offset;
+    bigChunk->header.index = _bigChunkIndex;
+
+    return reinterpret_cast<char *>(bigChunk) + sizeof(_bigChunk);
+}
+
 void memoryManager::release(void * p)
 {
     _allocedChunk * allocedChunk = reinterpret_cast<_allocedChunk *>
@@ -141,7 +199,11 @@ void memoryManager::release(void * p)
 
     if (allocedChunk->index == _bigChunkIndex)
     {
-        releaseHelper(p);
+        _bigChunk * bigChunk = reinterpret_cast<_bigChunk *>
+            (reinterpret_cast<char *>(p) - sizeof(_bigChunk));
+
+        releaseHelper(reinterpret_cast<char *>(bigChunk) - bigChunk->offset,
+                      bigChunk->size);
         return;
     }
 
@@ -154,6 +216,16 @@ void memoryManager::release(void * p)
     _allChunks[index] = freeChunk;
 }
 
+void ** memoryManager::freeLists()
+{
+    return reinterpret_cast<void **>(&_allChunks[0]);
+}
+
+size_t memoryManager::freeListCount() const
+{
+    return _allChunks.size();
+}
+
 memoryManager::_freeChunk *
     memoryManager::prepareNewBlock(size_t chunkSize)
 {
@@ -181,17 +253,51 @@ memoryManager::_freeChunk *
     return firstChunk;
 }
 
-void memoryManager::checkAllocationSize() throw(logic_error)
+size_t memoryManager::pageSize()
 {
+#ifdef _WIN32
     SYSTEM_INFO si;
     GetSystemInfo(&si);
 
-    if (_allocationSize % si.dwPageSize != 0)
+    return si.dwPageSize;
+#else
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+void memoryManager::protect(void * p, size_t size, bool writable)
+    throw(systemError)
+{
+#ifdef _WIN32
+    DWORD oldProtect;
+    BOOL res = VirtualProtect
+        (p                                  /* lpAddress */,
+         size                               /* dwSize */,
+         writable ? PAGE_EXECUTE_READWRITE
+                  : PAGE_EXECUTE_READ       /* flNewProtect */,
+         &oldProtect                        /* lpflOldProtect */
+        );
+
+    if (!res)
+        throw systemError(systemError::getLast);
+#else
+    int prot = PROT_READ | PROT_EXEC | (writable ? PROT_WRITE : 0);
+
+    if (mprotect(p, size, prot) != 0)
+        throw systemError(L"mprotect() failed", systemError::getLast);
+#endif
+}
+
+void memoryManager::checkAllocationSize() throw(logic_error)
+{
+    size_t pageSize = memoryManager::pageSize();
+
+    if (_allocationSize % pageSize != 0)
     {
         ostringstream ss;
 
         ss << "_allocationSize is not a multiple of the system page size: "
-            << _allocationSize << " % " << si.dwPageSize << " != 0";
+            << _allocationSize << " % " << pageSize << " != 0";
 
         throw logic_error(ss.str());
     }
@@ -200,6 +306,7 @@ void memoryManager::checkAllocationSize() throw(logic_error)
 void * memoryManager::allocHelper(size_t size, bool /* zero */) 
     throw(systemError)
 {
+#ifdef _WIN32
     void * p = VirtualAlloc
         (0                        /* lpAddress */,
          size                     /* dwSize */,
@@ -209,14 +316,35 @@ void * memoryManager::allocHelper(size_t size, bool /* zero */)
 
     if (!p)
         throw systemError(systemError::getLast);
+#else
+    /* Anonymous mappings are zero filled, just as VirtualAlloc(...) ones. */
+    void * p = mmap
+        (0                                      /* addr */,
+         size                                   /* length */,
+         PROT_READ | PROT_WRITE | PROT_EXEC     /* prot */,
+         MAP_PRIVATE | MAP_ANONYMOUS            /* flags */,
+         -1                                     /* fd */,
+         0                                      /* offset */
+        );
+
+    if (p == MAP_FAILED)
+        throw systemError(L"mmap() failed", systemError::getLast);
+#endif
 
     return p;
 }
 
-void memoryManager::releaseHelper(void * p) throw(systemError)
+void memoryManager::releaseHelper(void * p, size_t size) throw(systemError)
 {
+#ifdef _WIN32
+    (void) size;
+
     BOOL res = VirtualFree(p, 0, MEM_RELEASE);
 
     if (!res)
         throw systemError(systemError::getLast);
+#else
+    if (munmap(p, size) != 0)
+        throw systemError(L"munmap() failed", systemError::getLast);
+#endif
 }
@@ -6,7 +6,7 @@
 #include <boost/utility.hpp>
 
 #include <vector>
-#include <Stdexcept>
+#include <stdexcept>
 
 
 /*
@@ -25,12 +25,47 @@ public:
     void * alloc(size_t size, bool zero = true);
     void release(void * p);
 
+    /*
+     * Same as alloc(...), but byte `aligned' of the returned block starts a 
+     * memory page and no other block shares the pages that follow it, so 
+     * that they can be protected.  Released with release(...).
+     */
+    void * allocPageAligned(size_t size, size_t aligned, bool zero = true);
+
+    static size_t pageSize();
+
+    /*
+     * Makes pages [p, p + size) read only or writable again.  `p' should be 
+     * at a page boundary.
+     */
+    static void protect(void * p, size_t size, bool writable)
+        throw(exceptions::systemError);
+
+    /*
+     * Native code allocates and releases small arrays itself, taking chunks 
+     * from and putting them back into the free lists directly.  It only needs 
+     * to call alloc(...) when a list is empty.
+     *
+     * Chunks in list i are (1 << (minChunkSizeShift + i)) bytes long and 
+     * start with a chunkHeaderSize bytes long header that holds i.  Free 
+     * chunks hold a pointer to the next free chunk of the same list at the 
+     * same place.  Lists end with a null pointer.
+     *
+     * Returned pointer stays valid for the lifetime of the memory manager.
+     */
+    void ** freeLists();
+    size_t freeListCount() const;
+
+    static const size_t minChunkSizeShift = 5;
+    static const size_t chunkHeaderSize = sizeof(size_t);
+
 private:
     struct _freeChunk;
     struct _allocedChunk;
+    struct _bigChunk;
 
     static const size_t _allocationSize = 1024 * 1024;
-    static const size_t _minChunkSize = 32;
+    static const size_t _minChunkSize = 1 << minChunkSizeShift;
     static const size_t _maxChunkSize = _allocationSize;
 
     /*
@@ -76,8 +111,11 @@ private:
      */
     void * allocHelper(size_t size, bool zero) throw(exceptions::systemError);
 
-    /* Releases a block of memory. */
-    void releaseHelper(void * p) throw(exceptions::systemError);
+    /*
+     * Releases a block of memory.  `size' should be the same value that was 
+     * passed to the allocHelper(...) call that returned `p'.
+     */
+    void releaseHelper(void * p, size_t size) throw(exceptions::systemError);
 };
 
 #endif /* __MEMORY_MANAGER__H */
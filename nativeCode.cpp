@@ -3,9 +3,22 @@
 #include "memoryManager.h"
 #include "jumpTable.h"
 
+#include <algorithm>
+
 #include <boost/assert.hpp>
 
 
+struct nativeCode::_extension
+{
+    _extension * next;
+
+    /* Bytes of native code that follow. */
+    size_t size;
+
+    /* Native code goes here. */
+};
+
+
 nativeCode * nativeCode::create(memoryManager & mm, size_t bytes,
                                 size_t jumpTableSlotCount)
 {
@@ -26,6 +39,7 @@ nativeCode * nativeCode::create(memoryManager & mm, size_t bytes,
      */
     nativeCode * res = ::new(p) nativeCode();
 
+    res->_size = bytes;
     res->_jumpTable = jumpTable::create(mm, jumpTableSlotCount);
 
     return res;
@@ -33,11 +47,16 @@ nativeCode * nativeCode::create(memoryManager & mm, size_t bytes,
 
 nativeCode::nativeCode() throw()
     : _jumpTable(nullptr)
+    , _size(0)
+    , _extensions(nullptr)
+    , _extensionFree(nullptr)
+    , _extensionFreeSize(0)
 { }
 
 nativeCode::~nativeCode()
 {
     BOOST_ASSERT(_jumpTable == nullptr);
+    BOOST_ASSERT(_extensions == nullptr);
 }
 
 void nativeCode::destroy(memoryManager & mm)
@@ -48,6 +67,13 @@ void nativeCode::destroy(memoryManager & mm)
         _jumpTable = nullptr;
     }
 
+    while (_extensions)
+    {
+        _extension * next = _extensions->next;
+        mm.release(_extensions);
+        _extensions = next;
+    }
+
     nativeCode::~nativeCode();
 
     mm.release(this);
@@ -58,6 +84,34 @@ char * nativeCode::begin()
     return reinterpret_cast<char *>(this) + sizeof(nativeCode);
 }
 
+const char * nativeCode::begin() const
+{
+    return reinterpret_cast<const char *>(this) + sizeof(nativeCode);
+}
+
+size_t nativeCode::size() const
+{
+    return _size;
+}
+
+bool nativeCode::contains(const void * address) const
+{
+    const char * a = static_cast<const char *>(address);
+
+    if (a >= begin() && a < begin() + _size)
+        return true;
+
+    for (const _extension * e = _extensions; e; e = e->next)
+    {
+        const char * first = reinterpret_cast<const char *>(e + 1);
+
+        if (a >= first && a < first + e->size)
+            return true;
+    }
+
+    return false;
+}
+
 jumpTable * nativeCode::jumpTable()
 {
     return _jumpTable;
@@ -67,3 +121,67 @@ const jumpTable * nativeCode::jumpTable() const
 {
     return _jumpTable;
 }
+
+char * nativeCode::extend(memoryManager & mm, size_t bytes)
+{
+    if (bytes > _extensionFreeSize)
+    {
+        size_t size = std::max(bytes, _extensionSize - sizeof(_extension));
+
+        _extension * e = static_cast<_extension *>
+            (mm.alloc(sizeof(_extension) + size, false));
+
+        e->next = _extensions;
+        e->size = size;
+        _extensions = e;
+
+        _extensionFree = reinterpret_cast<char *>(e + 1);
+        _extensionFreeSize = size;
+    }
+
+    char * res = _extensionFree;
+
+    _extensionFree += bytes;
+    _extensionFreeSize -= bytes;
+
+    return res;
+}
+
+char * nativeCode::outOfLine(memoryManager & mm, size_t platter,
+                             size_t bytes)
+{
+    std::map<size_t, _outOfLineCode>::iterator p = _outOfLine.find(platter);
+
+    if (p != _outOfLine.end())
+    {
+        if (static_cast<size_t>(p->second.last - p->second.first) >= bytes)
+            return p->second.first;
+
+        _outOfLineStarts.erase(p->second.first);
+    }
+
+    char * res = extend(mm, bytes);
+
+    _outOfLineCode c = { res, res + bytes };
+    _outOfLine[platter] = c;
+    _outOfLineStarts[res] = platter;
+
+    return res;
+}
+
+bool nativeCode::outOfLinePlatter(const void * address, size_t & platter) const
+{
+    const char * a = static_cast<const char *>(address);
+
+    std::map<const char *, size_t>::const_iterator s =
+        _outOfLineStarts.upper_bound(a);
+    if (s == _outOfLineStarts.begin())
+        return false;
+    --s;
+
+    if (a >= _outOfLine.find(s->second)->second.last)
+        return false;
+
+    platter = s->second;
+    return true;
+}
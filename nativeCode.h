@@ -3,6 +3,9 @@
 
 #include <boost/utility.hpp>
 
+#include <map>
+#include <cstddef>
+
 class memoryManager;
 class jumpTable;
 
@@ -15,6 +18,7 @@ class nativeCode: boost::noncopyable
 {
 private:
     friend class context;
+    friend class codeCache;
 
     static nativeCode * create(memoryManager & mm, size_t bytes,
                                size_t jumpTableSlotCount);
@@ -29,14 +33,77 @@ public:
     void destroy(memoryManager & mm);
 
     char * begin();
+    const char * begin() const;
+
+    /*
+     * Number of bytes at begin() that were allocated by create(...).  Memory 
+     * returned by extend(...) is not included.
+     */
+    size_t size() const;
+
+    /*
+     * Whether `address' is in memory allocated by create(...) or 
+     * extend(...).
+     */
+    bool contains(const void * address) const;
 
     class jumpTable * jumpTable();
 
     const class jumpTable * jumpTable() const;
 
+private:
+    /*
+     * Returns memory for `bytes' bytes of native code that is generated after 
+     * this block was created.  It is released when this block is destroyed.
+     */
+    char * extend(memoryManager & mm, size_t bytes);
+
+    /*
+     * Returns memory for `bytes' bytes of code of platter `platter' that does 
+     * not fit its place any more after the platter was modified, see 
+     * context::recompilePlatter(...).  Memory the platter got before is 
+     * reused if it is large enough, otherwise it is not used again.
+     */
+    char * outOfLine(memoryManager & mm, size_t platter, size_t bytes);
+
+    /*
+     * Finds a platter which outOfLine(...) memory holds `address'.  Returns 
+     * false if there is none.
+     */
+    bool outOfLinePlatter(const void * address, size_t & platter) const;
+
 private:
     class jumpTable * _jumpTable;
 
+    size_t _size;
+
+    /*
+     * Memory returned by extend(...) is allocated in chunks of at least this 
+     * size, including the chunk header.
+     */
+    static const size_t _extensionSize = 16 * 1024;
+
+    struct _extension;
+
+    /* Single linked list of chunks allocated by extend(...), last first. */
+    _extension * _extensions;
+
+    /* Part of the first chunk in _extensions that is not used yet. */
+    char * _extensionFree;
+    size_t _extensionFreeSize;
+
+    struct _outOfLineCode
+    {
+        char * first;
+        char * last;
+    };
+
+    /* outOfLine(...) memory of every platter that has it. */
+    std::map<size_t, _outOfLineCode> _outOfLine;
+
+    /* Same platters, by the start of their memory. */
+    std::map<const char *, size_t> _outOfLineStarts;
+
     /* Native code goes here. */
 };
 
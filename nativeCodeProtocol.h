@@ -0,0 +1,499 @@
+#ifndef __NATIVE_CODE_PROTOCOL__H
+#define __NATIVE_CODE_PROTOCOL__H
+
+/*
+ * Conventions shared by context::run() and the native code generators for 
+ * different platforms (contextX86.cpp and contextX64.cpp).
+ *
+ * This header is private to the context implementation.
+ */
+
+#include <cstddef>
+#include <cstring>
+
+
+/*
+ * When native code returns it is expected to put one of these values into 
+ * eax to indicate the reason of the return.
+ */
+namespace nativeCodeReturnValue
+{
+    enum value
+    {
+        /*
+         * ebx: error code
+         *   0 - normal termination
+         *   1 - invalid operator
+         *   2 - execution beyond array size
+         *   3 - division by zero
+         *
+         * ecx: additional value only valid for the following ebx values
+         *   1 - ecx is a value of the plater that was not decoded
+         *
+         * Native code does not check divisors.  Division by zero is 
+         * returned by the fault handler instead, with the division as the 
+         * address to resume at, see context::faultHandler.
+         */
+        halt            = 1,
+
+        /*
+         * ebx: size of the new array
+         */
+        allocation      = 2,
+
+        /*
+         * ebx: an index of an array to abandon
+         */
+        abandonment     = 3,
+
+        /*
+         * ebx: value to output (should be [0, 255])
+         */
+        output          = 4,
+
+        /*
+         * Upon return into the native code:
+         *      eax should contain a character code that was read [0, 255] 
+         *          or ~0 for EOF
+         */
+        input           = 5,
+
+        /*
+         * ebx: an index of an array to be copied into array 0
+         * ecx: an index to set the execution finger to
+         */
+        loadProgram     = 6,
+
+        /*
+         * This code is returned when execution hits a "recompile stub".  
+         * Array 0 native code should be regenerated and execution should be 
+         * restarted from the same platter.
+         *
+         * Recompile stubs are inserted by array amendment operations that 
+         * amend array 0 itself.  This way we are trying to avoid extra 
+         * recompilations if array 0 is modified in more than one spot 
+         * before the modified code is actually executed.
+         *
+         * Execution finger position is calculated by doing a search in the 
+         * jumpTable for the nativeCode before recompilation.  It is not 
+         * very efficient but reduces stub size.  As stub may replace any 
+         * other operator its size is effectively the minimum size for 
+         * native code blocks generated for other operators.  As 
+         * recompilation of a generated native code should not happen often 
+         * this seems like a reasonable optimization.
+         *
+         * On x86-64 the stub is a call to code that is common for the whole 
+         * block.  See jumpTable::commonStub.
+         */
+        recompile       = 7,
+
+        /*
+         * ebx: address of the first character to output
+         * ecx: number of characters to output
+         *
+         * Characters are stored inside the native code block.  See 
+         * context::outputRun.
+         */
+        outputString    = 8,
+
+        /*
+         * ebx: an index of a platter that execution should continue at
+         *
+         * Execution reached a platter that has no native code yet.  Code for 
+         * the basic block that starts at this platter should be generated 
+         * and execution should continue there.  The compile stub that 
+         * returns this code expects the platter index in ecx.  See 
+         * context::compilation::lazy.
+         */
+        compile         = 9,
+
+        /*
+         * ebx: an index of a platter that execution should continue at
+         *
+         * A loadProgram target was jumped to often enough to record a trace 
+         * that starts at it.  The profile stub that returns this code 
+         * expects the platter index in ecx.  See 
+         * context::compilation::traced.
+         */
+        trace           = 10,
+
+        /*
+         * An array amendment is about to modify array 0 while it is shared 
+         * with the array it was loaded from, see array::shared().  The array 
+         * should be copied, then the amendment is executed again from the 
+         * start.
+         */
+        unshare         = 11,
+
+        /*
+         * ebx: an index of a platter that was accessed
+         * ecx: an index of the array that was accessed
+         *
+         * Bounds check of an arrayIndex or arrayAmendment failed, see 
+         * context::boundsChecks(...).  Execution does not continue.
+         */
+        invalidIndex    = 12,
+    };
+};
+
+namespace haltReturnCodes
+{
+    enum value
+    {
+        normalTermination   = 0,
+        invalidOperator     = 1,
+        outOfBoundExecution = 2,
+        /* Value is the index of the dividing platter. */
+        divisionByZero      = 3,
+    };
+};
+
+#if defined(__x86_64__)
+/*
+ * Values passed between context::run() and the native code entry 
+ * trampoline.  Field offsets are encoded in the trampoline in 
+ * contextX64.cpp.
+ */
+struct nativeCodeFrame
+{
+    /* In: rax value on entry.  Result of the previous native call. */
+    size_t eaxValue;
+    /*
+     * In: address to start execution at.  Out: address to resume at, that 
+     * native code returns in rdx.
+     */
+    void * resumeAt;
+    /* In: rsi value on entry. */
+    void * registers;
+    /* In: rdi value on entry. */
+    void * arrays;
+    /* In: rbp value on entry. */
+    void * jumpTable;
+
+    /* Out: rax, rbx and rcx values native code returned with. */
+    size_t returnCode;
+    size_t value1;
+    size_t value2;
+};
+
+static_assert(offsetof(nativeCodeFrame, eaxValue)   == 0
+              && offsetof(nativeCodeFrame, resumeAt)   == 8
+              && offsetof(nativeCodeFrame, registers)  == 16
+              && offsetof(nativeCodeFrame, arrays)     == 24
+              && offsetof(nativeCodeFrame, jumpTable)  == 32
+              && offsetof(nativeCodeFrame, returnCode) == 40
+              && offsetof(nativeCodeFrame, value1)     == 48
+              && offsetof(nativeCodeFrame, value2)     == 56,
+              "nativeCodeFrame layout is encoded in the "
+              "enterNativeCode trampoline.  If it changes the "
+              "trampoline should be updated.");
+
+/*
+ * Native code entry trampoline.  Defined in contextX64.cpp.
+ */
+extern "C" void enterNativeCode(nativeCodeFrame * frame);
+#endif
+
+/*
+ * Size of a platter slot in the context::compilation::strided mode.  A power of 
+ * two, so that native code can calculate slot addresses with a shift.
+ */
+#if defined(__x86_64__)
+const unsigned int codeStrideShift = 4;
+#else
+/* 32-bit code keeps UM registers in memory and is considerably larger. */
+const unsigned int codeStrideShift = 5;
+#endif
+const size_t codeStride = static_cast<size_t>(1) << codeStrideShift;
+
+/*
+ * --- Code generation helper macros ---
+ *
+ * Used by codeFor and codeForOOBStub implementations.
+ *
+ * Expect to, curr and size to be in scope.
+ */
+
+/*
+ * STR is expected to be a litteral string constant and thus include a trailing 
+ * zero bytes that is not copied in the output.
+ */
+#define EMIT_BYTES(STR)                         \
+    if (to)                                     \
+    {                                           \
+        memcpy(curr, STR, sizeof(STR) - 1);     \
+        curr += sizeof(STR) - 1;                \
+    }                                           \
+    size += sizeof(STR) - 1;                    \
+    /* */
+
+#define EMIT_REGISTER_AS_BYTE_DISP(REG)                         \
+    if (to)                                                     \
+    {                                                           \
+        *curr = static_cast<char>(REG * sizeof(unsigned int));  \
+        ++curr;                                                 \
+    }                                                           \
+    ++size;                                                     \
+    /* */
+
+#define EMIT_BYTE(VALUE)                                        \
+    if (to)                                                     \
+    {                                                           \
+        *reinterpret_cast<unsigned char *>(curr) = VALUE;       \
+        ++curr;                                                 \
+    }                                                           \
+    ++size;                                                     \
+    /* */
+
+#define EMIT_WORD(VALUE)                                        \
+    if (to)                                                     \
+    {                                                           \
+        *reinterpret_cast<unsigned int *>(curr) = VALUE;        \
+        curr += sizeof(unsigned int);                           \
+    }                                                           \
+    size += sizeof(unsigned int);                               \
+    /* */
+
+/*
+ * loadProgram code that continues at jump->target directly when ECX, holding 
+ * the new finger position, is equal to it.  See context::directJump.  The 
+ * encoding is the same on x86 and x86-64.
+ */
+const size_t directJumpSize = 13;
+
+#define EMIT_DIRECT_JUMP                                        \
+    if (jump)                                                   \
+    {                                                           \
+        EMIT_BYTES("\x81\xF9");     /* cmp ecx, imm32           */ \
+        EMIT_WORD(static_cast<unsigned int>(jump->target));     \
+        EMIT_BYTES("\x75\x05");     /* jne rel8: 5              */ \
+        jump->branch = curr;                                    \
+        EMIT_BYTE(0xE9);            /* jmp rel32                */ \
+        EMIT_WORD(0);               /*   <target code>          */ \
+    }                                                           \
+    /* */
+
+/*
+ * --- Stencils ---
+ *
+ * Operators that always compile into the same instructions, up to the 
+ * registers they use, are generated by copying a machine code template and 
+ * patching holes in it.  Templates are constant tables prepared at compile 
+ * time, so generating code for such an operator is a copy of the template 
+ * with the operands added in, and its size is known without generating 
+ * anything.
+ */
+const size_t maxStencilSize = 16;
+const size_t maxStencilHoles = 5;
+
+/*
+ * Values that go into stencil holes.  Register holes take one of the first 
+ * three, the rest have a hole kind of their own.
+ */
+namespace stencilOperand
+{
+    enum value
+    {
+        register0,
+        register1,
+        register2,
+        /* 32-bit platter value, orthography only. */
+        imm32,
+        /* disp8 of the first platter in an array, ::array::_plattersOffset */
+        plattersOffset,
+        count
+    };
+};
+
+struct stencil
+{
+    struct hole
+    {
+        enum kind
+        {
+            /* Marks the end of the holes list. */
+            none,
+            /* Register number goes into bits 0-2 (ModRM r/m, SIB base). */
+            lowRegister,
+            /* Register number goes into bits 3-5 (ModRM reg, SIB index). */
+            middleRegister,
+            /* disp8 of the register in the registers array. */
+            registerDisp,
+            /* 4 bytes of stencilOperand::imm32. */
+            imm32,
+            /* 1 byte of stencilOperand::plattersOffset. */
+            plattersOffset
+        };
+
+        unsigned char kind;
+        /* Position of the hole in the template. */
+        unsigned char offset;
+        /* Register holes only.  stencilOperand::register0 to register2. */
+        unsigned char operand;
+    };
+
+    unsigned char size;
+    /* One more for the terminating zero of the STENCIL_CODE string. */
+    unsigned char code[maxStencilSize + 1];
+    hole holes[maxStencilHoles];
+};
+
+/*
+ * STR is a litteral string constant with the template code.  Expands into 
+ * the stencil::size and stencil::code initializers.
+ */
+#define STENCIL_CODE(STR) sizeof(STR) - 1, STR
+
+/*
+ * stencil in the form emitStencil(...) uses.  Template is two little endian 
+ * 64-bit words.  Every operand has a multiplier that puts it into all of its 
+ * holes at once: a hole byte of the multiplier is 1, 8 or 4 for the low, 
+ * middle and displacement register holes.  Register numbers are below 8, 
+ * the first platter offset is below 128 and holes in the same byte use 
+ * different bits, so adding the products never carries from one hole into 
+ * another.
+ */
+struct preparedStencil
+{
+    unsigned long long code[2];
+    unsigned long long multipliers[stencilOperand::count][2];
+    unsigned char size;
+};
+
+constexpr preparedStencil prepareStencil(const stencil & s)
+{
+    preparedStencil r = { };
+
+    r.size = s.size;
+
+    for (size_t i = 0; i < s.size; ++i)
+        r.code[i / 8] |= static_cast<unsigned long long>(s.code[i])
+                         << (i % 8 * 8);
+
+    for (size_t i = 0;
+         i < maxStencilHoles && s.holes[i].kind != stencil::hole::none;
+         ++i)
+    {
+        const stencil::hole & h = s.holes[i];
+
+        unsigned long long * m = nullptr;
+        unsigned long long factor = 0;
+
+        switch (h.kind)
+        {
+            case stencil::hole::lowRegister:
+                m = r.multipliers[h.operand];
+                factor = 1;
+                break;
+
+            case stencil::hole::middleRegister:
+                m = r.multipliers[h.operand];
+                factor = 8;
+                break;
+
+            case stencil::hole::registerDisp:
+                m = r.multipliers[h.operand];
+                factor = sizeof(unsigned int);
+                break;
+
+            case stencil::hole::imm32:
+                /* 32-bit value should not cross the word boundary. */
+                if (h.offset % 8 > 4)
+                    throw "imm32 hole crosses a template word boundary";
+
+                m = r.multipliers[stencilOperand::imm32];
+                factor = 1;
+                break;
+
+            case stencil::hole::plattersOffset:
+                m = r.multipliers[stencilOperand::plattersOffset];
+                factor = 1;
+                break;
+        }
+
+        m[h.offset / 8] += factor << (h.offset % 8 * 8);
+    }
+
+    return r;
+}
+
+/*
+ * Prepared copy of a stencil table.  An array wrapper, so that it can be 
+ * returned from a constexpr function.
+ */
+template <size_t N>
+struct preparedStencils
+{
+    preparedStencil at[N];
+};
+
+template <size_t N>
+constexpr preparedStencils<N> prepareStencils(const stencil (& s)[N])
+{
+    preparedStencils<N> r = { };
+
+    for (size_t i = 0; i < N; ++i)
+        r.at[i] = prepareStencil(s[i]);
+
+    return r;
+}
+
+/* Smallest code size in a stencil table. */
+template <size_t N>
+constexpr size_t minStencilSize(const stencil (& s)[N])
+{
+    size_t r = maxStencilSize;
+
+    for (size_t i = 0; i < N; ++i)
+        if (s[i].size < r)
+            r = s[i].size;
+
+    return r;
+}
+
+/*
+ * Puts code for stencil `s' at `to', unless `to' is nullptr, and returns its 
+ * size.  `operands' are indexed by stencilOperand values.
+ */
+inline size_t emitStencil
+    (const preparedStencil & s,
+     const unsigned int (& operands)[stencilOperand::count], char * to)
+{
+    if (!to)
+        return s.size;
+
+    unsigned long long code[2] = { s.code[0], s.code[1] };
+
+    for (size_t i = 0; i < stencilOperand::count; ++i)
+    {
+        code[0] += operands[i] * s.multipliers[i][0];
+        code[1] += operands[i] * s.multipliers[i][1];
+    }
+
+    /*
+     * Two fixed size copies that overlap in the middle are just two moves, 
+     * while a copy of a variable size is a call.  Code that follows the 
+     * stencil may already be there and should stay intact.
+     */
+    const char * bytes = reinterpret_cast<const char *>(code);
+
+    if (s.size >= 8)
+    {
+        memcpy(to, bytes, 8);
+        memcpy(to + s.size - 8, bytes + s.size - 8, 8);
+    }
+    else if (s.size >= 4)
+    {
+        memcpy(to, bytes, 4);
+        memcpy(to + s.size - 4, bytes + s.size - 4, 4);
+    }
+    else
+    {
+        memcpy(to, bytes, 2);
+        memcpy(to + s.size - 2, bytes + s.size - 2, 2);
+    }
+
+    return s.size;
+}
+
+#endif /* __NATIVE_CODE_PROTOCOL__H */
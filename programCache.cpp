@@ -0,0 +1,153 @@
+#include "programCache.h"
+
+#include "array.h"
+#include "nativeCode.h"
+#include "platter.h"
+#include "utils.h"
+
+#include <cstring>
+
+#include <boost/assert.hpp>
+
+
+using namespace std;
+
+
+namespace
+{
+    unsigned long long hashOf(const ::array & a)
+    {
+        return contentHash(a.platters(), a.size() * sizeof(platter));
+    }
+}
+
+programCache::programCache(memoryManager & mm, size_t budget)
+    : _mm(mm)
+    , _budget(budget)
+    , _used(0)
+{ }
+
+programCache::~programCache()
+{
+    while (!_entries.empty())
+        erase(--_entries.end());
+}
+
+void programCache::budget(size_t bytes)
+{
+    _budget = bytes;
+    evict();
+}
+
+size_t programCache::budget() const
+{
+    return _budget;
+}
+
+size_t programCache::used() const
+{
+    return _used;
+}
+
+void programCache::store(::array * a)
+{
+    BOOST_ASSERT(a->_nativeCode && !a->dirty());
+
+    /*
+     * Jump table is not counted exactly, as the traced compilation mode 
+     * doubles it, but it is the same order of magnitude.
+     */
+    entry e = { hashOf(*a), a,
+                a->size() * sizeof(platter) + a->_nativeCode->size()
+                + (a->size() + 1) * sizeof(void *) };
+
+    if (e.size > _budget)
+    {
+        a->destroy(_mm);
+        return;
+    }
+
+    entries_type::iterator same = find(*a, e.hash);
+    if (same != _entries.end())
+    {
+        _entries.splice(_entries.begin(), _entries, same);
+        a->destroy(_mm);
+        return;
+    }
+
+    _entries.push_front(e);
+    _index.insert(make_pair(e.hash, _entries.begin()));
+    _used += e.size;
+
+    evict();
+}
+
+bool programCache::take(::array & a)
+{
+    if (_entries.empty())
+        return false;
+
+    entries_type::iterator e = find(a, hashOf(a));
+    if (e == _entries.end())
+        return false;
+
+    ::array & cached = *e->a;
+
+    if (a._nativeCode)
+        a._nativeCode->destroy(_mm);
+
+    a._nativeCode = cached._nativeCode;
+    cached._nativeCode = nullptr;
+
+    a._entryCount = cached._entryCount;
+    a._backEdgeCount = cached._backEdgeCount;
+    a.dirty(false);
+
+    erase(e);
+
+    return true;
+}
+
+programCache::entries_type::iterator
+programCache::find(const ::array & a, unsigned long long hash)
+{
+    pair<index_type::iterator, index_type::iterator> range =
+        _index.equal_range(hash);
+
+    for (index_type::iterator i = range.first; i != range.second; ++i)
+    {
+        const ::array & cached = *i->second->a;
+
+        if (cached.size() == a.size()
+            && memcmp(cached.platters(), a.platters(),
+                      a.size() * sizeof(platter)) == 0)
+            return i->second;
+    }
+
+    return _entries.end();
+}
+
+void programCache::erase(entries_type::iterator e)
+{
+    pair<index_type::iterator, index_type::iterator> range =
+        _index.equal_range(e->hash);
+
+    for (index_type::iterator i = range.first; i != range.second; ++i)
+    {
+        if (i->second == e)
+        {
+            _index.erase(i);
+            break;
+        }
+    }
+
+    _used -= e->size;
+    e->a->destroy(_mm);
+    _entries.erase(e);
+}
+
+void programCache::evict()
+{
+    while (_used > _budget)
+        erase(--_entries.end());
+}
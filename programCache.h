@@ -0,0 +1,94 @@
+#ifndef __PROGRAM_CACHE__H
+#define __PROGRAM_CACHE__H
+
+#include <boost/utility.hpp>
+
+#include <list>
+#include <unordered_map>
+#include <cstddef>
+
+class memoryManager;
+class array;
+
+/*
+ * Keeps native code of arrays that stopped being array 0, so that loading an 
+ * array with the same content again does not need a compilation.
+ *
+ * context::loadProgram(...) moves native code back to the array 0 source 
+ * when it loads another array, but only as long as neither of them is 
+ * modified.  Code that would be lost otherwise ends up here, along with the 
+ * platters it was generated for.  Arrays are looked up by a hash of their 
+ * content that is confirmed by comparing the platters.
+ *
+ * The cache holds at most budget() bytes.  Least recently used code is 
+ * destroyed first.
+ */
+class programCache: boost::noncopyable
+{
+public:
+    programCache(memoryManager & mm, size_t budget);
+
+    /* Destroys all the cached arrays. */
+    ~programCache();
+
+    /*
+     * Changes the amount of memory cached arrays may hold.  Zero disables 
+     * the cache.
+     */
+    void budget(size_t bytes);
+    size_t budget() const;
+
+    /* Memory held by the cached arrays. */
+    size_t used() const;
+
+    /*
+     * Takes ownership of `a', that should not be dirty and should have native 
+     * code.  `a' is destroyed right away if it does not fit into the budget 
+     * or an array with the same content is already cached.
+     */
+    void store(array * a);
+
+    /*
+     * Looks for a cached array with the same content as `a'.  If there is 
+     * one, its native code replaces any code `a' has and `a' is no longer 
+     * dirty.
+     *
+     * Returns true if `a' got native code from the cache.
+     */
+    bool take(array & a);
+
+private:
+    struct entry
+    {
+        unsigned long long hash;
+        array * a;
+
+        /* Bytes taken by the platters, native code and jump table. */
+        size_t size;
+    };
+
+    typedef std::list<entry> entries_type;
+    typedef std::unordered_multimap<unsigned long long,
+                                    entries_type::iterator> index_type;
+
+    /* Returns the cached array with the same content as `a', if any. */
+    entries_type::iterator find(const array & a, unsigned long long hash);
+
+    void erase(entries_type::iterator e);
+
+    /* Destroys least recently used arrays until `_used' fits the budget. */
+    void evict();
+
+private:
+    memoryManager & _mm;
+
+    size_t _budget;
+    size_t _used;
+
+    /* Most recently used first. */
+    entries_type _entries;
+
+    index_type _index;
+};
+
+#endif /* __PROGRAM_CACHE__H */
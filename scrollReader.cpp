@@ -4,6 +4,7 @@
 #include <vector>
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "memoryManager.h"
 #include "array.h"
@@ -35,9 +36,33 @@ array * scrollReader::readLegacy(memoryManager & mm,
         throw runtime_error("scroll does not have enough characters");
     }
 
-    platter * platters = res->platters();
-    for (size_t i = 0; i < size / 4; ++i)
-        platters[i] = _byteswap_ulong(platters[i]);
+    swapBytes(*res);
+
+    return res;
+}
+
+array * scrollReader::readLegacy(memoryManager & mm,
+                                 const char * scroll, size_t size)
+    throw(invalid_argument)
+{
+    if (size % 4 != 0)
+        throw invalid_argument("size is not a multiple of 4");
+
+    array * res = array::create(mm, size / 4);
+
+    memcpy(reinterpret_cast<char *>(res->platters()), scroll, size);
+    swapBytes(*res);
 
     return res;
 }
+
+void scrollReader::swapBytes(array & a)
+{
+    platter * platters = a.platters();
+    for (size_t i = 0; i < a.size(); ++i)
+#ifdef _MSC_VER
+        platters[i] = _byteswap_ulong(platters[i]);
+#else
+        platters[i] = __builtin_bswap32(platters[i]);
+#endif
+}
@@ -27,6 +27,19 @@ public:
     static array * readLegacy(memoryManager & mm,
                               std::istream & scroll, size_t size)
         throw(std::invalid_argument, std::runtime_error);
+
+    /*
+     * Same as above, but the scroll is already in memory.
+     *
+     * Throws invalid_argument if size % 4 != 0.
+     */
+    static array * readLegacy(memoryManager & mm,
+                              const char * scroll, size_t size)
+        throw(std::invalid_argument);
+
+private:
+    /* Converts platters read from a scroll into the host byte order. */
+    static void swapBytes(array & a);
 };
 
 #endif /* __SCROLL_READER__H */
@@ -2,10 +2,18 @@
 
 #include "../array.h"
 #include "../platter.h"
+#include "../jumpTable.h"
+#include "../nativeCode.h"
+#include "../codeCache.h"
+#include "../translator.h"
+#include "../nativeCodeProtocol.h"
 
 #include <cpput/assertcommon.h>
 
 #include <boost/assert.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <string>
 
 
 namespace test {
@@ -366,6 +374,57 @@ namespace test {
         CPPUT_ASSERT(os.str() == "Pas", "Output is as expected");
     }
 
+    CPPUT_FIXTURE_TEST(context, testAllocationRefill)
+    {
+        array * pa = array::create(mm, 20);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /*
+         * Registers:
+         * 1 - loop counter
+         * 2 - allocated array index
+         * 3 - allocated array size
+         * 6 - 0xFFFFFFFF
+         * 7 - 0
+         */
+        OP_ORTHOGRAPHY      (0,     1, 40);
+        OP_ORTHOGRAPHY      (1,     3, 3);
+        OP_ORTHOGRAPHY      (2,     7, 0);
+        OP_NOT_AND          (3,     6, 7, 7);
+        OP_ORTHOGRAPHY      (4,     4, 5);
+
+        /* Allocate more arrays than there are free indices at once. */
+        OP_ALLOCATION       (5,     2, 3);
+        OP_ARRAY_AMENDMENT  (6,     2, 7, 1);
+        OP_ADDITION         (7,     1, 1, 6);
+        OP_ORTHOGRAPHY      (8,     5, 11);
+        OP_CONDITIONAL_MOVE (9,     5, 4, 1);
+        OP_LOAD_PROGRAM     (10,    7, 5);
+
+        /* Array that is too large for the native code fast path. */
+        OP_ORTHOGRAPHY      (11,    3, 5000);
+        OP_ALLOCATION       (12,    2, 3);
+        OP_ORTHOGRAPHY      (13,    0, 4999);
+        OP_ORTHOGRAPHY      (14,    5, 'K');
+        OP_ARRAY_AMENDMENT  (15,    2, 0, 5);
+        OP_ARRAY_INDEX      (16,    5, 2, 0);
+        OP_OUTPUT           (17,    5);
+        OP_ABANDONMENT      (18,    2);
+
+        OP_HALT             (19);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "K", "Output is as expected");
+    }
+
     CPPUT_FIXTURE_TEST(context, testLoadProgram)
     {
         array * pa = array::create(mm, 24);
@@ -540,6 +599,535 @@ namespace test {
         CPPUT_ASSERT(os.str() == "1234", "Output is as expected");
     }
 
+    /*
+     * The program copies itself into a new array, abandons the previous copy 
+     * and loads the new one, three times.  Every copy has the same content, 
+     * so code of the previous array 0 is found in the program cache.
+     */
+    CPPUT_FIXTURE_TEST(context, testProgramCache)
+    {
+        array * pa = array::create(mm, 35);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /*
+         * Registers:
+         * 0 - copy index, the array 0 source after the first load
+         * 1 - array size
+         * 2 - source array index = 0
+         * 3 - copy from index
+         * 4 - number of copies loaded
+         * 5 - loop start address
+         * 6 - var1
+         * 7 - var2
+         */
+
+        /* Abandon the array 0 source, unless this is the first run. */
+        OP_ORTHOGRAPHY      (0,     7, 5);
+        OP_ORTHOGRAPHY      (1,     6, 4);
+        OP_CONDITIONAL_MOVE (2,     7, 6, 0);
+        OP_LOAD_PROGRAM     (3,     2, 7);
+        OP_ABANDONMENT      (4,     0);
+
+        OP_ORTHOGRAPHY      (5,     1, 35);
+        OP_ALLOCATION       (6,     0, 1);
+        OP_ORTHOGRAPHY      (7,     3, 0);
+        OP_ORTHOGRAPHY      (8,     5, 9);
+
+        OP_ARRAY_INDEX      (9,     6, 2, 3);
+        OP_ARRAY_AMENDMENT  (10,    0, 3, 6);
+
+        OP_ORTHOGRAPHY      (11,    6, 1);
+        OP_ADDITION         (12,    3, 3, 6);
+
+        /* `6 = `1 xor `3 */
+        SYN_6OP_XOR         (13,    6, 1, 3, /* */ 6, 7);
+
+        /* Loop end address */
+        OP_ORTHOGRAPHY      (19,    7, 22);
+        /* `7 = `5 if `6 != 0 */
+        OP_CONDITIONAL_MOVE (20,    7, 5, 6);
+        OP_LOAD_PROGRAM     (21,    2, 7);
+
+        OP_ORTHOGRAPHY      (22,    6, '.');
+        OP_OUTPUT           (23,    6);
+        OP_ORTHOGRAPHY      (24,    6, 1);
+        OP_ADDITION         (25,    4, 4, 6);
+
+        /* `6 = `4 / 3, not 0 once three copies were loaded */
+        OP_ORTHOGRAPHY      (26,    7, 3);
+        OP_DIVISION         (27,    6, 4, 7);
+
+        /* Load the copy from platter 0 or halt */
+        OP_ADDITION         (28,    7, 0, 2);
+        OP_CONDITIONAL_MOVE (29,    7, 2, 6);
+        OP_ORTHOGRAPHY      (30,    5, 34);
+        OP_ORTHOGRAPHY      (31,    3, 0);
+        OP_CONDITIONAL_MOVE (32,    3, 5, 6);
+        OP_LOAD_PROGRAM     (33,    7, 3);
+
+        OP_HALT             (34);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        /* The same program without the cache. */
+        for (size_t budget = 0; budget < 2; ++budget)
+        {
+            forEachMode(*pa, [&](::context & ctx)
+            {
+                if (budget == 0)
+                    ctx.programCacheBudget(0);
+
+                ctx.run();
+
+                CPPUT_ASSERT(os.str() == "...", "Output is as expected");
+            });
+        }
+
+        pa->destroy(mm);
+    }
+
+    /*
+     * Array 0 and the array it was loaded from are the same array until 
+     * either one is amended.  An amendment of either one should not be 
+     * visible in the other.
+     */
+    CPPUT_FIXTURE_TEST(context, testCopyOnWrite)
+    {
+        array * pa = array::create(mm, 54);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /*
+         * Registers:
+         * 0 - copy index
+         * 1 - array size
+         * 2 - source array index = 0
+         * 3 - copy from index, then the amended platter index
+         * 4 - return address
+         * 5 - loop start address
+         * 6 - var1
+         * 7 - var2
+         */
+
+        /* Copy the whole array 0 into a new array and load it. */
+        OP_ORTHOGRAPHY      (0,     1, 54);
+        OP_ALLOCATION       (1,     0, 1);
+        OP_ORTHOGRAPHY      (2,     3, 0);
+        OP_ORTHOGRAPHY      (3,     5, 4);
+        OP_ARRAY_INDEX      (4,     6, 2, 3);
+        OP_ARRAY_AMENDMENT  (5,     0, 3, 6);
+        OP_ORTHOGRAPHY      (6,     6, 1);
+        OP_ADDITION         (7,     3, 3, 6);
+        SYN_6OP_XOR         (8,     6, 1, 3, /* */ 6, 7);
+        OP_ORTHOGRAPHY      (14,    7, 17);
+        OP_CONDITIONAL_MOVE (15,    7, 5, 6);
+        OP_LOAD_PROGRAM     (16,    2, 7);
+        OP_ORTHOGRAPHY      (17,    7, 19);
+        OP_LOAD_PROGRAM     (18,    0, 7);
+
+        /*
+         * Amend the source: the copy of Y is changed, Y itself is not.  Y 
+         * is called with the return address in `4.
+         */
+        OP_ORTHOGRAPHY      (19,    3, 52);
+        OP_ARRAY_INDEX      (20,    6, 2, 3);
+        OP_ORTHOGRAPHY      (21,    3, 24);
+        OP_ARRAY_AMENDMENT  (22,    0, 3, 6);
+        OP_ORTHOGRAPHY      (23,    4, 27);
+        OP_ORTHOGRAPHY      (24,    6, 'A');
+        OP_OUTPUT           (25,    6);
+        OP_LOAD_PROGRAM     (26,    2, 4);
+
+        /* Output the low byte of the source copy of Y. */
+        OP_ARRAY_INDEX      (27,    6, 0, 3);
+        OP_ORTHOGRAPHY      (28,    7, 255);
+        OP_NOT_AND          (29,    6, 6, 7);
+        OP_NOT_AND          (30,    6, 6, 6);
+        OP_OUTPUT           (31,    6);
+        OP_ORTHOGRAPHY      (32,    7, 34);
+        OP_LOAD_PROGRAM     (33,    0, 7);
+
+        /* Load the source again and amend Z in array 0, but not in the copy. */
+        OP_ORTHOGRAPHY      (34,    3, 53);
+        OP_ARRAY_INDEX      (35,    6, 2, 3);
+        OP_ORTHOGRAPHY      (36,    3, 38);
+        OP_ARRAY_AMENDMENT  (37,    2, 3, 6);
+        OP_ORTHOGRAPHY      (38,    6, 'A');
+        OP_OUTPUT           (39,    6);
+
+        /* Output the low byte of the source copy of Z. */
+        OP_ARRAY_INDEX      (40,    6, 0, 3);
+        OP_ORTHOGRAPHY      (41,    7, 255);
+        OP_NOT_AND          (42,    6, 6, 7);
+        OP_NOT_AND          (43,    6, 6, 6);
+        OP_OUTPUT           (44,    6);
+        OP_ORTHOGRAPHY      (45,    7, 47);
+        OP_LOAD_PROGRAM     (46,    0, 7);
+
+        /* Load the source again and abandon it.  Array 0 keeps it. */
+        OP_ABANDONMENT      (47,    0);
+        OP_ORTHOGRAPHY      (48,    4, 51);
+        OP_ORTHOGRAPHY      (49,    7, 24);
+        OP_LOAD_PROGRAM     (50,    2, 7);
+        OP_HALT             (51);
+
+        /* Data */
+        /* orthography of `B' into 6 */
+        a[nextI++] = 0xDC000000 | 'B';
+        /* orthography of `C' into 6 */
+        a[nextI++] = 0xDC000000 | 'C';
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forEachMode(*pa, [&](::context & ctx)
+        {
+            ctx.run();
+
+            CPPUT_ASSERT(os.str() == "ABCAB", "Output is as expected");
+        });
+
+        pa->destroy(mm);
+    }
+
+    /*
+     * Same as the above, but array 0 is write protected and native code 
+     * amends arrays without checks.  Array 0 is amended while it is shared 
+     * and while it is not, and an array is amended after array 0 left its 
+     * native code with it.
+     */
+    CPPUT_FIXTURE_TEST(context, testWriteProtection)
+    {
+        array * pa = array::create(mm, 44);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /*
+         * Registers:
+         * 0 - first copy index
+         * 1 - array size, then second copy index
+         * 2 - source array index = 0
+         * 3 - copy from index, then the amended platter index
+         * 4 - second copy index, then return address
+         * 5 - loop start address
+         * 6 - var1
+         * 7 - var2
+         */
+
+        /* Make two copies of array 0 and load the first one. */
+        OP_ORTHOGRAPHY      (0,     1, 44);
+        OP_ALLOCATION       (1,     0, 1);
+        OP_ALLOCATION       (2,     4, 1);
+        OP_ORTHOGRAPHY      (3,     3, 0);
+        OP_ORTHOGRAPHY      (4,     5, 5);
+        OP_ARRAY_INDEX      (5,     6, 2, 3);
+        OP_ARRAY_AMENDMENT  (6,     0, 3, 6);
+        OP_ARRAY_AMENDMENT  (7,     4, 3, 6);
+        OP_ORTHOGRAPHY      (8,     6, 1);
+        OP_ADDITION         (9,     3, 3, 6);
+        SYN_6OP_XOR         (10,    6, 1, 3, /* */ 6, 7);
+        OP_ORTHOGRAPHY      (16,    7, 19);
+        OP_CONDITIONAL_MOVE (17,    7, 5, 6);
+        OP_LOAD_PROGRAM     (18,    2, 7);
+        OP_CONDITIONAL_MOVE (19,    1, 4, 1);
+        OP_ORTHOGRAPHY      (20,    7, 22);
+        OP_LOAD_PROGRAM     (21,    0, 7);
+
+        /*
+         * Amend Y in array 0, while it is shared.  Y is called with the 
+         * return address in `4.
+         */
+        OP_ORTHOGRAPHY      (22,    3, 42);
+        OP_ARRAY_INDEX      (23,    6, 2, 3);
+        OP_ORTHOGRAPHY      (24,    3, 27);
+        OP_ARRAY_AMENDMENT  (25,    2, 3, 6);
+        OP_ORTHOGRAPHY      (26,    4, 30);
+        OP_ORTHOGRAPHY      (27,    6, 'A');
+        OP_OUTPUT           (28,    6);
+        OP_LOAD_PROGRAM     (29,    2, 4);
+
+        /*
+         * Load the first copy, where Y is not amended, and then the second 
+         * one.  The first copy keeps its native code.
+         */
+        OP_ORTHOGRAPHY      (30,    7, 32);
+        OP_LOAD_PROGRAM     (31,    0, 7);
+        OP_ORTHOGRAPHY      (32,    7, 34);
+        OP_LOAD_PROGRAM     (33,    1, 7);
+
+        /* Amend Y in the first copy and call it there. */
+        OP_ORTHOGRAPHY      (34,    3, 43);
+        OP_ARRAY_INDEX      (35,    6, 2, 3);
+        OP_ORTHOGRAPHY      (36,    3, 27);
+        OP_ARRAY_AMENDMENT  (37,    0, 3, 6);
+        OP_ORTHOGRAPHY      (38,    4, 41);
+        OP_ORTHOGRAPHY      (39,    7, 27);
+        OP_LOAD_PROGRAM     (40,    0, 7);
+        OP_HALT             (41);
+
+        /* Data */
+        /* orthography of `B' into 6 */
+        a[nextI++] = 0xDC000000 | 'B';
+        /* orthography of `C' into 6 */
+        a[nextI++] = 0xDC000000 | 'C';
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forEachMode(*pa, [&](::context & ctx)
+        {
+            ctx.writeProtection(true);
+
+            ctx.run();
+
+            CPPUT_ASSERT(os.str() == "BC", "Output is as expected");
+        });
+
+        pa->destroy(mm);
+    }
+
+    CPPUT_FIXTURE_TEST(context, testBoundsChecks)
+    {
+        array * pa = array::create(mm, 9);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /*
+         * Amends platters of a 2000 platter array until it runs past the 
+         * end.  The loop is long enough to be compiled in the tiered mode 
+         * and traced in the traced mode.
+         */
+        OP_ORTHOGRAPHY      (0,     0, 2000);
+        OP_ALLOCATION       (1,     1, 0);
+        OP_ORTHOGRAPHY      (2,     2, 0);
+        OP_ORTHOGRAPHY      (3,     3, 1);
+        OP_ORTHOGRAPHY      (4,     4, 0);
+        OP_ORTHOGRAPHY      (5,     5, 6);
+        OP_ARRAY_AMENDMENT  (6,     1, 2, 3);
+        OP_ADDITION         (7,     2, 2, 3);
+        OP_LOAD_PROGRAM     (8,     4, 5);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forEachMode(*pa, [&](::context & ctx)
+        {
+            ctx.boundsChecks(true);
+
+            bool thrown = false;
+            try
+            {
+                ctx.run();
+            }
+            catch (const exceptions::invalidArrayIndex & e)
+            {
+                thrown = true;
+
+                CPPUT_ASSERT(e.index() == 2000,
+                             "Index past the end is reported");
+                CPPUT_ASSERT(e.msg().find(L"at platter 6")
+                             != std::wstring::npos,
+                             "Amendment platter is reported");
+            }
+
+            CPPUT_ASSERT(thrown, "Amendment past the end is caught");
+        }, true);
+
+        pa->destroy(mm);
+    }
+
+    CPPUT_FIXTURE_TEST(context, testAbandonedArrayChecks)
+    {
+        array * pa = array::create(mm, 6);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* Reads an array that was abandoned. */
+        OP_ORTHOGRAPHY      (0,     0, 4);
+        OP_ALLOCATION       (1,     1, 0);
+        OP_ABANDONMENT      (2,     1);
+        OP_ORTHOGRAPHY      (3,     2, 0);
+        OP_ARRAY_INDEX      (4,     3, 1, 2);
+        OP_HALT             (5);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forEachMode(*pa, [&](::context & ctx)
+        {
+            ctx.boundsChecks(true);
+
+            bool thrown = false;
+            try
+            {
+                ctx.run();
+            }
+            catch (const exceptions::invalidArrayIndex & e)
+            {
+                thrown = true;
+
+                CPPUT_ASSERT(e.index() == 1, "Abandoned array is reported");
+                CPPUT_ASSERT(e.msg().find(L"at platter 4")
+                             != std::wstring::npos,
+                             "Array index platter is reported");
+            }
+
+            CPPUT_ASSERT(thrown, "Read of an abandoned array is caught");
+        });
+
+        pa->destroy(mm);
+    }
+
+    /* Check fails in a platter that was compiled as data. */
+    CPPUT_FIXTURE_TEST(context, testDataPlatterChecks)
+    {
+        array * pa = array::create(mm, 14);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* r3 = 6 + 6; goto r3 */
+        OP_ORTHOGRAPHY      (0,     1, 6);
+        OP_ADDITION         (1,     3, 1, 1);
+        OP_ORTHOGRAPHY      (2,     0, 0);
+        OP_ORTHOGRAPHY      (3,     5, 1000);
+        OP_LOAD_PROGRAM     (4,     0, 3);
+        OP_HALT             (5);
+        OP_HALT             (6);
+
+        /* Data */
+        a[nextI++] = 0xFFFFFFFF;
+        a[nextI++] = 0x41424344;
+        a[nextI++] = 0xE0000000;
+        a[nextI++] = 0x00000000;
+        a[nextI++] = 0x00000000;
+
+        /* Not referenced by any orthography, r4 = a[1000] */
+        OP_ARRAY_INDEX      (12,    4, 0, 5);
+        OP_HALT             (13);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forEachMode(*pa, [&](::context & ctx)
+        {
+            ctx.boundsChecks(true);
+
+            bool thrown = false;
+            try
+            {
+                ctx.run();
+            }
+            catch (const exceptions::invalidArrayIndex & e)
+            {
+                thrown = true;
+
+                CPPUT_ASSERT(e.index() == 1000,
+                             "Index past the end is reported");
+                CPPUT_ASSERT(e.msg().find(L"at platter 12")
+                             != std::wstring::npos,
+                             "Array index platter is reported");
+            }
+
+            CPPUT_ASSERT(thrown, "Read past the end is caught");
+        }, true);
+
+        pa->destroy(mm);
+    }
+
+    CPPUT_FIXTURE_TEST(context, testDivisionByZero)
+    {
+        array * pa = array::create(mm, 9);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /*
+         * Divides by a counter that goes down from 2000 to 0.  The loop is 
+         * long enough to be compiled in the tiered mode and traced in the 
+         * traced mode.
+         */
+        OP_ORTHOGRAPHY      (0,     1, 100);
+        OP_ORTHOGRAPHY      (1,     2, 2000);
+        OP_ORTHOGRAPHY      (2,     4, 0);
+        OP_NOT_AND          (3,     4, 4, 4);
+        OP_ORTHOGRAPHY      (4,     5, 6);
+        OP_ORTHOGRAPHY      (5,     6, 0);
+        OP_DIVISION         (6,     3, 1, 2);
+        OP_ADDITION         (7,     2, 2, 4);
+        OP_LOAD_PROGRAM     (8,     6, 5);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forEachMode(*pa, [&](::context & ctx)
+        {
+            ctx.run();
+
+            CPPUT_ASSERT(os.str().find("\nDivision by zero at platter 6\n"
+                                       "Registers: 0x0 0x64 0x0 0x64 "
+                                       "0xFFFFFFFF 0x6 0x0 0x0\n"
+                                       "Array 0: 9 platters, hash 0x")
+                         == 0,
+                         "Division platter and registers are reported");
+        });
+
+        pa->destroy(mm);
+    }
+
+    /*
+     * Same as testDivisionByZero, but the division is put into the loop by
+     * an amendment, so its code is recompiled.
+     */
+    CPPUT_FIXTURE_TEST(context, testRecompiledDivisionByZero)
+    {
+        array * pa = array::create(mm, 13);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     1, 100);
+        OP_ORTHOGRAPHY      (1,     2, 2000);
+        OP_ORTHOGRAPHY      (2,     4, 0);
+        OP_NOT_AND          (3,     4, 4, 4);
+
+        /* a[9] = a[12] */
+        OP_ORTHOGRAPHY      (4,     3, 12);
+        OP_ARRAY_INDEX      (5,     6, 0, 3);
+        OP_ORTHOGRAPHY      (6,     3, 9);
+        OP_ARRAY_AMENDMENT  (7,     0, 3, 6);
+
+        OP_ORTHOGRAPHY      (8,     5, 9);
+        OP_ORTHOGRAPHY      (9,     3, 1);
+        OP_ADDITION         (10,    2, 2, 4);
+        OP_LOAD_PROGRAM     (11,    0, 5);
+
+        OP_DIVISION         (12,    3, 1, 2);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forEachMode(*pa, [&](::context & ctx)
+        {
+            ctx.run();
+
+            CPPUT_ASSERT(os.str().find("\nDivision by zero at platter 9\n"
+                                       "Registers: 0x0 0x64 0x0 0x64 "
+                                       "0xFFFFFFFF 0x9 ")
+                         == 0,
+                         "Recompiled division platter is reported");
+        }, true);
+
+        pa->destroy(mm);
+    }
+
     /* In this test stub completely covers old instruction. */
     CPPUT_FIXTURE_TEST(context, testSelfModifyingCode1)
     {
@@ -624,6 +1212,103 @@ namespace test {
         CPPUT_ASSERT(a[22] == 384, "Value is as expected");
     }
 
+    /*
+     * Modified platters are recompiled in place, into an overflow area and, 
+     * when neither is possible, the whole array is recompiled.
+     */
+    CPPUT_FIXTURE_TEST(context, testSelfModifyingCode3)
+    {
+        array * pa = array::create(mm, 41);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* a[14] = a[30], larger code */
+        OP_ORTHOGRAPHY      (0,     1, 30);
+        OP_ARRAY_INDEX      (1,     2, 7, 1);
+        OP_ORTHOGRAPHY      (2,     1, 14);
+        OP_ARRAY_AMENDMENT  (3,     7, 1, 2);
+
+        /* a[15] = a[31], smaller code */
+        OP_ORTHOGRAPHY      (4,     1, 31);
+        OP_ARRAY_INDEX      (5,     2, 7, 1);
+        OP_ORTHOGRAPHY      (6,     1, 15);
+        OP_ARRAY_AMENDMENT  (7,     7, 1, 2);
+
+        /* a[16] = a[32], larger code that does not fit a branch either */
+        OP_ORTHOGRAPHY      (8,     1, 32);
+        OP_ARRAY_INDEX      (9,     2, 7, 1);
+        OP_ORTHOGRAPHY      (10,    1, 16);
+        OP_ARRAY_AMENDMENT  (11,    7, 1, 2);
+
+        OP_ORTHOGRAPHY      (12,    3, 100);
+        OP_ORTHOGRAPHY      (13,    4, 7);
+
+        OP_ORTHOGRAPHY      (14,    5, 0);
+        OP_ORTHOGRAPHY      (15,    0, 0);
+        OP_ADDITION         (16,    6, 0, 6);
+
+        OP_ORTHOGRAPHY      (17,    1, 40);
+        OP_ARRAY_AMENDMENT  (18,    7, 1, 6);
+        OP_HALT             (19);
+
+        /* Placeholders     (20 - 29) */
+        nextI += 10;
+
+        OP_DIVISION         (30,    5, 3, 4);
+        OP_ADDITION         (31,    6, 5, 6);
+        OP_MULTIPLICATION   (32,    6, 6, 6);
+
+        /* Placeholders     (33 - 40) */
+        nextI += 8;
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        /* (100 / 7) * (100 / 7) */
+        CPPUT_ASSERT(a[40] == 196, "Value is as expected");
+    }
+
+    /* Division by zero in code that was recompiled into an overflow area. */
+    CPPUT_FIXTURE_TEST(context, testSelfModifiedDivisionByZero)
+    {
+        array * pa = array::create(mm, 9);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* a[6] = a[8], larger code */
+        OP_ORTHOGRAPHY      (0,     3, 100);
+        OP_ORTHOGRAPHY      (1,     1, 8);
+        OP_ARRAY_INDEX      (2,     2, 7, 1);
+        OP_ORTHOGRAPHY      (3,     1, 6);
+        OP_ARRAY_AMENDMENT  (4,     7, 1, 2);
+        OP_ORTHOGRAPHY      (5,     4, 0);
+
+        OP_ORTHOGRAPHY      (6,     5, 1);
+        OP_HALT             (7);
+
+        OP_DIVISION         (8,     5, 3, 4);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forEachMode(*pa, [&](::context & ctx)
+        {
+            ctx.run();
+
+            CPPUT_ASSERT(os.str().find("\nDivision by zero at platter 6\n")
+                         == 0,
+                         "Amended division platter is reported");
+        }, true);
+
+        pa->destroy(mm);
+    }
+
     CPPUT_FIXTURE_TEST(context, testExecutionAfterArrayEnd)
     {
         array * pa = array::create(mm, 6);
@@ -680,6 +1365,997 @@ namespace test {
                      "Output is as expected");
     }
 
+    /* Execution may start in the middle of a constant string output. */
+    CPPUT_FIXTURE_TEST(context, testOutputBuffer)
+    {
+        array * pa = array::create(mm, 11);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /*
+         * Registers:
+         * 0 - character to output
+         * 1 - loop counter
+         * 6 - 0xFFFFFFFF
+         * 7 - 0
+         */
+        OP_ORTHOGRAPHY      (0,     1, 100000);
+        OP_ORTHOGRAPHY      (1,     7, 0);
+        OP_NOT_AND          (2,     6, 7, 7);
+        OP_ORTHOGRAPHY      (3,     0, 'x');
+        OP_ORTHOGRAPHY      (4,     4, 5);
+
+        /* Output more characters than the output buffer holds. */
+        OP_OUTPUT           (5,     0);
+        OP_ADDITION         (6,     1, 1, 6);
+        OP_ORTHOGRAPHY      (7,     5, 10);
+        OP_CONDITIONAL_MOVE (8,     5, 4, 1);
+        OP_LOAD_PROGRAM     (9,     7, 5);
+
+        OP_HALT             (10);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == std::string(100000, 'x'),
+                     "Output is as expected");
+    }
+
+    CPPUT_FIXTURE_TEST(context, testInputBuffer)
+    {
+        array * pa = array::create(mm, 10);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /*
+         * Copies input into output until EOF.  EOF value is output as well, 
+         * its low byte is 0xFF.
+         *
+         * Registers:
+         * 1 - input character
+         * 3 - ~input character, 0 on EOF
+         * 6 - loop address
+         * 7 - 0
+         */
+        OP_ORTHOGRAPHY      (0,     7, 0);
+        OP_ORTHOGRAPHY      (1,     6, 2);
+
+        OP_INPUT            (2,     1);
+        OP_NOT_AND          (3,     3, 1, 1);
+        OP_ORTHOGRAPHY      (4,     4, 9);
+        OP_CONDITIONAL_MOVE (5,     4, 6, 3);
+        OP_OUTPUT           (6,     1);
+        OP_LOAD_PROGRAM     (7,     7, 4);
+
+        OP_HALT             (8);
+        OP_HALT             (9);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        std::string input;
+        for (size_t i = 0; i < 100000; ++i)
+            input += static_cast<char>(i % 251);
+        is.str(input);
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == input + static_cast<char>(0xFF),
+                     "Output is as expected");
+    }
+
+    CPPUT_FIXTURE_TEST(context, testOutputRun)
+    {
+        array * pa = array::create(mm, 12);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     0, 'A');
+        OP_OUTPUT           (1,     0);
+        OP_ORTHOGRAPHY      (2,     1, 'B');
+        OP_OUTPUT           (3,     1);
+        OP_ORTHOGRAPHY      (4,     2, 'C');
+        OP_OUTPUT           (5,     2);
+
+        /* Jump to 3 the first time and to 11 the second time. */
+        OP_ORTHOGRAPHY      (6,     3, 3);
+        OP_ORTHOGRAPHY      (7,     5, 11);
+        OP_CONDITIONAL_MOVE (8,     3, 5, 6);
+        OP_ORTHOGRAPHY      (9,     6, 1);
+        OP_LOAD_PROGRAM     (10,    7, 3);
+
+        OP_HALT             (11);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "ABCBC", "Output is as expected");
+    }
+
+    /* Constant string output is modified before it is executed. */
+    CPPUT_FIXTURE_TEST(context, testOutputRunModification)
+    {
+        array * pa = array::create(mm, 10);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     1, 9);
+        OP_ARRAY_INDEX      (1,     2, 7, 1);
+        OP_ORTHOGRAPHY      (2,     1, 6);
+        OP_ARRAY_AMENDMENT  (3,     7, 1, 2);
+
+        OP_ORTHOGRAPHY      (4,     0, 'O');
+        OP_OUTPUT           (5,     0);
+        OP_ORTHOGRAPHY      (6,     0, 'K');
+        OP_OUTPUT           (7,     0);
+
+        OP_HALT             (8);
+
+        OP_ORTHOGRAPHY      (9,     0, '!');
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "O!", "Output is as expected");
+    }
+
+    /*
+     * Operators that update a register in place, or read the same register 
+     * twice, are compiled differently from the ones that use three different 
+     * registers.  Values are read from an array, so that the compiler does 
+     * not know them.  notAnd platters are separated, so that they are not 
+     * compiled as a bitwise run.
+     */
+    CPPUT_FIXTURE_TEST(context, testRegisterAliasing)
+    {
+        array * pa = array::create(mm, 39);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* r0 = 0, that is unknown to the compiler */
+        OP_ORTHOGRAPHY      (0,     1, 1);
+        OP_ALLOCATION       (1,     7, 1);
+        OP_ORTHOGRAPHY      (2,     2, 0);
+        OP_ARRAY_INDEX      (3,     0, 7, 2);
+
+        /* r1 = 5; r2 = 7 */
+        OP_ORTHOGRAPHY      (4,     1, 5);
+        OP_ADDITION         (5,     1, 1, 0);
+        OP_ORTHOGRAPHY      (6,     2, 7);
+        OP_ADDITION         (7,     2, 2, 0);
+
+        OP_ADDITION         (8,     1, 1, 2);   /* r1 = 12  */
+        OP_ADDITION         (9,     2, 1, 2);   /* r2 = 19  */
+        OP_ADDITION         (10,    3, 2, 2);   /* r3 = 38  */
+        OP_MULTIPLICATION   (11,    4, 1, 1);   /* r4 = 144 */
+        OP_MULTIPLICATION   (12,    1, 1, 2);   /* r1 = 228 */
+        OP_ORTHOGRAPHY      (13,    5, 1);
+        OP_MULTIPLICATION   (14,    2, 5, 2);   /* r2 = 19  */
+        OP_OUTPUT           (15,    1);
+        OP_OUTPUT           (16,    2);
+        OP_OUTPUT           (17,    3);
+        OP_OUTPUT           (18,    4);
+
+        /* x = r4 = 0x6C; y = r1 = 0x3A; x & y = 0x28 */
+        OP_ORTHOGRAPHY      (19,    6, 0x6C);
+        OP_ADDITION         (20,    4, 0, 6);
+        OP_ORTHOGRAPHY      (21,    6, 0x3A);
+        OP_ADDITION         (22,    1, 0, 6);
+
+        OP_ADDITION         (23,    6, 4, 0);
+        OP_NOT_AND          (24,    6, 6, 1);   /* r6 = ~(x & y) */
+        OP_ADDITION         (25,    3, 3, 3);
+        OP_NOT_AND          (26,    6, 6, 6);   /* r6 = x & y    */
+        OP_ADDITION         (27,    5, 1, 0);
+        OP_NOT_AND          (28,    5, 4, 5);   /* r5 = ~(x & y) */
+        OP_ADDITION         (29,    3, 3, 3);
+        OP_NOT_AND          (30,    3, 4, 1);   /* r3 = ~(x & y) */
+        OP_ADDITION         (31,    2, 2, 2);
+        OP_NOT_AND          (32,    2, 3, 3);   /* r2 = x & y    */
+        OP_ADDITION         (33,    7, 7, 0);
+        OP_NOT_AND          (34,    5, 5, 5);   /* r5 = x & y    */
+        OP_OUTPUT           (35,    6);
+        OP_OUTPUT           (36,    2);
+        OP_OUTPUT           (37,    5);
+        OP_HALT             (38);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "\xE4\x13\x26\x90" "(((",
+                     "Output is as expected");
+    }
+
+    CPPUT_FIXTURE_TEST(context, testBitwiseRun)
+    {
+        array * pa = array::create(mm, 19);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     1, 'a');
+        OP_ORTHOGRAPHY      (1,     2, 0x20);
+        SYN_6OP_XOR         (2,     3, 1, 2, /* */ 4, 5);
+        OP_OUTPUT           (8,     3);
+
+        /* r6 = r1 or r3 */
+        OP_NOT_AND          (9,     4, 1, 1);
+        OP_NOT_AND          (10,    5, 3, 3);
+        OP_NOT_AND          (11,    6, 4, 5);
+        OP_OUTPUT           (12,    6);
+
+        /* Jump to 10 the first time and to 18 the second time. */
+        OP_ORTHOGRAPHY      (13,    1, 10);
+        OP_ORTHOGRAPHY      (14,    2, 18);
+        OP_CONDITIONAL_MOVE (15,    1, 2, 7);
+        OP_ORTHOGRAPHY      (16,    7, 1);
+        OP_LOAD_PROGRAM     (17,    0, 1);
+
+        OP_HALT             (18);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "Aaa", "Output is as expected");
+    }
+
+    /* A bitwise run is modified before it is executed. */
+    CPPUT_FIXTURE_TEST(context, testBitwiseRunModification)
+    {
+        array * pa = array::create(mm, 10);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     1, 9);
+        OP_ARRAY_INDEX      (1,     2, 7, 1);
+        OP_ORTHOGRAPHY      (2,     1, 5);
+        OP_ARRAY_AMENDMENT  (3,     7, 1, 2);
+
+        OP_ORTHOGRAPHY      (4,     3, 'B');
+        OP_NOT_AND          (5,     4, 3, 3);
+        OP_NOT_AND          (6,     4, 5, 5);
+        OP_OUTPUT           (7,     4);
+
+        OP_HALT             (8);
+
+        OP_NOT_AND          (9,     5, 3, 3);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "B", "Output is as expected");
+    }
+
+    /*
+     * loadProgram targets are known at compile time, but one of them is 
+     * reached with a different value.
+     */
+    CPPUT_FIXTURE_TEST(context, testDirectJump)
+    {
+        array * pa = array::create(mm, 13);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     2, 'A');
+        OP_ORTHOGRAPHY      (1,     1, 6);
+        OP_OUTPUT           (2,     2);
+        OP_LOAD_PROGRAM     (3,     0, 1);
+
+        OP_HALT             (4);
+        OP_HALT             (5);
+
+        OP_ORTHOGRAPHY      (6,     2, 'B');
+        OP_ORTHOGRAPHY      (7,     1, 10);
+        OP_ORTHOGRAPHY      (8,     3, 2);
+        OP_LOAD_PROGRAM     (9,     0, 3);
+
+        OP_ORTHOGRAPHY      (10,    2, 'C');
+        OP_OUTPUT           (11,    2);
+
+        OP_HALT             (12);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "ABC", "Output is as expected");
+    }
+
+    /* Platters that are never executed are never compiled. */
+    CPPUT_FIXTURE_TEST(context, testLazyCompilation)
+    {
+        array * pa = array::create(mm, 9);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     0, 'L');
+        OP_OUTPUT           (1,     0);
+        OP_ORTHOGRAPHY      (2,     1, 6);
+        OP_LOAD_PROGRAM     (3,     7, 1);
+
+        /* Data         (4, 5) */
+        a[nextI++] = 0xE0000000;
+        a[nextI++] = 0xF0000000;
+
+        OP_ORTHOGRAPHY      (6,     0, 'Z');
+        OP_OUTPUT           (7,     0);
+        OP_HALT             (8);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa, ::context::compilation::lazy);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "LZ", "Output is as expected");
+
+        const jumpTable & jt = *a.jumpTable();
+        void * compileStub =
+            jt.commonStubAddress(jumpTable::commonStub::compile);
+
+        CPPUT_ASSERT(jt.address(3) != compileStub,
+                     "Executed platters are compiled");
+        CPPUT_ASSERT(jt.address(4) == compileStub
+                     && jt.address(5) == compileStub,
+                     "Data platters are not compiled");
+        CPPUT_ASSERT(jt.address(6) != compileStub,
+                     "Jump target is compiled");
+    }
+
+    /* Same as testSelfModifyingCode1, but with lazy compilation. */
+    CPPUT_FIXTURE_TEST(context, testLazySelfModifyingCode)
+    {
+        array * pa = array::create(mm, 10);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     0, 'O');
+        OP_OUTPUT           (1,     0);
+
+        OP_ORTHOGRAPHY      (2,     1, 9);
+        OP_ARRAY_INDEX      (3,     2, 7, 1);
+
+        OP_ORTHOGRAPHY      (4,     1, 6);
+        OP_ARRAY_AMENDMENT  (5,     7, 1, 2);
+
+        OP_ORTHOGRAPHY      (6,     0, '*');
+        OP_OUTPUT           (7,     0);
+
+        OP_HALT             (8);
+
+        OP_ORTHOGRAPHY      (9,     0, 'K');
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa, ::context::compilation::lazy);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "OK", "Output is as expected");
+    }
+
+    CPPUT_FIXTURE_TEST(context, testStridedLayout)
+    {
+        array * pa = array::create(mm, 20);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     0, 'A');
+        OP_OUTPUT           (1,     0);
+        OP_ORTHOGRAPHY      (2,     0, 'B');
+        OP_OUTPUT           (3,     0);
+
+        OP_ORTHOGRAPHY      (4,     1, 9);
+        OP_ORTHOGRAPHY      (5,     2, 0);
+        OP_LOAD_PROGRAM     (6,     2, 1);
+
+        OP_HALT             (7);
+        OP_HALT             (8);
+
+        OP_ORTHOGRAPHY      (9,     1, 19);
+        OP_ARRAY_INDEX      (10,    3, 2, 1);
+        OP_ORTHOGRAPHY      (11,    1, 16);
+        OP_ARRAY_AMENDMENT  (12,    2, 1, 3);
+
+        OP_ORTHOGRAPHY      (13,    5, 'C' * 2);
+        OP_ORTHOGRAPHY      (14,    6, 2);
+        OP_ORTHOGRAPHY      (15,    0, '!');
+        OP_ORTHOGRAPHY      (16,    0, '?');
+        OP_OUTPUT           (17,    0);
+
+        OP_HALT             (18);
+
+        OP_DIVISION         (19,    0, 5, 6);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa, ::context::compilation::strided);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "ABC", "Output is as expected");
+    }
+
+    CPPUT_FIXTURE_TEST(context, testInterpreter)
+    {
+        array * pa = array::create(mm, 20);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     0, 'A');
+        OP_OUTPUT           (1,     0);
+        OP_ORTHOGRAPHY      (2,     0, 'B');
+        OP_OUTPUT           (3,     0);
+
+        OP_ORTHOGRAPHY      (4,     1, 9);
+        OP_ORTHOGRAPHY      (5,     2, 0);
+        OP_LOAD_PROGRAM     (6,     2, 1);
+
+        OP_HALT             (7);
+        OP_HALT             (8);
+
+        OP_ORTHOGRAPHY      (9,     1, 19);
+        OP_ARRAY_INDEX      (10,    3, 2, 1);
+        OP_ORTHOGRAPHY      (11,    1, 16);
+        OP_ARRAY_AMENDMENT  (12,    2, 1, 3);
+
+        OP_ORTHOGRAPHY      (13,    5, 'C' * 2);
+        OP_ORTHOGRAPHY      (14,    6, 2);
+        OP_ORTHOGRAPHY      (15,    0, '!');
+        OP_ORTHOGRAPHY      (16,    0, '?');
+        OP_OUTPUT           (17,    0);
+
+        OP_HALT             (18);
+
+        OP_DIVISION         (19,    0, 5, 6);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa, ::context::compilation::interpreted);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "ABC", "Output is as expected");
+    }
+
+    /* A loop gets hot in the interpreter and continues as native code. */
+    CPPUT_FIXTURE_TEST(context, testTieredExecution)
+    {
+        array * pa = array::create(mm, 13);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        OP_ORTHOGRAPHY      (0,     4, 'A');
+        OP_OUTPUT           (1,     4);
+
+        /* r1 = 100000; r7 = -1; r2 = <loop> */
+        OP_ORTHOGRAPHY      (2,     1, 100000);
+        OP_NOT_AND          (3,     7, 0, 0);
+        OP_ORTHOGRAPHY      (4,     2, 5);
+
+        /* loop: --r1; if (r1) goto loop */
+        OP_ADDITION         (5,     1, 1, 7);
+        OP_ORTHOGRAPHY      (6,     3, 9);
+        OP_CONDITIONAL_MOVE (7,     3, 2, 1);
+        OP_LOAD_PROGRAM     (8,     0, 3);
+
+        OP_ORTHOGRAPHY      (9,     4, 'B');
+        OP_OUTPUT           (10,    4);
+        OP_HALT             (11);
+        OP_HALT             (12);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa, ::context::compilation::tiered);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "AB", "Output is as expected");
+        CPPUT_ASSERT(a.nativeCode() != nullptr, "Array 0 was compiled");
+    }
+
+    /*
+     * The same array is loaded as array 0 over and over again and is 
+     * compiled after a while.
+     */
+    CPPUT_FIXTURE_TEST(context, testTieredEntries)
+    {
+        array * pa = array::create(mm, 38);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* r5 = new array[6]; copy platters 32-37 there. */
+        OP_ORTHOGRAPHY      (0,     1, 6);
+        OP_ALLOCATION       (1,     5, 1);
+
+        OP_ORTHOGRAPHY      (2,     1, 32);
+        OP_ARRAY_INDEX      (3,     2, 0, 1);
+        OP_ORTHOGRAPHY      (4,     1, 0);
+        OP_ARRAY_AMENDMENT  (5,     5, 1, 2);
+        OP_ORTHOGRAPHY      (6,     1, 33);
+        OP_ARRAY_INDEX      (7,     2, 0, 1);
+        OP_ORTHOGRAPHY      (8,     1, 1);
+        OP_ARRAY_AMENDMENT  (9,     5, 1, 2);
+        OP_ORTHOGRAPHY      (10,    1, 34);
+        OP_ARRAY_INDEX      (11,    2, 0, 1);
+        OP_ORTHOGRAPHY      (12,    1, 2);
+        OP_ARRAY_AMENDMENT  (13,    5, 1, 2);
+        OP_ORTHOGRAPHY      (14,    1, 35);
+        OP_ARRAY_INDEX      (15,    2, 0, 1);
+        OP_ORTHOGRAPHY      (16,    1, 3);
+        OP_ARRAY_AMENDMENT  (17,    5, 1, 2);
+        OP_ORTHOGRAPHY      (18,    1, 36);
+        OP_ARRAY_INDEX      (19,    2, 0, 1);
+        OP_ORTHOGRAPHY      (20,    1, 4);
+        OP_ARRAY_AMENDMENT  (21,    5, 1, 2);
+        OP_ORTHOGRAPHY      (22,    1, 37);
+        OP_ARRAY_INDEX      (23,    2, 0, 1);
+        OP_ORTHOGRAPHY      (24,    1, 5);
+        OP_ARRAY_AMENDMENT  (25,    5, 1, 2);
+
+        /* r1 = 100; r7 = -1; r4 = 'E'; load r5 */
+        OP_ORTHOGRAPHY      (26,    1, 100);
+        OP_NOT_AND          (27,    7, 0, 0);
+        OP_ORTHOGRAPHY      (28,    4, 'E');
+        OP_ORTHOGRAPHY      (29,    2, 0);
+        OP_LOAD_PROGRAM     (30,    5, 2);
+
+        OP_HALT             (31);
+
+        /*
+         * Loaded as array 0: --r1; reload self at 0 if r1 != 0 and at 4 
+         * otherwise.
+         */
+        OP_ADDITION         (32,    1, 1, 7);
+        OP_ORTHOGRAPHY      (33,    3, 4);
+        OP_CONDITIONAL_MOVE (34,    3, 6, 1);
+        OP_LOAD_PROGRAM     (35,    5, 3);
+        OP_OUTPUT           (36,    4);
+        OP_HALT             (37);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa, ::context::compilation::tiered);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "E", "Output is as expected");
+    }
+
+    /*
+     * Two copies of a program load each other until both are promoted, one
+     * of them from native code, and then the program modifies itself.
+     */
+    CPPUT_FIXTURE_TEST(context, testTieredWriteProtection)
+    {
+        array * pa = array::create(mm, 35);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* r5 = new array[15]; r6 = new array[15]; copy platters 20-34 */
+        OP_ORTHOGRAPHY      (0,     1, 15);
+        OP_ALLOCATION       (1,     5, 1);
+        OP_ALLOCATION       (2,     6, 1);
+        OP_NOT_AND          (3,     7, 0, 0);
+        OP_ORTHOGRAPHY      (4,     2, 5);
+
+        OP_ADDITION         (5,     1, 1, 7);
+        OP_ORTHOGRAPHY      (6,     3, 20);
+        OP_ADDITION         (7,     3, 3, 1);
+        OP_ARRAY_INDEX      (8,     4, 0, 3);
+        OP_ARRAY_AMENDMENT  (9,     5, 1, 4);
+        OP_ARRAY_AMENDMENT  (10,    6, 1, 4);
+        OP_ORTHOGRAPHY      (11,    3, 15);
+        OP_CONDITIONAL_MOVE (12,    3, 2, 1);
+        OP_ORTHOGRAPHY      (13,    0, 0);
+        OP_LOAD_PROGRAM     (14,    0, 3);
+
+        /* r1 = 15; load r5 */
+        OP_ORTHOGRAPHY      (15,    4, 'a');
+        OP_OUTPUT           (16,    4);
+        OP_ORTHOGRAPHY      (17,    4, 0);
+        OP_ORTHOGRAPHY      (18,    1, 15);
+        OP_LOAD_PROGRAM     (19,    5, 4);
+
+        /*
+         * Loaded as array 0: --r1; swap r5 and r6; load r5 at 0 if r1 != 0.
+         * Otherwise a[11] = a[14] and output r4.
+         */
+        OP_ADDITION         (20,    1, 1, 7);
+        OP_ADDITION         (21,    2, 5, 0);
+        OP_ADDITION         (22,    5, 6, 0);
+        OP_ADDITION         (23,    6, 2, 0);
+        OP_ORTHOGRAPHY      (24,    3, 7);
+        OP_CONDITIONAL_MOVE (25,    3, 4, 1);
+        OP_LOAD_PROGRAM     (26,    5, 3);
+        OP_ORTHOGRAPHY      (27,    2, 14);
+        OP_ARRAY_INDEX      (28,    3, 0, 2);
+        OP_ORTHOGRAPHY      (29,    2, 11);
+        OP_ARRAY_AMENDMENT  (30,    0, 2, 3);
+        OP_ORTHOGRAPHY      (31,    4, 'b');
+        OP_OUTPUT           (32,    4);
+        OP_HALT             (33);
+        OP_ORTHOGRAPHY      (34,    4, 'Z');
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forMode(::context::compilation::tiered, *pa, [&](::context & ctx)
+        {
+            ctx.run();
+
+            CPPUT_ASSERT(os.str() == "aZ", "Modification is executed");
+        }, true);
+
+        pa->destroy(mm);
+    }
+
+    /*
+     * Hot loop is traced.  It amends another array and divides, and exits 
+     * the trace once the loop condition changes.
+     */
+    CPPUT_FIXTURE_TEST(context, testTracedExecution)
+    {
+        array * pa = array::create(mm, 20);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* r1 = 5000; r7 = -1; r2 = <loop>; r5 = new array[1]; r6 = 3 */
+        OP_ORTHOGRAPHY      (0,     1, 5000);
+        OP_NOT_AND          (1,     7, 0, 0);
+        OP_ORTHOGRAPHY      (2,     2, 7);
+        OP_ORTHOGRAPHY      (3,     6, 1);
+        OP_ALLOCATION       (4,     5, 6);
+        OP_ORTHOGRAPHY      (5,     6, 3);
+        OP_ORTHOGRAPHY      (6,     0, 0);
+
+        /* loop: r5[0] += r1 / 3; --r1; if (r1) goto loop */
+        OP_DIVISION         (7,     3, 1, 6);
+        OP_ARRAY_INDEX      (8,     4, 5, 0);
+        OP_ADDITION         (9,     4, 4, 3);
+        OP_ARRAY_AMENDMENT  (10,    5, 0, 4);
+        OP_ADDITION         (11,    1, 1, 7);
+        OP_ORTHOGRAPHY      (12,    3, 15);
+        OP_CONDITIONAL_MOVE (13,    3, 2, 1);
+        OP_LOAD_PROGRAM     (14,    0, 3);
+
+        /* r5[0] is 4165833, output its lowest byte: 0xC9 */
+        OP_ARRAY_INDEX      (15,    4, 5, 0);
+        OP_OUTPUT           (16,    4);
+        OP_ORTHOGRAPHY      (17,    4, 'F');
+        OP_OUTPUT           (18,    4);
+        OP_HALT             (19);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa, ::context::compilation::traced);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "\xC9" "F", "Output is as expected");
+    }
+
+    CPPUT_FIXTURE_TEST(context, testDataPlatters)
+    {
+        array * pa = array::create(mm, 16);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* r3 = 5 + 6; goto r3 */
+        OP_ORTHOGRAPHY      (0,     1, 5);
+        OP_ORTHOGRAPHY      (1,     2, 6);
+        OP_ADDITION         (2,     3, 1, 2);
+        OP_ORTHOGRAPHY      (3,     0, 0);
+        OP_LOAD_PROGRAM     (4,     0, 3);
+        OP_HALT             (5);
+        OP_HALT             (6);
+
+        /* Data */
+        a[nextI++] = 0xFFFFFFFF;
+        a[nextI++] = 0x41424344;
+        a[nextI++] = 0xE0000000;
+        a[nextI++] = 0x00000000;
+
+        /*
+         * No orthography loads 11 and nothing falls through into it, so it 
+         * looks like data too, but it is executed.
+         */
+        OP_ORTHOGRAPHY      (11,    4, 'O');
+        OP_OUTPUT           (12,    4);
+        OP_ORTHOGRAPHY      (13,    4, 'K');
+        OP_OUTPUT           (14,    4);
+        OP_HALT             (15);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run();
+
+        CPPUT_ASSERT(os.str() == "OK", "Output is as expected");
+    }
+
+    /* Platter that looks like data is executed and halts the machine. */
+    CPPUT_FIXTURE_TEST(context, testDataPlatterHalt)
+    {
+        array * pa = array::create(mm, 13);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* r3 = 5 + 6; goto r3 */
+        OP_ORTHOGRAPHY      (0,     1, 5);
+        OP_ORTHOGRAPHY      (1,     2, 6);
+        OP_ADDITION         (2,     3, 1, 2);
+        OP_ORTHOGRAPHY      (3,     0, 0);
+        OP_LOAD_PROGRAM     (4,     0, 3);
+        OP_HALT             (5);
+        OP_HALT             (6);
+
+        /* Data */
+        a[nextI++] = 0xFFFFFFFF;
+        a[nextI++] = 0x41424344;
+        a[nextI++] = 0xE0000000;
+        a[nextI++] = 0x00000000;
+
+        /* Not referenced by any orthography, r4 = 5 / 0 */
+        OP_DIVISION         (11,    4, 1, 0);
+        OP_HALT             (12);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        forEachMode(*pa, [&](::context & ctx)
+        {
+            ctx.run();
+
+            CPPUT_ASSERT(os.str().find("\nDivision by zero at platter 11\n")
+                         == 0,
+                         "Division in a data platter is reported");
+        });
+
+        pa->destroy(mm);
+    }
+
+    CPPUT_FIXTURE_TEST(context, testCodeCache)
+    {
+        namespace fs = boost::filesystem;
+
+        array * pa = array::create(mm, 13);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* r1 = 5; r2 = 'A'; r3 = 1; r7 = -1; r4 = <loop> */
+        OP_ORTHOGRAPHY      (0,     1, 5);
+        OP_ORTHOGRAPHY      (1,     2, 'A');
+        OP_ORTHOGRAPHY      (2,     3, 1);
+        OP_NOT_AND          (3,     7, 0, 0);
+        OP_ORTHOGRAPHY      (4,     4, 6);
+        OP_ORTHOGRAPHY      (5,     0, 0);
+
+        /* loop: output r2++; --r1; if (r1) goto loop */
+        OP_OUTPUT           (6,     2);
+        OP_ADDITION         (7,     2, 2, 3);
+        OP_ADDITION         (8,     1, 1, 7);
+        OP_ORTHOGRAPHY      (9,     5, 12);
+        OP_CONDITIONAL_MOVE (10,    5, 4, 1);
+        OP_LOAD_PROGRAM     (11,    0, 5);
+        OP_HALT             (12);
+
+        BOOST_ASSERT(nextI == a.size());
+
+        /* Scrolls store platters most significant byte first. */
+        std::string scroll;
+        for (size_t i = 0; i < a.size(); ++i)
+            for (int shift = 24; shift >= 0; shift -= 8)
+                scroll += static_cast<char>(a[i] >> shift);
+
+        fs::path directory =
+            fs::temp_directory_path() / fs::unique_path("um-test-%%%%-%%%%");
+
+        {
+            ::codeCache cache(directory);
+
+            ::context ctx(mm, is, os, pa);
+            ctx.compile();
+            cache.store(scroll.data(), scroll.size(), a);
+
+            array * loaded = cache.load(mm, scroll.data(), scroll.size());
+
+#if defined(__x86_64__) && defined(__linux__)
+            CPPUT_ASSERT(loaded != nullptr, "Cached code is found");
+            CPPUT_ASSERT(loaded->nativeCode() != nullptr,
+                         "Native code is loaded with the platters");
+            CPPUT_ASSERT(loaded->size() == a.size()
+                         && std::equal(a.platters(), a.platters() + a.size(),
+                                       loaded->platters()),
+                         "Platters are loaded");
+
+            {
+                std::istringstream loadedIs;
+                std::ostringstream loadedOs;
+
+                ::context loadedCtx(mm, loadedIs, loadedOs, loaded);
+                loadedCtx.run();
+
+                CPPUT_ASSERT(loadedOs.str() == "ABCDE",
+                             "Cached code runs as expected");
+            }
+
+            std::string otherScroll = scroll;
+            otherScroll[3] ^= 1;
+            CPPUT_ASSERT(cache.load(mm, otherScroll.data(), otherScroll.size())
+                         == nullptr,
+                         "Code is not found for a different scroll");
+
+            fs::path file = fs::directory_iterator(directory)->path();
+            fs::resize_file(file, fs::file_size(file) - 1);
+            CPPUT_ASSERT(cache.load(mm, scroll.data(), scroll.size())
+                         == nullptr,
+                         "Damaged cache file is ignored");
+#else
+            CPPUT_ASSERT(loaded == nullptr,
+                         "Nothing is cached on this platform");
+#endif
+
+            ctx.run();
+            CPPUT_ASSERT(os.str() == "ABCDE", "Output is as expected");
+        }
+
+        fs::remove_all(directory);
+    }
+
+}
+
+/*
+ * What translator::translate(...) writes for platters 0 to 6 of the 
+ * testTranslatedCode program.  Execution leaves the translated code at the 
+ * amendment of array 0, so the rest is replaced with a marker the test would 
+ * see if it did not.
+ */
+bool translatedProgram::run(::context & ctx, size_t & fingerPosition)
+{
+    unsigned int r[8];
+    for (size_t i = 0; i < 8; ++i)
+        r[i] = ctx._registers[i];
+
+    size_t target = fingerPosition;
+
+    switch (target)
+    {
+        case 0: goto p0;
+        case 1: goto p1;
+        case 2: goto p2;
+        case 3: goto p3;
+        case 4: goto p4;
+        case 5: goto p5;
+        case 6: goto p6;
+        case 7: goto p7;
+        default: goto outOfBound;
+    }
+
+p0:
+    r[1] = 65u;
+p1:
+    ctx.output(static_cast<unsigned char>(r[1]));
+p2:
+    r[2] = 66u;
+p3:
+    r[3] = 10u;
+p4:
+    r[4] = platters(ctx._arrays[r[0]])[r[3]];
+p5:
+    r[3] = 8u;
+p6:
+    platters(ctx._arrays[r[0]])[r[3]] = r[4];
+    dirty(ctx._arrays[r[0]]);
+    if (r[0] == 0)
+    {
+        fingerPosition = 7;
+        goto leave;
+    }
+p7:
+    ctx.output('X');
+
+outOfBound:
+    ctx.halt(haltReturnCodes::outOfBoundExecution, 0);
+    return false;
+
+leave:
+    for (size_t i = 0; i < 8; ++i)
+        ctx._registers[i] = r[i];
+
+    return true;
+}
+
+namespace test {
+
+    CPPUT_FIXTURE_TEST(context, testTranslatedCode)
+    {
+        array * pa = array::create(mm, 11);
+        array & a = *pa;
+
+        size_t nextI = 0;
+
+        /* Output 'A', then replace platter 8 with a copy of platter 10. */
+        OP_ORTHOGRAPHY      (0,     1, 'A');
+        OP_OUTPUT           (1,     1);
+        OP_ORTHOGRAPHY      (2,     2, 'B');
+        OP_ORTHOGRAPHY      (3,     3, 10);
+        OP_ARRAY_INDEX      (4,     4, 0, 3);
+        OP_ORTHOGRAPHY      (5,     3, 8);
+        OP_ARRAY_AMENDMENT  (6,     0, 3, 4);
+
+        /* The runtime continues here with the modified array 0. */
+        OP_OUTPUT           (7,     1);
+        OP_OUTPUT           (8,     1);
+        OP_HALT             (9);
+        OP_OUTPUT           (10,    2);
+
+        BOOST_ASSERT(nextI == a.size());
+
+
+        ::context ctx(mm, is, os, pa);
+
+        ctx.run(&translatedProgram::run);
+
+        CPPUT_ASSERT(os.str() == "AAB", "Output is as expected");
+    }
+
 #undef GENERAL_OP
 #undef OP_CONDITIONAL_MOVE
 #undef OP_ARRAY_INDEX
@@ -4,6 +4,7 @@
 #include <cpput/testing.h>
 
 #include "../memoryManager.h"
+#include "../array.h"
 #include "../context.h"
 
 #include <sstream>
@@ -17,6 +18,49 @@ namespace test {
         std::ostringstream os;
 
         memoryManager mm;
+
+        /*
+         * Calls `check' once for every compilation mode with a new context 
+         * that runs a clone of `program'.  See forMode(...).
+         */
+        template <typename Check>
+        void forEachMode(array & program, Check check,
+                         bool writeProtection = false)
+        {
+            const ::context::compilation::value modes[] = {
+                ::context::compilation::eager,
+                ::context::compilation::lazy,
+                ::context::compilation::strided,
+                ::context::compilation::interpreted,
+                ::context::compilation::tiered,
+                ::context::compilation::traced
+            };
+
+            for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m)
+                forMode(modes[m], program, check, writeProtection);
+        }
+
+        /*
+         * Calls `check' with a new context that runs a clone of `program' 
+         * in `mode'.  `os' is cleared first.  `check' is expected to run the 
+         * context.  With `writeProtection' it is called twice, with write 
+         * protection off and on.
+         */
+        template <typename Check>
+        void forMode(::context::compilation::value mode, array & program,
+                     Check check, bool writeProtection = false)
+        {
+            for (int protection = 0; protection < (writeProtection ? 2 : 1);
+                 ++protection)
+            {
+                os.str("");
+
+                ::context ctx(mm, is, os, program.clone(mm), mode);
+                ctx.writeProtection(protection != 0);
+
+                check(ctx);
+            }
+        }
     };
 
 }
@@ -1,6 +1,8 @@
 #include "platter.h"
 
 #include "../platter.h"
+#include "../decodedPlatters.h"
+#include "../array.h"
 
 #include <cpput/assertcommon.h>
 
@@ -64,4 +66,59 @@ namespace test {
         CPPUT_ASSERT(value == 0x14C759C, "`value' is 0x14C759C");
     }
 
+    CPPUT_FIXTURE_TEST(platter, testBatchDecode)
+    {
+        /*
+         * Every operator, including the invalid ones, with pseudo random 
+         * fields.  37 platters are decoded in groups of 16 and one by one.
+         */
+        const size_t size = 37;
+        ::array * a = ::array::create(mm, size);
+
+        unsigned int seed = 0x2545F491;
+        for (size_t i = 0; i < size; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            (*a)[i] = static_cast<unsigned int>(i % 16) << 28
+                      | (seed >> 4);
+        }
+
+        decodedPlatters decoded(*a);
+        CPPUT_ASSERT(decoded.size() == size, "All the platters are decoded");
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            unsigned int A = 0, B = 0, C = 0, value = 0;
+
+            if (i % 16 > ::platter::operator_::orthography)
+            {
+                CPPUT_ASSERT(decoded.operators()[i]
+                             == decodedPlatters::invalidOperator,
+                             "Invalid operator is tagged");
+                CPPUT_ASSERT(decoded.values()[i] == (*a)[i],
+                             "Invalid operator value is the platter");
+                continue;
+            }
+
+            ::platter::operator_::value op = (*a)[i].decode(A, B, C, value);
+            CPPUT_ASSERT(decoded.operators()[i] == op,
+                         "Operator matches platter::decode()");
+            CPPUT_ASSERT(decoded.A()[i] == A,
+                         "`A' matches platter::decode()");
+
+            if (op == ::platter::operator_::orthography)
+                CPPUT_ASSERT(decoded.values()[i] == value,
+                             "`value' matches platter::decode()");
+            else
+            {
+                CPPUT_ASSERT(decoded.B()[i] == B,
+                             "`B' matches platter::decode()");
+                CPPUT_ASSERT(decoded.C()[i] == C,
+                             "`C' matches platter::decode()");
+            }
+        }
+
+        a->destroy(mm);
+    }
+
 }
@@ -38,4 +38,18 @@ namespace test {
         CPPUT_ASSERT(a[2] == 0x00aacc33u, "Third platter read correctly");
     }
 
+    CPPUT_FIXTURE_TEST(scrollReader, testReadLegacyFromMemory)
+    {
+        const char scroll[] =
+            "\x12\x34\x56\x78"
+            "\x00\xaa\xcc\x33";
+
+        array * pa = ::scrollReader::readLegacy(mm, scroll, sizeof(scroll) - 1);
+        array & a = *pa;
+
+        CPPUT_ASSERT(a.size() == 2, "Array size is 2");
+        CPPUT_ASSERT(a[0] == 0x12345678u, "First platter read correctly");
+        CPPUT_ASSERT(a[1] == 0x00aacc33u, "Second platter read correctly");
+    }
+
 }
@@ -0,0 +1,323 @@
+#include "translator.h"
+
+#include "array.h"
+#include "platter.h"
+#include "decodedPlatters.h"
+
+#include <ostream>
+#include <iomanip>
+
+
+using namespace std;
+
+
+namespace
+{
+    /* Header of the generated source, up to the platters table. */
+    const char prologue[] =
+        "#include \"context.h\"\n"
+        "#include \"memoryManager.h\"\n"
+        "#include \"nativeCodeProtocol.h\"\n"
+        "#include \"translator.h\"\n"
+        "\n"
+        "#include <iostream>\n"
+        "#include <stdexcept>\n"
+        "\n"
+        "#ifdef _WIN32\n"
+        "# include <io.h>\n"
+        "# include <fcntl.h>\n"
+        "#endif\n"
+        "\n"
+        "\n"
+        "namespace\n"
+        "{\n"
+        "    /*\n"
+        "     * Output buffer flush interval is checked once in this many \n"
+        "     * executed loadProgram operators, as in context::interpret().\n"
+        "     */\n"
+        "    const unsigned int flushCheckPeriod = 64 * 1024;\n"
+        "\n";
+
+    /* Start of translatedProgram::run(...). */
+    const char runPrologue[] =
+        "    };\n"
+        "}\n"
+        "\n"
+        "bool translatedProgram::run(context & ctx, size_t & fingerPosition)\n"
+        "{\n"
+        "    unsigned int r[8];\n"
+        "    for (size_t i = 0; i < 8; ++i)\n"
+        "        r[i] = ctx._registers[i];\n"
+        "\n"
+        "    size_t target = fingerPosition;\n"
+        "\n";
+
+    /* Only needed if the program has loadProgram operators. */
+    const char jumpsPrologue[] =
+        "    unsigned int flushCheckCountdown = flushCheckPeriod;\n"
+        "\n"
+        "dispatch:\n";
+
+    const char outOfBound[] =
+        "outOfBound:\n"
+        "    ctx.halt(haltReturnCodes::outOfBoundExecution, 0);\n"
+        "    return false;\n";
+
+    /* Only needed if array 0 may be modified or replaced. */
+    const char leave[] =
+        "\n"
+        "    /* The runtime continues at fingerPosition. */\n"
+        "leave:\n"
+        "    for (size_t i = 0; i < 8; ++i)\n"
+        "        ctx._registers[i] = r[i];\n"
+        "\n"
+        "    return true;\n";
+
+    /* End of translatedProgram::run(...) and main(). */
+    const char epilogue[] =
+        "}\n"
+        "\n"
+        "int main()\n"
+        "{\n"
+        "    std::ios::sync_with_stdio(false);\n"
+        "\n"
+        "    static char inputBuffer[64 * 1024];\n"
+        "    std::cin.rdbuf()->pubsetbuf(inputBuffer, sizeof(inputBuffer));\n"
+        "\n"
+        "#ifdef _WIN32\n"
+        "    _setmode(_fileno(stdin), _O_BINARY);\n"
+        "    _setmode(_fileno(stdout), _O_BINARY);\n"
+        "#endif\n"
+        "\n"
+        "    try\n"
+        "    {\n"
+        "        memoryManager mm;\n"
+        "\n"
+        "        ::array * zeroArray = ::array::create(mm, platterCount);\n"
+        "        for (size_t i = 0; i < platterCount; ++i)\n"
+        "            (*zeroArray)[i] = platters[i];\n"
+        "\n"
+        "        context ctx(mm, std::cin, std::cout, zeroArray);\n"
+        "        ctx.run(&translatedProgram::run);\n"
+        "    }\n"
+        "    catch (const std::exception & e)\n"
+        "    {\n"
+        "        std::cerr << \"Error: \" << e.what() << std::endl;\n"
+        "        return 2;\n"
+        "    }\n"
+        "\n"
+        "    return 0;\n"
+        "}\n";
+
+    /* Writes the C++ statements that execute platter `i' of `decoded'. */
+    void translatePlatter(const decodedPlatters & decoded, size_t i,
+                          ostream & out)
+    {
+        unsigned int A = decoded.A()[i];
+        unsigned int B = decoded.B()[i];
+        unsigned int C = decoded.C()[i];
+        unsigned int value = decoded.values()[i];
+
+        if (decoded.operators()[i] == decodedPlatters::invalidOperator)
+        {
+            out << "    ctx.halt(haltReturnCodes::invalidOperator, 0x"
+                << hex << value << dec << "u);\n"
+                   "    return false;\n";
+            return;
+        }
+
+        switch (static_cast<platter::operator_::value>(decoded.operators()[i]))
+        {
+            case platter::operator_::conditionalMove:
+                out << "    if (r[" << C << "])\n"
+                       "        r[" << A << "] = r[" << B << "];\n";
+                break;
+
+            case platter::operator_::arrayIndex:
+                out << "    r[" << A << "] = platters(ctx._arrays[r[" << B
+                    << "]])[r[" << C << "]];\n";
+                break;
+
+            case platter::operator_::arrayAmendment:
+                /* Array 0 no longer matches the translation. */
+                out << "    platters(ctx._arrays[r[" << A << "]])[r[" << B
+                    << "]] = r[" << C << "];\n"
+                       "    dirty(ctx._arrays[r[" << A << "]]);\n"
+                       "    if (r[" << A << "] == 0)\n"
+                       "    {\n"
+                       "        fingerPosition = " << i + 1 << ";\n"
+                       "        goto leave;\n"
+                       "    }\n";
+                break;
+
+            case platter::operator_::addition:
+                out << "    r[" << A << "] = r[" << B << "] + r[" << C
+                    << "];\n";
+                break;
+
+            case platter::operator_::multiplication:
+                out << "    r[" << A << "] = r[" << B << "] * r[" << C
+                    << "];\n";
+                break;
+
+            case platter::operator_::division:
+                out << "    if (r[" << C << "] == 0)\n"
+                       "    {\n"
+                       "        for (size_t i = 0; i < 8; ++i)\n"
+                       "            ctx._registers[i] = r[i];\n"
+                       "        ctx.halt(haltReturnCodes::divisionByZero, "
+                    << i << ");\n"
+                       "        return false;\n"
+                       "    }\n"
+                       "    r[" << A << "] = r[" << B << "] / r[" << C
+                    << "];\n";
+                break;
+
+            case platter::operator_::notAnd:
+                out << "    r[" << A << "] = ~(r[" << B << "] & r[" << C
+                    << "]);\n";
+                break;
+
+            case platter::operator_::halt:
+                out << "    ctx.halt(haltReturnCodes::normalTermination, 0);\n"
+                       "    return false;\n";
+                break;
+
+            case platter::operator_::allocation:
+                out << "    r[" << B << "] = static_cast<unsigned int>("
+                       "ctx.allocation(r[" << C << "]));\n";
+                break;
+
+            case platter::operator_::abandonment:
+                out << "    ctx.abandonment(r[" << C << "]);\n";
+                break;
+
+            case platter::operator_::output:
+                out << "    ctx.output(static_cast<unsigned char>(r[" << C
+                    << "]));\n";
+                break;
+
+            case platter::operator_::input:
+                out << "    r[" << C << "] = ctx.input();\n";
+                break;
+
+            case platter::operator_::loadProgram:
+                /*
+                 * Most jumps have a target that is put into the register 
+                 * right before the jump.  The comparison lets the C++ 
+                 * compiler see it and skip the switch.
+                 */
+                out << "    if (--flushCheckCountdown == 0)\n"
+                       "    {\n"
+                       "        flushCheckCountdown = flushCheckPeriod;\n"
+                       "        ctx.flushOutputIfDue();\n"
+                       "    }\n"
+                       "    target = r[" << C << "];\n"
+                       "    if (r[" << B << "] != 0)\n"
+                       "    {\n"
+                       "        ctx.loadProgram(r[" << B << "]);\n"
+                       "        if (target >= ctx._arrays[0]->size())\n"
+                       "            throw exceptions::invalidArrayIndex\n"
+                       "                (L\"loadProgram index out of range\", "
+                       "target);\n"
+                       "        fingerPosition = target;\n"
+                       "        goto leave;\n"
+                       "    }\n";
+
+                if (i > 0
+                    && decoded.operators()[i - 1]
+                       == platter::operator_::orthography
+                    && decoded.A()[i - 1] == C
+                    && decoded.values()[i - 1] < decoded.size())
+                {
+                    out << "    if (target == " << decoded.values()[i - 1]
+                        << ")\n"
+                           "        goto p" << decoded.values()[i - 1] << ";\n";
+                }
+
+                out << "    goto dispatch;\n";
+                break;
+
+            case platter::operator_::orthography:
+                out << "    r[" << A << "] = " << value << "u;\n";
+                break;
+        }
+    }
+}
+
+void translator::translate(const ::array & a, const string & scrollName,
+                           ostream & out)
+{
+    out << "/*\n"
+           " * Generated by um --translate from " << scrollName << ".\n"
+           " */\n";
+
+    out << prologue;
+
+    out << "    const size_t platterCount = " << a.size() << ";\n"
+           "\n"
+           "    const unsigned int platters[] = {\n";
+
+    if (a.size() == 0)
+        out << "        0 /* C++ does not allow empty arrays. */\n";
+
+    out << hex << setfill('0');
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        out << (i % 6 == 0 ? "        " : " ")
+            << "0x" << setw(8) << static_cast<unsigned int>(a[i]) << ",";
+        if (i % 6 == 5 || i + 1 == a.size())
+            out << "\n";
+    }
+    out << dec << setfill(' ');
+
+    decodedPlatters decoded(a);
+
+    bool jumps = false;
+    bool leaves = false;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        switch (decoded.operators()[i])
+        {
+            case platter::operator_::loadProgram:
+                jumps = true;
+                leaves = true;
+                break;
+
+            case platter::operator_::arrayAmendment:
+                leaves = true;
+                break;
+
+            default:
+                ;
+        }
+    }
+
+    out << runPrologue;
+
+    if (jumps)
+        out << jumpsPrologue;
+
+    out << "    switch (target)\n"
+           "    {\n";
+
+    for (size_t i = 0; i < a.size(); ++i)
+        out << "        case " << i << ": goto p" << i << ";\n";
+
+    out << "        default: goto outOfBound;\n"
+           "    }\n"
+           "\n";
+
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        out << "p" << i << ":\n";
+        translatePlatter(decoded, i, out);
+    }
+
+    out << "\n" << outOfBound;
+
+    if (leaves)
+        out << leave;
+
+    out << epilogue;
+}
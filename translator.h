@@ -0,0 +1,65 @@
+#ifndef __TRANSLATOR__H
+#define __TRANSLATOR__H
+
+#include "array.h"
+
+#include <iosfwd>
+#include <string>
+#include <cstddef>
+
+class context;
+
+/*
+ * Translates array 0 of a "program" scroll into C++ source ahead of time. 
+ * Compiled together with all the um sources but main.cpp, the source becomes 
+ * a standalone executable that runs this one scroll.
+ *
+ * Every platter becomes a labeled block of C++ code, so the C++ compiler can 
+ * optimize the whole program.  loadProgram jumps within array 0 go through a 
+ * switch on the target platter.  Everything the translation can not handle 
+ * is left to the runtime: once array 0 is modified or replaced, the context 
+ * continues in its regular compilation mode.
+ */
+class translator
+{
+public:
+    /*
+     * Writes the translation of `a' into `out'.  `scrollName' only goes into 
+     * a comment.
+     */
+    static void translate(const array & a, const std::string & scrollName,
+                          std::ostream & out);
+};
+
+/*
+ * Code generated by translator::translate(...).  Only the generated source 
+ * defines it.  It is a friend of context, so that the translated platters 
+ * work with the machine state directly, as context::interpret(...) does.
+ */
+struct translatedProgram
+{
+    /*
+     * Executes array 0 starting at `fingerPosition'.  See 
+     * context::translatedCode for the return value.
+     */
+    static bool run(context & ctx, size_t & fingerPosition);
+
+private:
+    /*
+     * array::operator[](...) and array::dirty(...) are defined in array.cpp, 
+     * so the compiler of the translated source would have to call them for 
+     * every array access.
+     */
+    static unsigned int * platters(array * a)
+    {
+        return reinterpret_cast<unsigned int *>
+            (reinterpret_cast<char *>(a) + array::_plattersOffset);
+    }
+
+    static void dirty(array * a)
+    {
+        a->_flags |= array::flag::dirty;
+    }
+};
+
+#endif /* __TRANSLATOR__H */
@@ -2,9 +2,12 @@
 
 #include <sstream>
 #include <iomanip>
+#include <cstring>
 
 using namespace std;
 
+#ifdef _WIN32
+
 wstring systemErrorText(DWORD errorCode, DWORD langId)
 {
     HLOCAL pRes = 0;
@@ -64,6 +67,17 @@ wstring COMErrorText(HRESULT hr)
     }
 }
 
+#else /* _WIN32 */
+
+wstring systemErrorText(DWORD errorCode, DWORD /* langId */)
+{
+    const char * text = strerror(static_cast<int>(errorCode));
+
+    return wstring(text, text + strlen(text));
+}
+
+#endif /* _WIN32 */
+
 void quoteAsCommandComponent(wstring & arg)
 {
     /* Check if we need to add quotes. */
@@ -96,6 +110,8 @@ void quoteAsCommandComponent(wstring & arg)
     arg += L'"';
 }
 
+#ifdef _WIN32
+
 /*
  * Creates all the missing directories, making it possible to create a file 
  * with the specified path and an arbitrary name.
@@ -172,6 +188,8 @@ void ensurePathExists(const std::wstring & path)
     }
 }
 
+#endif /* _WIN32 */
+
 wstring getDirectory(const wstring & path) throw()
 {
     if (path.empty())
@@ -187,3 +205,24 @@ wstring getDirectory(const wstring & path) throw()
 
     return path.substr(0, i);
 }
+
+unsigned long long contentHash(const void * data, size_t size) throw()
+{
+    const unsigned long long prime = 0x100000001B3ull;
+    unsigned long long res = 0xCBF29CE484222325ull;
+
+    const char * bytes = static_cast<const char *>(data);
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        unsigned long long word;
+        memcpy(&word, bytes + i, 8);
+        res = (res ^ word) * prime;
+    }
+
+    for (; i < size; ++i)
+        res = (res ^ static_cast<unsigned char>(bytes[i])) * prime;
+
+    return res ^ (res >> 29);
+}
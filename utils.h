@@ -4,6 +4,7 @@
 #include "windows.h"
 
 #include <string>
+#include <cstddef>
 
 #include "exceptions/systemError.h"
 
@@ -13,10 +14,12 @@
  */
 std::wstring systemErrorText(DWORD errorCode, DWORD langId = 0);
 
+#ifdef _WIN32
 /*
  * Returns error text for a system COM error code.
  */
 std::wstring COMErrorText(HRESULT hr);
+#endif
 
 /*
  * Adds double quotes around the string in case they are needed for the string 
@@ -29,12 +32,14 @@ std::wstring COMErrorText(HRESULT hr);
 void quoteAsCommandComponent(std::wstring & arg);
 
 
+#ifdef _WIN32
 /*
  * Creates all the missing directories, making it possible to create a file 
  * with the specified path and an arbitrary name.
  */
 void ensurePathExists(const std::wstring & path)
     throw(exceptions::systemError);
+#endif
 
 /*
  * Remove the last component from a path unless the path ends with a slash.  In 
@@ -45,4 +50,10 @@ void ensurePathExists(const std::wstring & path)
  */
 std::wstring getDirectory(const std::wstring & path) throw();
 
+/*
+ * FNV-1a that consumes 8 bytes at a time.  It is fast rather than strong, so 
+ * data with equal hashes should still be compared.
+ */
+unsigned long long contentHash(const void * data, size_t size) throw();
+
 #endif /* __UTILS_H */
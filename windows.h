@@ -4,8 +4,13 @@
 /*
  * Define WINDOWS_H_INCLUDE_WINDOWS in order to include window operations and 
  * related staff.
+ *
+ * On POSIX hosts only a few definitions that are used by the portable parts of 
+ * the code are provided.  See the end of this file.
  */
 
+#ifdef _WIN32
+
 /* Vista target */
 #define NTDDI_VERSION NTDDI_VISTA
 #define WINVER 0x0600
@@ -188,4 +193,26 @@
 #undef NODEFERWINDOWPOS
 #undef NOMCX
 
+#else /* _WIN32 */
+
+#include <cerrno>
+
+/*
+ * System error codes are errno values.  exceptions::systemError stores them in 
+ * the same field that holds GetLastError() codes on Windows.
+ */
+typedef unsigned long DWORD;
+
+inline DWORD GetLastError()
+{
+    return static_cast<DWORD>(errno);
+}
+
+/* strerror() does not take a language, so language ids are ignored. */
+#define MAKELANGID(p, s) 0
+#define LANG_ENGLISH 0
+#define SUBLANG_ENGLISH_US 0
+
+#endif /* _WIN32 */
+
 #endif /* __WINDOWS_H */